@@ -0,0 +1,579 @@
+
+#include "database/dbpool.h"
+#include "database/dbsim.h"
+using namespace OTL;
+#include <list>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// 连接池基准测试：
+//   pool    - N个线程通过CDBAppConn获取连接、按权重执行语句并持有一段时间后释放，
+//             输出吞吐量及获取/端到端延时的p50/p99/p999
+//   idleset - 对比原实现(std::list + COTLThreadLock)与分片空闲集合CDBConnIdleSet，
+//             输出不同线程数下每秒获取+释放的次数
+//   datetime - 日期时间字符串批量解析/格式化的吞吐
+// 默认使用进程内模拟后端，无需数据库；-b otl -s <连接串> 时连接真实数据库
+
+// 语句混合中的一项
+struct SQueryMix
+{
+    int          nWeight;
+    unsigned int nLatencyUs;    // 模拟后端的执行延时
+    std::string  strSql;
+};
+
+struct SBenchConfig
+{
+    std::string  strMode;       // pool | idleset
+    std::string  strBackend;    // sim | otl
+    std::string  strConn;
+    int          nThreads;
+    int          nSeconds;
+    int          nConnNum;
+    int          nMaxConnNum;
+    int          nWaitMs;       // 获取连接的超时，<0为不等待
+    unsigned int nHoldUs;       // 执行语句后继续持有连接的时间
+    unsigned int nConnectUs;    // 模拟后端的连接延时
+    double       dQueryErrRate; // 模拟后端的错误注入
+    int          nQueryErrCode;
+    double       dConnErrRate;
+    int          nConnErrCode;
+    int          nDisconnectMs; // 模拟后端每隔多久断线一次，0为不断线
+    unsigned int nSeed;
+    int          nThreadCacheMs;// 线程亲和槽位的空闲收回时间，<0为不启用
+    int          nInitParallel; // 初始化时同时建立的连接数
+    std::vector<SQueryMix> vecQuery;
+};
+
+static void usage(const char *prog);
+static bool parse_query_mix(const char *str, std::vector<SQueryMix> &vecQuery);
+static bool parse_error(const char *str, double &dRate, int &nErrCode);
+static int bench_pool(const SBenchConfig &cfg);
+static int bench_idle_set(int nMaxThreads, int nSeconds);
+static int bench_datetime(int nSeconds);
+
+int main(int argc, char** argv)
+{
+    SBenchConfig cfg;
+    cfg.strMode     = "pool";
+    cfg.strBackend  = "sim";
+    cfg.nThreads    = 16;
+    cfg.nSeconds    = 5;
+    cfg.nConnNum    = 8;
+    cfg.nMaxConnNum = 0;
+    cfg.nWaitMs     = 1000;
+    cfg.nHoldUs     = 0;
+    cfg.nConnectUs  = 20000;
+    cfg.dQueryErrRate = 0;
+    cfg.nQueryErrCode = 0;
+    cfg.dConnErrRate  = 0;
+    cfg.nConnErrCode  = 0;
+    cfg.nDisconnectMs = 0;
+    cfg.nSeed         = 1;
+    cfg.nThreadCacheMs = -1;
+    cfg.nInitParallel  = 1;
+    const char *szQuery = "1:200:select 1 from dual";
+
+    for( int i = 1; i < argc; ++i )
+    {
+        std::string strOpt = argv[i];
+        if( strOpt.size() != 2 || strOpt[0] != '-' || i + 1 >= argc )
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *szVal = argv[++i];
+        switch( strOpt[1] )
+        {
+        case 'm': cfg.strMode     = szVal; break;
+        case 'b': cfg.strBackend  = szVal; break;
+        case 's': cfg.strConn     = szVal; break;
+        case 't': cfg.nThreads    = atoi(szVal); break;
+        case 'd': cfg.nSeconds    = atoi(szVal); break;
+        case 'n': cfg.nConnNum    = atoi(szVal); break;
+        case 'x': cfg.nMaxConnNum = atoi(szVal); break;
+        case 'w': cfg.nWaitMs     = atoi(szVal); break;
+        case 'h': cfg.nHoldUs     = (unsigned int)atoi(szVal); break;
+        case 'L': cfg.nConnectUs  = (unsigned int)atoi(szVal); break;
+        case 'q': szQuery         = szVal; break;
+        case 'k': cfg.nDisconnectMs = atoi(szVal); break;
+        case 'r': cfg.nSeed         = (unsigned int)atoi(szVal); break;
+        case 'a': cfg.nThreadCacheMs = atoi(szVal); break;
+        case 'p': cfg.nInitParallel  = atoi(szVal); break;
+        case 'e':
+        case 'c':
+            if( !parse_error(szVal, strOpt[1] == 'e' ? cfg.dQueryErrRate : cfg.dConnErrRate,
+                strOpt[1] == 'e' ? cfg.nQueryErrCode : cfg.nConnErrCode) )
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( cfg.nThreads <= 0 ) cfg.nThreads = 1;
+    if( cfg.nSeconds <= 0 ) cfg.nSeconds = 1;
+
+    if( cfg.strMode == "datetime" )
+    {
+        return bench_datetime(cfg.nSeconds);
+    }
+    if( cfg.strMode == "idleset" )
+    {
+        // 空闲集合获取/释放吞吐，线程数从1倍增到-t
+        return bench_idle_set(cfg.nThreads, cfg.nSeconds);
+    }
+    if( cfg.strMode != "pool" || !parse_query_mix(szQuery, cfg.vecQuery) )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    return bench_pool(cfg);
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [options]\n", prog);
+    printf("  -m pool|idleset|datetime  benchmark mode (pool)\n");
+    printf("  -b sim|otl        backend (sim)\n");
+    printf("  -s conn_str       connection string for the otl backend\n");
+    printf("  -t threads        worker threads (16)\n");
+    printf("  -d seconds        duration (5)\n");
+    printf("  -n conns          initial connections (8)\n");
+    printf("  -x max_conns      pool size limit, 0 for unlimited (0)\n");
+    printf("  -w timeout_ms     acquire timeout, <0 for no wait (1000)\n");
+    printf("  -h hold_us        extra hold time after the query (0)\n");
+    printf("  -L connect_us     simulated connect latency (20000)\n");
+    printf("  -q mix            weight:latency_us:sql;... (1:200:select 1 from dual)\n");
+    printf("  -e rate:ora_code  simulated query error rate, e.g. 0.001:3113\n");
+    printf("  -c rate:ora_code  simulated connect error rate, e.g. 0.1:12541\n");
+    printf("  -k interval_ms    simulated disconnect of all sessions every interval\n");
+    printf("  -r seed           random seed of the simulated backend (1)\n");
+    printf("  -a idle_ms        thread-affine connection slots, reclaimed after idle_ms (off)\n");
+    printf("  -p parallel       connections opened concurrently by Init (1)\n");
+}
+
+// 解析错误注入"rate:ora_code"
+static bool parse_error(const char *str, double &dRate, int &nErrCode)
+{
+    const char *szCode = strchr(str, ':');
+    if( NULL == szCode )
+        return false;
+    dRate    = atof(str);
+    nErrCode = atoi(szCode + 1);
+    return dRate >= 0 && dRate <= 1 && nErrCode > 0;
+}
+
+// 解析语句混合"weight:latency_us:sql;..."
+static bool parse_query_mix(const char *str, std::vector<SQueryMix> &vecQuery)
+{
+    std::string strMix = str;
+    std::string::size_type nPos = 0;
+    while( nPos < strMix.size() )
+    {
+        std::string::size_type nEnd = strMix.find(';', nPos);
+        if( nEnd == std::string::npos )
+            nEnd = strMix.size();
+        std::string strItem = strMix.substr(nPos, nEnd - nPos);
+        nPos = nEnd + 1;
+        if( strItem.empty() )
+            continue;
+
+        std::string::size_type n1 = strItem.find(':');
+        std::string::size_type n2 = (n1 == std::string::npos) ? n1 : strItem.find(':', n1 + 1);
+        if( n2 == std::string::npos )
+        {
+            printf("invalid query mix item: %s\n", strItem.c_str());
+            return false;
+        }
+        SQueryMix mix;
+        mix.nWeight    = atoi(strItem.substr(0, n1).c_str());
+        mix.nLatencyUs = (unsigned int)atoi(strItem.substr(n1 + 1, n2 - n1 - 1).c_str());
+        mix.strSql     = strItem.substr(n2 + 1);
+        if( mix.nWeight <= 0 || mix.strSql.empty() )
+        {
+            printf("invalid query mix item: %s\n", strItem.c_str());
+            return false;
+        }
+        vecQuery.push_back(mix);
+    }
+    return !vecQuery.empty();
+}
+
+static void sleep_ms(int nMs)
+{
+#ifdef _WIN32
+    Sleep(nMs);
+#else
+    usleep(nMs * 1000);
+#endif
+}
+
+/******************************************************************************************/
+// 连接池基准测试
+
+struct SPoolBenchArg
+{
+    const SBenchConfig       * pCfg;
+    CDBConnPool              * pPool;
+    volatile long            * pStop;
+    int                        nTotalWeight;
+    unsigned int               nSeed;
+    long long                  nOps;
+    long long                  nAcquireFails;
+    long long                  nErrors;
+    std::vector<unsigned int>  vecAcquireUs;    // 每次获取连接的耗时
+    std::vector<unsigned int>  vecTotalUs;      // 获取+执行+持有+释放的耗时
+};
+
+static const SQueryMix &pick_query(SPoolBenchArg *pArg)
+{
+    const std::vector<SQueryMix> &vecQuery = pArg->pCfg->vecQuery;
+    if( vecQuery.size() == 1 )
+        return vecQuery[0];
+    pArg->nSeed = pArg->nSeed * 1103515245U + 12345U;
+    int nPick = (int)((pArg->nSeed >> 8) % (unsigned int)pArg->nTotalWeight);
+    for( size_t i = 0; i < vecQuery.size(); ++i )
+    {
+        nPick -= vecQuery[i].nWeight;
+        if( nPick < 0 )
+            return vecQuery[i];
+    }
+    return vecQuery.back();
+}
+
+static void pool_worker(void *pParam)
+{
+    SPoolBenchArg *pArg = (SPoolBenchArg *)pParam;
+    while( 0 == *pArg->pStop )
+    {
+        unsigned long long tBegin = GetTickUs();
+        CDBAppConn conn(pArg->pPool, pArg->pCfg->nWaitMs);
+        unsigned long long tAcquired = GetTickUs();
+        pArg->vecAcquireUs.push_back((unsigned int)(tAcquired - tBegin));
+        if( !conn.Good() )
+        {
+            ++pArg->nAcquireFails;
+            continue;
+        }
+
+        try
+        {
+            conn.Execute(pick_query(pArg).strSql.c_str());
+        }
+        catch( otl_exception & e )
+        {
+            conn.GetErrFromException(e);
+            ++pArg->nErrors;
+        }
+        SleepUs(pArg->pCfg->nHoldUs);
+        conn.Release();
+
+        pArg->vecTotalUs.push_back((unsigned int)(GetTickUs() - tBegin));
+        ++pArg->nOps;
+    }
+}
+
+// 取已排序样本的百分位
+static unsigned int percentile(const std::vector<unsigned int> &vecSorted, double p)
+{
+    if( vecSorted.empty() )
+        return 0;
+    size_t nIndex = (size_t)(p * (vecSorted.size() - 1) + 0.5);
+    return vecSorted[nIndex];
+}
+
+static void print_latency(const char *szName, std::vector<unsigned int> &vecUs)
+{
+    std::sort(vecUs.begin(), vecUs.end());
+    double dAvg = 0;
+    for( size_t i = 0; i < vecUs.size(); ++i )
+        dAvg += vecUs[i];
+    if( !vecUs.empty() )
+        dAvg /= vecUs.size();
+    printf("%-8s latency us: avg %.0f, p50 %u, p99 %u, p999 %u, max %u\n", szName, dAvg,
+        percentile(vecUs, 0.5), percentile(vecUs, 0.99), percentile(vecUs, 0.999),
+        vecUs.empty() ? 0 : vecUs.back());
+}
+
+int bench_pool(const SBenchConfig &cfg)
+{
+    CDBSimBackend simBackend;
+    CDBConnPool   dbpool;
+    std::string   strConn = cfg.strConn;
+    if( cfg.strBackend == "sim" )
+    {
+        simBackend.SetConnectLatency(cfg.nConnectUs);
+        for( size_t i = 0; i < cfg.vecQuery.size(); ++i )
+            simBackend.SetQueryLatency(cfg.vecQuery[i].strSql.c_str(), cfg.vecQuery[i].nLatencyUs);
+        simBackend.SetSeed(cfg.nSeed);
+        simBackend.SetQueryError(cfg.dQueryErrRate, cfg.nQueryErrCode);
+        dbpool.SetBackend(&simBackend);
+        if( strConn.empty() )
+            strConn = "sim";
+    }
+    else if( cfg.strBackend != "otl" || strConn.empty() )
+    {
+        printf("the otl backend needs a connection string (-s)\n");
+        return 1;
+    }
+
+    if( cfg.nMaxConnNum > 0 )
+        dbpool.SetMaxConnNum(cfg.nMaxConnNum);
+    dbpool.SetInitPolicy(cfg.nInitParallel > 0 ? cfg.nInitParallel : 1);
+    int nInitConns = dbpool.Init(strConn.c_str(), cfg.nConnNum);
+    SInitResult initResult;
+    std::string strInit;
+    dbpool.GetInitResult(initResult);
+    initResult.ToString(strInit);
+    printf("%s", strInit.c_str());
+    if( cfg.nConnNum != nInitConns )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return 1;
+    }
+
+    if( cfg.nThreadCacheMs >= 0 )
+        dbpool.EnableThreadCache((unsigned int)cfg.nThreadCacheMs);
+
+    // 登录错误在初始化之后才注入，以免Init失败
+    simBackend.SetConnectError(cfg.dConnErrRate, cfg.nConnErrCode);
+
+    int nTotalWeight = 0;
+    for( size_t i = 0; i < cfg.vecQuery.size(); ++i )
+        nTotalWeight += cfg.vecQuery[i].nWeight;
+
+    volatile long nStop = 0;
+    COTLThread    *pThreads = new COTLThread[cfg.nThreads];
+    SPoolBenchArg *pArgs    = new SPoolBenchArg[cfg.nThreads];
+    for( int i = 0; i < cfg.nThreads; ++i )
+    {
+        pArgs[i].pCfg          = &cfg;
+        pArgs[i].pPool         = &dbpool;
+        pArgs[i].pStop         = &nStop;
+        pArgs[i].nTotalWeight  = nTotalWeight;
+        pArgs[i].nSeed         = 2166136261U ^ (unsigned int)i;
+        pArgs[i].nOps          = 0;
+        pArgs[i].nAcquireFails = 0;
+        pArgs[i].nErrors       = 0;
+    }
+
+    printf("pool benchmark: backend %s, %d threads, %d conns (max %d), wait %d ms, hold %u us, %d s\n",
+        cfg.strBackend.c_str(), cfg.nThreads, cfg.nConnNum, cfg.nMaxConnNum, cfg.nWaitMs, cfg.nHoldUs, cfg.nSeconds);
+
+    unsigned long long tBegin = GetTickUs();
+    for( int i = 0; i < cfg.nThreads; ++i )
+        pThreads[i].Start(pool_worker, &pArgs[i]);
+    unsigned long long tDisconnect = tBegin + cfg.nDisconnectMs * 1000ULL;
+    long nDisconnects = 0;
+    while( GetTickUs() - tBegin < (unsigned long long)cfg.nSeconds * 1000000ULL )
+    {
+        sleep_ms(10);
+        if( cfg.nDisconnectMs > 0 && cfg.strBackend == "sim" && GetTickUs() >= tDisconnect )
+        {
+            // 模拟数据库重启/网络闪断，所有会话需要重连
+            simBackend.DisconnectAll();
+            ++nDisconnects;
+            tDisconnect += cfg.nDisconnectMs * 1000ULL;
+        }
+    }
+    AtomicAdd(&nStop, 1);
+
+    long long nOps = 0, nAcquireFails = 0, nErrors = 0;
+    std::vector<unsigned int> vecAcquireUs, vecTotalUs;
+    for( int i = 0; i < cfg.nThreads; ++i )
+    {
+        pThreads[i].Join();
+        nOps          += pArgs[i].nOps;
+        nAcquireFails += pArgs[i].nAcquireFails;
+        nErrors       += pArgs[i].nErrors;
+        vecAcquireUs.insert(vecAcquireUs.end(), pArgs[i].vecAcquireUs.begin(), pArgs[i].vecAcquireUs.end());
+        vecTotalUs.insert(vecTotalUs.end(), pArgs[i].vecTotalUs.begin(), pArgs[i].vecTotalUs.end());
+    }
+    double dSeconds = (GetTickUs() - tBegin) / 1000000.0;
+    delete [] pThreads;
+    delete [] pArgs;
+
+    printf("throughput: %.0f ops/s (%lld ops, %lld acquire failures, %lld query errors)\n",
+        nOps / dSeconds, nOps, nAcquireFails, nErrors);
+    print_latency("acquire", vecAcquireUs);
+    print_latency("total", vecTotalUs);
+    if( cfg.strBackend == "sim" )
+    {
+        printf("sim backend: %ld sessions, %lld logons, %lld queries, %lld injected errors, %ld disconnects\n",
+            simBackend.GetSessionNum(), simBackend.GetLogonNum(), simBackend.GetQueryNum(),
+            simBackend.GetErrorNum(), nDisconnects);
+    }
+
+    std::string strStats;
+    dbpool.DumpStats(strStats);
+    printf("%s\n", strStats.c_str());
+
+    dbpool.Destroy();
+    return 0;
+}
+
+/******************************************************************************************/
+// 空闲集合获取/释放吞吐
+
+// 原实现：单锁保护的std::list，每次释放分配一个链表节点
+class CListIdleSet
+{
+public:
+    void Push(CDBConn *pConn)
+    {
+        m_Lock.Lock();
+        m_ConnList.push_back(pConn);
+        m_Lock.Unlock();
+    }
+    CDBConn *Pop(void)
+    {
+        CDBConn *pConn = NULL;
+        m_Lock.Lock();
+        if( !m_ConnList.empty() )
+        {
+            pConn = m_ConnList.front();
+            m_ConnList.pop_front();
+        }
+        m_Lock.Unlock();
+        return pConn;
+    }
+private:
+    std::list<CDBConn*> m_ConnList;
+    COTLThreadLock      m_Lock;
+};
+
+struct SBenchArg
+{
+    CListIdleSet   * pList;     // 二者取其一
+    CDBConnIdleSet * pSet;
+    volatile long  * pStop;
+    long long        nOps;
+};
+
+static void bench_worker(void *pParam)
+{
+    SBenchArg *pArg = (SBenchArg *)pParam;
+    long long nOps = 0;
+    while( 0 == *pArg->pStop )
+    {
+        CDBConn *pConn = pArg->pSet ? pArg->pSet->Pop() : pArg->pList->Pop();
+        if( NULL == pConn )
+            continue;
+        if( pArg->pSet )
+            pArg->pSet->Push(pConn);
+        else
+            pArg->pList->Push(pConn);
+        ++nOps;
+    }
+    pArg->nOps = nOps;
+}
+
+static double run_bench(CListIdleSet *pList, CDBConnIdleSet *pSet, int nThreads, int nSeconds)
+{
+    volatile long nStop = 0;
+    COTLThread *pThreads = new COTLThread[nThreads];
+    SBenchArg  *pArgs    = new SBenchArg[nThreads];
+
+    for( int i = 0; i < nThreads; ++i )
+    {
+        pArgs[i].pList = pList;
+        pArgs[i].pSet  = pSet;
+        pArgs[i].pStop = &nStop;
+        pArgs[i].nOps  = 0;
+    }
+
+    unsigned long long tBegin = GetTickUs();
+    for( int i = 0; i < nThreads; ++i )
+        pThreads[i].Start(bench_worker, &pArgs[i]);
+
+    while( GetTickUs() - tBegin < (unsigned long long)nSeconds * 1000000ULL )
+        sleep_ms(10);
+    AtomicAdd(&nStop, 1);
+
+    long long nOps = 0;
+    for( int i = 0; i < nThreads; ++i )
+    {
+        pThreads[i].Join();
+        nOps += pArgs[i].nOps;
+    }
+    double dSeconds = (GetTickUs() - tBegin) / 1000000.0;
+
+    delete [] pThreads;
+    delete [] pArgs;
+    return nOps / dSeconds;
+}
+
+// 空闲集合获取/释放吞吐
+int bench_idle_set(int nMaxThreads, int nSeconds)
+{
+    // 连接数为线程数的2倍，保证基本不会取空；未连接的CDBConn即可满足测试
+    int nConnNum = nMaxThreads * 2;
+    CDBConn *pConns = new CDBConn[nConnNum];
+
+    CListIdleSet   listSet;
+    CDBConnIdleSet shardSet;
+    for( int i = 0; i < nConnNum; ++i )
+    {
+        listSet.Push(&pConns[i]);
+        shardSet.Push(&pConns[i]);
+    }
+
+    printf("idle set acquire+release, %d shards, %d s per run\n", shardSet.GetShardNum(), nSeconds);
+    printf("%8s %18s %18s\n", "threads", "list+lock ops/s", "sharded ops/s");
+    for( int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2 )
+    {
+        double dList  = run_bench(&listSet, NULL, nThreads, nSeconds);
+        double dShard = run_bench(NULL, &shardSet, nThreads, nSeconds);
+        printf("%8d %18.0f %18.0f\n", nThreads, dList, dShard);
+    }
+
+    // 连接对象由数组统一释放，先清空集合
+    while( listSet.Pop() ) {}
+    while( shardSet.Pop() ) {}
+    delete [] pConns;
+    return 0;
+}
+
+/******************************************************************************************/
+// 日期时间批量解析/格式化吞吐
+
+int bench_datetime(int nSeconds)
+{
+    const int nRows = 4096;
+    const int nStride = 32;
+    const char *arrFormat[] = { "%04d-%02d-%02d %02d:%02d:%02d", "%04d%02d%02d %02d:%02d:%02d" };
+    std::vector<char> vecColumn(nRows * nStride);
+    std::vector<otl_datetime> vecDt(nRows);
+    for( int i = 0; i < nRows; ++i )
+    {
+        sprintf(&vecColumn[i * nStride], arrFormat[i % 2], 2000 + i % 30, 1 + i % 12, 1 + i % 28,
+            i % 24, i % 60, (i * 7) % 60);
+    }
+
+    long long nParsed = 0, nFormatted = 0;
+    unsigned long long tBegin = GetTickUs();
+    unsigned long long tHalf = (unsigned long long)nSeconds * 500000ULL;
+    while( GetTickUs() - tBegin < tHalf )
+    {
+        nParsed += ConvertOtlDatetimes(&vecDt[0], &vecColumn[0], nStride, nRows);
+    }
+    double dParse = (GetTickUs() - tBegin) / 1000000.0;
+
+    std::vector<char> vecOut(nRows * nStride);
+    tBegin = GetTickUs();
+    while( GetTickUs() - tBegin < tHalf )
+    {
+        FormatOtlDatetimes(&vecDt[0], nRows, &vecOut[0], nStride);
+        nFormatted += nRows;
+    }
+    double dFormat = (GetTickUs() - tBegin) / 1000000.0;
+
+    printf("datetime parse:  %.0f rows/s\n", nParsed / dParse);
+    printf("datetime format: %.0f rows/s (%s)\n", nFormatted / dFormat, &vecOut[(nRows - 1) * nStride]);
+    return 0;
+}
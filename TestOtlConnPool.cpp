@@ -1,24 +1,110 @@
 #include "database/dbpool.h"
+#include "database/dbsim.h"
+#include "database/dbcoro.h"
 using namespace OTL;
 #include <string>
 
+// 检查测试结果：不成立时输出位置和条件，计入本测试的失败数nFailed
+#define TEST_CHECK(cond) \
+    do { if( !(cond) ) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++nFailed; } } while( 0 )
+
 // 测试非单件/单件连接池
 static int test_pool();
 static int test_singleton_pool();
 static int test_convert_datetime();
+static int test_stmt_cache();
+static int test_sim_backend();
+static int test_pool_group();
+static int test_async_query();
+static int test_idempotent_retry();
+static int test_group_commit();
+static int test_result_cache();
+static int test_thread_cache();
+static int test_parallel_init();
+static int test_conn_handle();
+static int test_workload_class();
+static int test_circuit_breaker();
+static int test_hold_watch();
+static int test_parallel_query();
+static int test_sim_cursor();
+static int test_cursor_prefetch();
+static int test_bulk_write();
+static int test_grow_retry();
+static int test_coroutine();
 
 int main(int argc, char** argv)
 {
+    int nFailed = 0;
+
     // 测试日期时间的转换
-    test_convert_datetime();
+    nFailed += (0 != test_convert_datetime());
 
     // 测试非单件连接池
-    test_pool();
+    nFailed += (0 != test_pool());
 
     // 测试单件连接池
-    test_singleton_pool();
+    nFailed += (0 != test_singleton_pool());
 
-    return 0;
+    // 测试语句缓存
+    nFailed += (0 != test_stmt_cache());
+
+    // 测试模拟后端的断线重连(无需数据库)
+    nFailed += (0 != test_sim_backend());
+
+    // 测试多节点连接池组的路由与剔除(无需数据库)
+    nFailed += (0 != test_pool_group());
+
+    // 测试异步查询(无需数据库)
+    nFailed += (0 != test_async_query());
+
+    // 测试幂等操作的重试(无需数据库)
+    nFailed += (0 != test_idempotent_retry());
+
+    // 测试组提交(无需数据库)
+    nFailed += (0 != test_group_commit());
+
+    // 测试查询结果缓存(无需数据库)
+    nFailed += (0 != test_result_cache());
+
+    // 测试线程亲和的连接槽位(无需数据库)
+    nFailed += (0 != test_thread_cache());
+
+    // 测试并发/延迟初始化(无需数据库)
+    nFailed += (0 != test_parallel_init());
+
+    // 测试连接句柄的转移(无需数据库)
+    nFailed += (0 != test_conn_handle());
+
+    // 测试工作负载类别的保证与份额(无需数据库)
+    nFailed += (0 != test_workload_class());
+
+    // 测试熔断与过载保护(无需数据库)
+    nFailed += (0 != test_circuit_breaker());
+
+    // 测试持有时间监控与泄漏收回(无需数据库)
+    nFailed += (0 != test_hold_watch());
+
+    // 测试分区并行查询(无需数据库)
+    nFailed += (0 != test_parallel_query());
+
+    // 测试游标与默认的查询加载方式(无需数据库)
+    nFailed += (0 != test_sim_cursor());
+
+    // 测试游标跨预取块的读取(无需数据库)
+    nFailed += (0 != test_cursor_prefetch());
+
+    // 测试批量写入的分批与错误记录(无需数据库)
+    nFailed += (0 != test_bulk_write());
+
+    // 测试新建连接失败后的重试(无需数据库)
+    nFailed += (0 != test_grow_retry());
+
+    // 测试协程接口(需要C++20，无需数据库)
+    nFailed += (0 != test_coroutine());
+
+    if( nFailed > 0 )
+        printf("%d test(s) failed.\n", nFailed);
+    return nFailed > 0 ? 1 : 0;
 }
 
 // 测试非单件连接池
@@ -54,7 +140,7 @@ int test_pool()
             strErrMsg = conn.GetErrFromException(e);
             printf(strErrMsg.c_str());
         }
-        getchar();
+        printf("\n");
     }
     return 0;
 }
@@ -100,16 +186,1239 @@ int test_singleton_pool()
 
 int test_convert_datetime()
 {
-    char * str1 = "2012-04-10";
-    char * str2 = "2012-04-10 10:10:10";
-    char * str3 = "20120410";
-    char * str4 = "20120410 10:10:10";
+    int nFailed = 0;
+    const char * arrStr[] = {
+        "2012-04-10", "2012-04-10 10:10:10", "20120410", "20120410 10:10:10",
+        "2012-04-10 10:10:10.123456", "2012-02-29 23:59:59",
+        // 以下为非法格式
+        "2011-02-29", "2012-13-01", "2012-04-10 24:00:00", "2012-4-10", "2012-04-10 10:10", "2012-04-10 10:10:10." };
+
+    for(size_t i = 0; i < sizeof(arrStr) / sizeof(arrStr[0]); ++i)
+    {
+        otl_datetime dt;
+        char buf[32] = { 0 };
+        bool bOK = ConvertOtlDatetime(dt, arrStr[i]);
+        FormatOtlDatetime(dt, buf, dt.frac_precision);
+        printf("[%s] %s, %s\n", arrStr[i], bOK ? "ok" : "invalid", buf);
+        TEST_CHECK(bOK == (i < 6));
+    }
+
+    // 批量转换一列定长字符串
+    char arrColumn[3][20] = { "2012-04-10", "20120411 08:00:00", "bad" };
+    otl_datetime arrDt[3];
+    unsigned char arrValid[3];
+    int nOK = ConvertOtlDatetimes(arrDt, arrColumn[0], sizeof(arrColumn[0]), 3, arrValid);
+    printf("batch: %d/3 converted, valid %d%d%d\n", nOK, arrValid[0], arrValid[1], arrValid[2]);
+    TEST_CHECK(2 == nOK && 1 == arrValid[0] && 1 == arrValid[1] && 0 == arrValid[2]);
+
+    return nFailed;
+}
+
+// 测试语句缓存
+int test_stmt_cache()
+{
+    OTL::CDBConnPool dbpool;
+    dbpool.SetStmtCacheSize(8);
+    if( 1 != dbpool.Init("new_elevator/1234@Elevator_8", 1) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+    for(int i = 0; i < 3; ++i)
+    {
+        OTL::CDBAppConn conn(&dbpool);
+        try
+        {
+            // 第一次解析，之后复用同一个已解析的语句
+            OTL::CDBStream stm(conn, 1, "select to_char(sysdate, 'YYYY-MM-DD HH24:MI:SS') from dual");
+            char date[32] = { 0 };
+            stm >> date;
+            printf("[%s] Get current date is : %s.\n", stm.IsReused() ? "cached" : "parsed", date);
+        }
+        catch( otl_exception & e )
+        {
+            printf("%s\n", conn.GetErrFromException(e));
+        }
+    }
+    return 0;
+}
+
+// 测试模拟后端的断线重连
+int test_sim_backend()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    if( 2 != dbpool.Init("sim", 2) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
 
-    otl_datetime dt1, dt2, dt3, dt4;
-    ConvertOtlDatetime(dt1, str1); printf("[%s], %d-%d-%d, %d:%d:%d\n", str1, dt1.year, dt1.month, dt1.day, dt1.hour, dt1.minute, dt1.second);
-    ConvertOtlDatetime(dt2, str2); printf("[%s], %d-%d-%d, %d:%d:%d\n", str2, dt2.year, dt2.month, dt2.day, dt2.hour, dt2.minute, dt2.second);
-    ConvertOtlDatetime(dt3, str3); printf("[%s], %d-%d-%d, %d:%d:%d\n", str3, dt3.year, dt3.month, dt3.day, dt3.hour, dt3.minute, dt3.second);
-    ConvertOtlDatetime(dt4, str4); printf("[%s], %d-%d-%d, %d:%d:%d\n", str4, dt4.year, dt4.month, dt4.day, dt4.hour, dt4.minute, dt4.second);
+    // 断线后第一次执行报ORA-03113并标记所有空闲连接，之后获取连接时自动重连
+    sim.DisconnectAll();
+    for(int i = 0; i < 2; ++i)
+    {
+        OTL::CDBAppConn conn(&dbpool);
+        try
+        {
+            conn.Execute("select 1 from dual");
+            printf("[sim] execute ok after %lld logons.\n", sim.GetLogonNum());
+            TEST_CHECK(1 == i);
+        }
+        catch( otl_exception & e )
+        {
+            printf("[sim] %s\n", conn.GetErrFromException(e));
+            TEST_CHECK(0 == i);
+        }
+    }
+
+    // 监听不可用时重连失败(连接已被标记)，恢复后重连成功
+    sim.SetServerDown(true);
+    {
+        OTL::CDBAppConn conn(&dbpool);
+        printf("[sim] server down, connection good: %d.\n", conn.Good() ? 1 : 0);
+        TEST_CHECK(!conn.Good());
+    }
+    sim.SetServerDown(false);
+    {
+        OTL::CDBAppConn conn(&dbpool);
+        printf("[sim] server up, connection good: %d.\n", conn.Good() ? 1 : 0);
+        TEST_CHECK(conn.Good());
+    }
+    return nFailed;
+}
 
+// 测试多节点连接池组：一主两备，备库宕机后被剔除，恢复后重新接纳
+int test_pool_group()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend primary, replica1, replica2;
+    OTL::CDBPoolGroup group;
+    group.SetEjectPolicy(1, 100, 1000);
+    group.AddEndpoint("primary", 2, 1, true, &primary);
+    group.AddEndpoint("replica1", 2, 1, false, &replica1);
+    group.AddEndpoint("replica2", 2, 1, false, &replica2);
+
+    // 同时持有两个只读连接，分别落在两个备库上
+    {
+        OTL::CDBAppConn conn1(&group, true);
+        OTL::CDBAppConn conn2(&group, true);
+        OTL::CDBAppConn conn3(&group, false);
+        conn1.Execute("select 1 from dual");
+        conn2.Execute("select 1 from dual");
+        conn3.Execute("update t set c = 1");
+        printf("[group] queries: primary %lld, replica1 %lld, replica2 %lld.\n",
+            primary.GetQueryNum(), replica1.GetQueryNum(), replica2.GetQueryNum());
+        TEST_CHECK(1 == primary.GetQueryNum() && 1 == replica1.GetQueryNum() && 1 == replica2.GetQueryNum());
+    }
+
+    // 备库1宕机：读请求报错后剔除，之后的读请求都落在备库2
+    replica1.SetServerDown(true);
+    for(int i = 0; i < 4; ++i)
+    {
+        OTL::CDBAppConn conn(&group, true);
+        try
+        {
+            conn.Execute("select 1 from dual");
+        }
+        catch( otl_exception & e )
+        {
+            conn.GetErrFromException(e);
+        }
+    }
+    printf("[group] replica1 down, ejected: %d, replica2 queries %lld.\n",
+        group.IsEjected(1) ? 1 : 0, replica2.GetQueryNum());
+    TEST_CHECK(group.IsEjected(1) && 4 == replica2.GetQueryNum());
+
+    // 恢复后等待剔除到期，试用成功后重新接纳
+    replica1.SetServerDown(false);
+    SleepUs(150 * 1000);
+    for(int i = 0; i < 4; ++i)
+    {
+        OTL::CDBAppConn conn(&group, true);
+        conn.Execute("select 1 from dual");
+    }
+    printf("[group] replica1 up, ejected: %d, replica1 queries %lld.\n",
+        group.IsEjected(1) ? 1 : 0, replica1.GetQueryNum());
+    TEST_CHECK(!group.IsEjected(1) && replica1.GetQueryNum() > 1);
+
+    // 初始化时宕机的备库：试用到期后仍然宕机，读请求不会无限等待，
+    // 备库被再次剔除，读请求改由主库执行
+    {
+        OTL::CDBSimBackend up, down;
+        OTL::CDBPoolGroup group2;
+        group2.SetEjectPolicy(1, 100, 1000);
+        down.SetServerDown(true);
+        group2.AddEndpoint("primary", 1, 1, true, &up);
+        group2.AddEndpoint("replica", 1, 1, false, &down);
+        TEST_CHECK(group2.IsEjected(1));
+        SleepUs(200 * 1000);
+        TEST_CHECK(!group2.IsEjected(1));
+
+        unsigned long long tBegin = OTL::GetTickUs();
+        int nGood = 0;
+        for(int i = 0; i < 3; ++i)
+        {
+            OTL::CDBAppConn conn(&group2, true);
+            if( conn.Good() )
+            {
+                conn.Execute("select 1 from dual");
+                ++nGood;
+            }
+        }
+        unsigned long long nMs = (OTL::GetTickUs() - tBegin) / 1000;
+        printf("[group] replica still down: %d of 3 reads ok in %llu ms, ejected: %d, primary queries %lld.\n",
+            nGood, nMs, group2.IsEjected(1) ? 1 : 0, up.GetQueryNum());
+        TEST_CHECK(3 == nGood && 3 == up.GetQueryNum() && group2.IsEjected(1) && nMs < 2000);
+    }
+    return nFailed;
+}
+
+// 模拟后端不支持otl_stream，异步查询直接执行语句
+class CSimAsyncQuery : public OTL::CDBAsyncQuery
+{
+public:
+    CSimAsyncQuery(const char *sql = "select 1 from dual") : OTL::CDBAsyncQuery(sql) {}
+protected:
+    virtual void Run(OTL::CDBAppConn& conn) { SetRpc(conn.Execute(m_strSql.c_str())); }
+};
+
+static void on_query_done(OTL::CDBAsyncQuery * /*pQuery*/, void *pArg)
+{
+    OTL::AtomicAdd((volatile long *)pArg, 1);
+}
+
+// 测试异步查询：8个查询在2个执行线程上并发执行
+int test_async_query()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.SetQueryLatency(10 * 1000);
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    if( 2 != dbpool.Init("sim", 2) || !dbpool.EnableAsync(2) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    // 等待方式
+    std::vector<CSimAsyncQuery*> vecQuery;
+    unsigned long long tBegin = OTL::GetTickUs();
+    for(int i = 0; i < 4; ++i)
+    {
+        vecQuery.push_back(new CSimAsyncQuery);
+        dbpool.SubmitAsync(vecQuery.back());
+    }
+    int nGood = 0;
+    for(size_t i = 0; i < vecQuery.size(); ++i)
+    {
+        if( vecQuery[i]->Wait(1000) && vecQuery[i]->Good() )
+            ++nGood;
+        delete vecQuery[i];
+    }
+    printf("[async] %d/4 queries done in %llu ms.\n", nGood, (OTL::GetTickUs() - tBegin) / 1000);
+    TEST_CHECK(4 == nGood);
+
+    // 回调方式
+    volatile long nDone = 0;
+    CSimAsyncQuery arrQuery[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        arrQuery[i].SetCallback(on_query_done, (void *)&nDone);
+        dbpool.SubmitAsync(&arrQuery[i]);
+    }
+    tBegin = OTL::GetTickUs();
+    while( nDone < 4 && OTL::GetTickUs() - tBegin < 5000 * 1000 )
+        OTL::SleepUs(1000);
+    printf("[async] %ld callbacks.\n", nDone);
+    TEST_CHECK(4 == nDone);
+
+    // 默认执行方式：模拟后端通过结果来源返回设置的结果
+    sim.AddResultColumn("id", otl_var_long_int);
+    sim.AddResultColumn("name", otl_var_char, 16);
+    const char *arrRow1[] = { "1", "alpha" };
+    const char *arrRow2[] = { "2", NULL };
+    sim.AddResultRow(arrRow1);
+    sim.AddResultRow(arrRow2);
+    OTL::CDBAsyncQuery query("select id, name from t");
+    dbpool.SubmitAsync(&query);
+    query.Wait();
+    printf("[async] default run on sim backend: %s, %d rows.\n", query.Good() ? "ok" : query.GetLastError(), query.GetRowNum());
+    TEST_CHECK(query.Good() && 2 == query.GetRowNum() && 2 == query.GetRpc());
+    TEST_CHECK(query.Good() && 0 == strcmp(query.GetValue(0, 1), "alpha") && NULL == query.GetValue(1, 1));
+    return nFailed;
+}
+
+// 测试幂等操作的重试：断线和死锁对调用者不可见，约束冲突直接抛出
+int test_idempotent_retry()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    if( 2 != dbpool.Init("sim", 2) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    OTL::SRetryPolicy policy;
+    policy.nBaseDelayMs = 1;
+    const char *arrCase[] = { "disconnect", "deadlock", "unique constraint" };
+    for(int i = 0; i < 3; ++i)
+    {
+        if( 0 == i ) sim.DisconnectAll();
+        if( 1 == i ) sim.InjectQueryError(60, 2);
+        if( 2 == i ) sim.InjectQueryError(1, 1);
+
+        OTL::CDBAppConn conn(&dbpool);
+        try
+        {
+            conn.ExecuteIdempotent("update t set c = 1 where id = 1", policy);
+            printf("[retry] %s: ok, %lld queries.\n", arrCase[i], sim.GetQueryNum());
+            TEST_CHECK(2 != i);
+        }
+        catch( otl_exception & e )
+        {
+            printf("[retry] %s: %s\n", arrCase[i], conn.GetErrFromException(e));
+            TEST_CHECK(2 == i && 1 == e.code);
+        }
+    }
+    return nFailed;
+}
+
+// 模拟后端不支持otl_stream，写入单元直接执行语句
+class CSimWriteUnit : public OTL::CDBWriteUnit
+{
+public:
+    CSimWriteUnit() : OTL::CDBWriteUnit("insert into t values(1)") {}
+protected:
+    virtual void Apply(OTL::CDBAppConn& conn) { SetRpc(conn.Execute(m_strSql.c_str())); }
+};
+
+static void group_commit_worker(void *pArg)
+{
+    OTL::CDBGroupCommitter *pCommitter = (OTL::CDBGroupCommitter *)pArg;
+    for(int i = 0; i < 50; ++i)
+    {
+        CSimWriteUnit unit;
+        if( !pCommitter->Write(&unit) )
+            printf("[group commit] write failed: %s\n", unit.GetLastError());
+    }
+}
+
+// 测试组提交：8个线程各写50次，提交1ms，提交次数应远小于写入次数；
+// 注入一次约束冲突，只有该单元失败
+int test_group_commit()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.SetCommitLatency(1000);
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    OTL::CDBGroupCommitter committer(&dbpool);
+    if( 2 != dbpool.Init("sim", 2) || !committer.Start(2, 32) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    unsigned long long tBegin = OTL::GetTickUs();
+    OTL::COTLThread arrThread[8];
+    for(int i = 0; i < 8; ++i)
+        arrThread[i].Start(group_commit_worker, &committer);
+    for(int i = 0; i < 8; ++i)
+        arrThread[i].Join();
+    printf("[group commit] %lld units in %lld commits, %llu ms.\n", committer.GetUnitNum(),
+        sim.GetCommitNum(), (OTL::GetTickUs() - tBegin) / 1000);
+    TEST_CHECK(400 == committer.GetUnitNum() && sim.GetCommitNum() > 0 && sim.GetCommitNum() * 2 < committer.GetUnitNum());
+
+    CSimWriteUnit arrUnit[4];
+    sim.InjectQueryError(1, 1);
+    for(int i = 0; i < 4; ++i)
+        committer.Submit(&arrUnit[i]);
+    for(int i = 0; i < 4; ++i)
+    {
+        arrUnit[i].Wait();
+        printf("[group commit] unit %d: %s\n", i, arrUnit[i].Good() ? "ok" : arrUnit[i].GetLastError());
+        TEST_CHECK(arrUnit[i].Good() == (0 != i));
+    }
+    committer.Stop();
+    return nFailed;
+}
+
+// 模拟后端不支持otl_stream，加载时直接执行语句并返回输入变量
+class CSimResultCache : public OTL::CDBResultCache
+{
+public:
+    CSimResultCache(OTL::CDBConnPool *pPool) : OTL::CDBResultCache(pPool) {}
+protected:
+    virtual void Load(OTL::CDBAppConn& conn, const char *sql, const char * const *binds, int nBinds,
+        OTL::CDBResultSet& result)
+    {
+        conn.Execute(sql);
+        result.AddColumn("value");
+        result.AddValue(nBinds > 0 ? binds[0] : "");
+    }
+};
+
+static void result_cache_worker(void *pArg)
+{
+    const char *binds[] = { "CN" };
+    OTL::CDBResultRef res;
+    if( !((CSimResultCache *)pArg)->Query("select name from country where code = :c<char[8]>", binds, 1, res) )
+        printf("[result cache] query failed: %s\n", res.GetLastError());
+}
+
+// 测试查询结果缓存：8个线程同时未命中只执行一次查询，失效后重新加载，超过内存上限时淘汰
+int test_result_cache()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.SetQueryLatency(20 * 1000);
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    if( 2 != dbpool.Init("sim", 2) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    CSimResultCache cache(&dbpool);
+    cache.Init(4096, 60000);
+    OTL::COTLThread arrThread[8];
+    for(int i = 0; i < 8; ++i)
+        arrThread[i].Start(result_cache_worker, &cache);
+    for(int i = 0; i < 8; ++i)
+        arrThread[i].Join();
+    printf("[result cache] 8 concurrent misses: %lld queries.\n", sim.GetQueryNum());
+    TEST_CHECK(1 == sim.GetQueryNum());
+
+    const char *sql = "select name from country where code = :c<char[8]>";
+    const char *binds[] = { "CN" };
+    OTL::CDBResultRef res;
+    cache.Query(sql, binds, 1, res);
+    printf("[result cache] hit: %s, %lld queries.\n", res->GetValue(0, 0), sim.GetQueryNum());
+    TEST_CHECK(0 == strcmp(res->GetValue(0, 0), "CN") && 1 == sim.GetQueryNum());
+
+    cache.Invalidate(sql);
+    cache.Query(sql, binds, 1, res);
+    printf("[result cache] after invalidate: %lld queries.\n", sim.GetQueryNum());
+    TEST_CHECK(2 == sim.GetQueryNum());
+
+    // 4KB上限，写入100个不同的键后只保留最近使用的部分
+    sim.SetQueryLatency(0);
+    char szCode[16];
+    for(int i = 0; i < 100; ++i)
+    {
+        sprintf(szCode, "%d", i);
+        binds[0] = szCode;
+        cache.Query(sql, binds, 1, res);
+    }
+    printf("[result cache] %u entries, %u bytes, %lld evicted.\n", (unsigned int)cache.GetEntryNum(),
+        (unsigned int)cache.GetMemSize(), cache.GetEvictNum());
+    TEST_CHECK(cache.GetMemSize() <= 4096 && cache.GetEvictNum() > 0 && cache.GetEntryNum() + cache.GetEvictNum() >= 100);
+
+    cache.SetStatementTTL(sql, 0);
+    long long nQueries = sim.GetQueryNum();
+    cache.Query(sql, binds, 1, res);
+    printf("[result cache] ttl 0: %lld queries.\n", sim.GetQueryNum() - nQueries);
+    TEST_CHECK(1 == sim.GetQueryNum() - nQueries);
+    return nFailed;
+}
+
+struct SThreadCacheArg
+{
+    OTL::CDBConnPool * pPool;
+    bool               bReused;
+};
+
+static void thread_cache_worker(void *pArg)
+{
+    SThreadCacheArg *pCache = (SThreadCacheArg *)pArg;
+    OTL::CDBConnPool *pPool = pCache->pPool;
+    OTL::CDBConn *pFirst = pPool->WaitConn(1000);
+    pPool->ReleaseConn(pFirst);
+    OTL::CDBConn *pSecond = pPool->WaitConn(1000);
+    pCache->bReused = (pFirst != NULL && pFirst == pSecond);
+    printf("[thread cache] same connection reused: %d, parked %d.\n", pFirst == pSecond, pPool->GetParkedConnNum());
+    pPool->ReleaseConn(pSecond);
+}
+
+// 测试线程亲和的连接槽位：同一线程复用槽位中的连接，线程退出时归还，
+// 连接池只有1个连接时其他线程可以收回槽位中的连接
+int test_thread_cache()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(1);
+    if( 1 != dbpool.Init("sim", 1) || !dbpool.EnableThreadCache(1000) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    SThreadCacheArg cache = { &dbpool, false };
+    OTL::COTLThread thread;
+    thread.Start(thread_cache_worker, &cache);
+    thread.Join();
+    printf("[thread cache] after thread exit: parked %d, idle %d.\n", dbpool.GetParkedConnNum(), dbpool.GetConnNum());
+    TEST_CHECK(cache.bReused && 0 == dbpool.GetParkedConnNum() && 1 == dbpool.GetConnNum());
+
+    // 本线程放入槽位后，其他线程获取时收回
+    dbpool.ReleaseConn(dbpool.WaitConn(1000));
+    cache.bReused = false;
+    thread.Start(thread_cache_worker, &cache);
+    thread.Join();
+    printf("[thread cache] %d logons.\n", (int)sim.GetLogonNum());
+    TEST_CHECK(cache.bReused && 1 == sim.GetLogonNum());
+    return nFailed;
+}
+
+// 测试并发/延迟初始化：20个连接、每个登录50ms
+int test_parallel_init()
+{
+    int nFailed = 0;
+    std::string strResult;
+    OTL::SInitResult result;
+    OTL::CDBSimBackend sim;
+    sim.SetConnectLatency(50 * 1000);
+
+    // 10个并发，其中3个登录失败，其余不受影响
+    {
+        OTL::CDBConnPool dbpool;
+        dbpool.SetBackend(&sim);
+        dbpool.SetInitPolicy(10);
+        sim.InjectConnectError(12541, 3);
+        int num = dbpool.Init("sim", 20);
+        dbpool.GetInitResult(result);
+        result.ToString(strResult);
+        printf("[init] parallel: %d conns\n%s", num, strResult.c_str());
+        TEST_CHECK(17 == num && 17 == result.nConnected && 3 == result.nFailed);
+    }
+
+    // 延迟模式：2个就绪即返回，其余在后台建立
+    {
+        OTL::CDBConnPool dbpool;
+        dbpool.SetBackend(&sim);
+        dbpool.SetInitPolicy(4, 2);
+        int num = dbpool.Init("sim", 20);
+        dbpool.GetInitResult(result);
+        printf("[init] lazy: %d conns ready in %llu ms, %d pending.\n", num, result.nReadyUs / 1000, result.nPending);
+        TEST_CHECK(num >= 2 && num < 20 && num + result.nPending == 20);
+        OTL::CDBAppConn conn(&dbpool, 1000);
+        printf("[init] lazy: acquire %s.\n", conn.Good() ? "ok" : conn.GetLastError());
+        TEST_CHECK(conn.Good());
+        unsigned long long tBegin = OTL::GetTickUs();
+        while( dbpool.GetTotalConnNum() < 20 && OTL::GetTickUs() - tBegin < 5000 * 1000 )
+            OTL::SleepUs(10 * 1000);
+        dbpool.GetInitResult(result);
+        printf("[init] lazy: all ready in %llu ms.\n", result.nTotalUs / 1000);
+        TEST_CHECK(20 == dbpool.GetTotalConnNum() && result.nTotalUs > 0);
+    }
+
+    // 服务器不可用：每个并发都失败后放弃剩余的连接
+    {
+        OTL::CDBConnPool dbpool;
+        dbpool.SetBackend(&sim);
+        dbpool.SetInitPolicy(4);
+        sim.SetServerDown(true);
+        int num = dbpool.Init("sim", 20);
+        sim.SetServerDown(false);
+        dbpool.GetInitResult(result);
+        result.ToString(strResult);
+        printf("[init] server down: %d conns\n%s", num, strResult.c_str());
+        TEST_CHECK(0 == num && result.nSkipped > 0 && 20 == result.nFailed + result.nSkipped);
+    }
+    return nFailed;
+}
+
+// 测试连接句柄的转移：跨阶段传递同一个连接，不经过连接池
+int test_conn_handle()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(1);
+    if( 1 != dbpool.Init("sim", 1) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    OTL::CDBAppConn stage1(&dbpool, 0);
+    OTL::CDBConn *pConn = stage1.GetConn();
+    OTL::CDBAppConn stage2;
+    stage2.Transfer(stage1);
+    printf("[handle] transfer: same %d, source empty %d, idle %d.\n",
+        stage2.GetConn() == pConn, NULL == stage1.GetConn(), dbpool.GetConnNum());
+    TEST_CHECK(NULL != pConn && stage2.GetConn() == pConn && NULL == stage1.GetConn() && 0 == dbpool.GetConnNum());
+
+    // 放弃所有权后交给另一个句柄
+    OTL::CDBAppConn stage3;
+    stage3.Attach(&dbpool, stage2.Detach());
+    stage3.Execute("select 1 from dual");
+    printf("[handle] attach: same %d, good %d.\n", stage3.GetConn() == pConn, stage3.Good());
+    TEST_CHECK(stage3.GetConn() == pConn && stage3.Good());
+
+    stage3.Reset();
+    OTL::CDBAppConn again(&dbpool, 0);
+    printf("[handle] reset: acquired again %d.\n", again.GetConn() == pConn);
+    TEST_CHECK(again.GetConn() == pConn);
+    return nFailed;
+}
+
+struct SClassWaitArg
+{
+    OTL::CDBConnPool * pPool;
+    int                nClass;
+    OTL::CDBConn     * pConn;
+};
+
+static void workload_class_waiter(void *pArg)
+{
+    SClassWaitArg *pWait = (SClassWaitArg *)pArg;
+    pWait->pConn = pWait->pPool->WaitConn(2000, pWait->nClass);
+}
+
+// 测试工作负载类别：4个连接，oltp保证2个且优先，batch最多用2个，
+// batch占满份额后不能挤占oltp的保证，归还的连接先交给oltp的等待者
+int test_workload_class()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(4);
+    if( 4 != dbpool.Init("sim", 4) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+    int nOltp  = dbpool.AddWorkloadClass("oltp", 2, 0, 10);
+    int nBatch = dbpool.AddWorkloadClass("batch", 0, 2);
+
+    OTL::CDBConn *pBatch1 = dbpool.WaitConn(0, nBatch);
+    OTL::CDBConn *pBatch2 = dbpool.WaitConn(0, nBatch);
+    OTL::CDBConn *pBatch3 = dbpool.WaitConn(0, nBatch);
+    OTL::CDBConn *pDefault = dbpool.WaitConn(0);
+    printf("[class] batch got %d of 3, default got %d, idle %d.\n",
+        (pBatch1 != NULL) + (pBatch2 != NULL) + (pBatch3 != NULL), pDefault != NULL, dbpool.GetConnNum());
+    TEST_CHECK(pBatch1 && pBatch2 && !pBatch3 && !pDefault && 2 == dbpool.GetConnNum());
+
+    OTL::CDBConn *pOltp1 = dbpool.WaitConn(0, nOltp);
+    OTL::CDBConn *pOltp2 = dbpool.WaitConn(0, nOltp);
+    printf("[class] oltp got reserved %d, in use %d.\n", (pOltp1 != NULL) + (pOltp2 != NULL), dbpool.GetClassInUse(nOltp));
+    TEST_CHECK(pOltp1 && pOltp2 && 2 == dbpool.GetClassInUse(nOltp));
+
+    // 先排队batch，再排队oltp
+    SClassWaitArg batchWait = { &dbpool, nBatch, NULL };
+    SClassWaitArg oltpWait  = { &dbpool, nOltp, NULL };
+    OTL::COTLThread batchThread, oltpThread;
+    batchThread.Start(workload_class_waiter, &batchWait);
+    while( dbpool.GetOutstandingNum() < 5 )
+        OTL::SleepUs(1000);
+    oltpThread.Start(workload_class_waiter, &oltpWait);
+    while( dbpool.GetOutstandingNum() < 6 )
+        OTL::SleepUs(1000);
+
+    dbpool.ReleaseConn(pBatch1);
+    oltpThread.Join();
+    printf("[class] released batch conn goes to oltp waiter %d.\n", oltpWait.pConn == pBatch1);
+    TEST_CHECK(oltpWait.pConn == pBatch1);
+    dbpool.ReleaseConn(pBatch2);
+    batchThread.Join();
+    printf("[class] next release goes to batch waiter %d.\n", batchWait.pConn == pBatch2);
+    TEST_CHECK(batchWait.pConn == pBatch2);
+
+    std::string strStats;
+    dbpool.DumpStats(strStats);
+    printf("%s", strStats.c_str());
+
+    dbpool.ReleaseConn(batchWait.pConn);
+    dbpool.ReleaseConn(oltpWait.pConn);
+    dbpool.ReleaseConn(pOltp1);
+    dbpool.ReleaseConn(pOltp2);
+    printf("[class] all returned: idle %d, oltp in use %d.\n", dbpool.GetConnNum(), dbpool.GetClassInUse(nOltp));
+    TEST_CHECK(4 == dbpool.GetConnNum() && 0 == dbpool.GetClassInUse(nOltp));
+    return nFailed;
+}
+
+static void circuit_breaker_waiter(void *pArg)
+{
+    OTL::CDBConnPool *pPool = (OTL::CDBConnPool *)pArg;
+    pPool->ReleaseConn(pPool->WaitConn(2000));
+}
+
+// 测试熔断与过载保护：服务器不可用时连续3次新建失败后熔断，之后获取立即失败，
+// 恢复后由后台试探关闭熔断器；队首等待过久时新的获取立即失败
+int test_circuit_breaker()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(4);
+    dbpool.SetCircuitBreaker(3, 200);
+    if( 1 != dbpool.Init("sim", 1, 1) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    OTL::CDBConn *pHeld = dbpool.GetConn();
+    sim.SetServerDown(true);
+    for( int i = 0; i < 3; ++i )
+        dbpool.GetConn();
+    unsigned long long tBegin = OTL::GetTickUs();
+    OTL::CDBConn *pConn = dbpool.WaitConn(1000);
+    unsigned long long nMs = (OTL::GetTickUs() - tBegin) / 1000;
+    printf("[breaker] state %d, acquire failed in %llu ms: %s\n", (int)dbpool.GetBreakerState(),
+        nMs, NULL == pConn ? dbpool.GetLastError() : "acquired");
+    TEST_CHECK(OTL::DB_BREAKER_OPEN == dbpool.GetBreakerState() && NULL == pConn && nMs < 500);
+    {
+        // 应用连接没有获取到连接时报告连接池的原因
+        OTL::CDBAppConn conn(&dbpool, 0);
+        printf("[breaker] app conn: %s\n", conn.GetLastError());
+        TEST_CHECK(!conn.Good() && std::string("Circuit breaker is open!") == conn.GetLastError());
+    }
+
+    // 恢复后等待试探
+    sim.SetServerDown(false);
+    OTL::SleepUs(400 * 1000);
+    pConn = dbpool.WaitConn(1000);
+    printf("[breaker] recovered: state %d, acquire %s.\n", (int)dbpool.GetBreakerState(), pConn ? "ok" : dbpool.GetLastError());
+    TEST_CHECK(OTL::DB_BREAKER_CLOSED == dbpool.GetBreakerState() && NULL != pConn);
+    dbpool.ReleaseConn(pConn);
+    dbpool.ReleaseConn(pHeld);
+
+    // 过载：只有1个连接且被占用，队首等待超过50ms后拒绝新的获取
+    OTL::CDBConnPool shedpool;
+    shedpool.SetBackend(&sim);
+    shedpool.SetMaxConnNum(1);
+    shedpool.SetCircuitBreaker(3, 200, 50);
+    shedpool.Init("sim", 1);
+    pHeld = shedpool.GetConn();
+    OTL::COTLThread thread;
+    thread.Start(circuit_breaker_waiter, &shedpool);
+    OTL::SleepUs(100 * 1000);
+    tBegin = OTL::GetTickUs();
+    pConn = shedpool.WaitConn(1000);
+    nMs = (OTL::GetTickUs() - tBegin) / 1000;
+    printf("[breaker] shed in %llu ms: %s\n", nMs, NULL == pConn ? shedpool.GetLastError() : "acquired");
+    TEST_CHECK(NULL == pConn && nMs < 500);
+    shedpool.ReleaseConn(pHeld);
+    thread.Join();
+
+    std::string strStats;
+    dbpool.DumpStats(strStats);
+    printf("%s", strStats.c_str());
+    return nFailed;
+}
+
+// 测试持有时间监控：2个连接，泄漏1个，超过100ms告警，超过1500ms收回并新建连接替代，
+// 已收回未归还的会话达到上限后不再收回
+int test_hold_watch()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(2);
+    if( 2 != dbpool.Init("sim", 2) || !dbpool.EnableHoldWatch(100, 1500) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    OTL::CDBConn *pLeaked = dbpool.GetConn();
+    OTL::SleepUs(200 * 1000);
+    std::vector<OTL::SHeldConn> vecHeld;
+    {
+        OTL::CDBAppConn conn(&dbpool, 0);
+        int num = dbpool.GetHeldConns(vecHeld, 100);
+        printf("[hold] held over 100ms: %d, leaked %d, site %p.\n", num,
+            num > 0 && vecHeld[0].pConn == pLeaked, num > 0 ? vecHeld[0].pSite : NULL);
+        TEST_CHECK(1 == num && vecHeld[0].pConn == pLeaked && NULL != vecHeld[0].pSite);
+    }
+
+    OTL::SPoolStats stats;
+    for( int i = 0; i < 50; ++i )
+    {
+        dbpool.GetStats(stats);
+        if( stats.nHoldReclaims > 0 )
+            break;
+        OTL::SleepUs(100 * 1000);
+    }
+    printf("[hold] reclaimed %lld, warns %lld, total %d.\n", stats.nHoldReclaims, stats.nHoldWarns, stats.nTotal);
+    TEST_CHECK(1 == stats.nHoldReclaims && stats.nHoldWarns >= 1 && 1 == stats.nTotal);
+
+    // 收回后可以同时取得2个连接
+    OTL::CDBAppConn conn1(&dbpool, 1000);
+    OTL::CDBAppConn conn2(&dbpool, 1000);
+    printf("[hold] acquire after reclaim: %d %d, total %d.\n", conn1.Good(), conn2.Good(), dbpool.GetTotalConnNum());
+    TEST_CHECK(conn1.Good() && conn2.Good() && 2 == dbpool.GetTotalConnNum());
+
+    // 已收回未归还的会话达到上限(默认1个)，conn1/conn2持有超过收回阈值也不再收回
+    OTL::SleepUs(2100 * 1000);
+    dbpool.GetStats(stats);
+    printf("[hold] over cap: reclaimed %lld, reclaimed open %d, total %d.\n",
+        stats.nHoldReclaims, stats.nReclaimedOpen, stats.nTotal);
+    TEST_CHECK(1 == stats.nHoldReclaims && 1 == stats.nReclaimedOpen && 2 == stats.nTotal);
+
+    // 持有者最后归还时关闭会话
+    dbpool.ReleaseConn(pLeaked);
+    dbpool.GetStats(stats);
+    printf("[hold] leaked returned: total %d, held %d, reclaimed open %d.\n", dbpool.GetTotalConnNum(),
+        dbpool.GetHeldConns(vecHeld), stats.nReclaimedOpen);
+    TEST_CHECK(2 == dbpool.GetTotalConnNum() && 0 == stats.nReclaimedOpen);
+    return nFailed;
+}
+
+// 模拟哈希分区：返回0~99中除以n余b的id，按id升序
+class CSimParallelQuery : public OTL::CDBParallelQuery
+{
+public:
+    CSimParallelQuery(OTL::CDBConnPool *pPool) : OTL::CDBParallelQuery(pPool) {}
+protected:
+    virtual void Load(OTL::CDBAppConn& conn, const char *sql, const char * const *binds, int nBinds,
+        OTL::CDBResultSet& result)
+    {
+        conn.Execute(sql);
+        int n = atoi(binds[nBinds - 2]), b = atoi(binds[nBinds - 1]);
+        char szId[16];
+        result.AddColumn("id");
+        for( int i = b; i < 100; i += n )
+        {
+            sprintf(szId, "%d", i);
+            result.AddValue(szId);
+        }
+    }
+};
+
+// 测试分区并行查询：8个桶在4个连接上执行，不排序和按id归并，以及分区失败
+int test_parallel_query()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.SetQueryLatency(50 * 1000);
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(4);
+    if( 4 != dbpool.Init("sim", 4) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    CSimParallelQuery query(&dbpool);
+    query.SetSql("select id from elevator_event where mod(ora_hash(rowid), :n<char[12]>) = :b<char[12]> order by id");
+    query.AddBuckets(8);
+
+    unsigned long long tBegin = OTL::GetTickUs();
+    long nSum = 0;
+    query.Run(4);
+    while( query.Next() )
+        nSum += atol(query.GetValue(0));
+    printf("[parallel] unordered: %ld rows, sum %ld, %s, %llu ms.\n", query.GetRowCount(), nSum,
+        query.Good() ? "ok" : query.GetLastError(), (OTL::GetTickUs() - tBegin) / 1000);
+    TEST_CHECK(query.Good() && 100 == query.GetRowCount() && 4950 == nSum);
+
+    query.SetOrderBy(0, true);
+    query.Run(4);
+    int nPrev = -1;
+    bool bSorted = true;
+    while( query.Next() )
+    {
+        int nId = atoi(query.GetValue(0));
+        bSorted = bSorted && nId == nPrev + 1;
+        nPrev = nId;
+    }
+    printf("[parallel] ordered: %ld rows, sorted %d.\n", query.GetRowCount(), bSorted);
+    TEST_CHECK(query.Good() && 100 == query.GetRowCount() && bSorted && 99 == nPrev);
+
+    // 一个分区失败时整个查询失败
+    sim.InjectQueryError(1555, 1);
+    query.Run(2);
+    while( query.Next() )
+        ;
+    printf("[parallel] failed partition: %s\n", query.Good() ? "ok" : query.GetLastError());
+    TEST_CHECK(!query.Good());
+    return nFailed;
+}
+
+// 测试游标：模拟后端的结果经CDBCursor读入行缓冲区，检查各类型列的值、NULL标志和
+// FormatValue，以及查询结果缓存、分区并行查询默认的加载方式
+int test_sim_cursor()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.AddResultColumn("id", otl_var_long_int);
+    sim.AddResultColumn("name", otl_var_char, 5);
+    sim.AddResultColumn("score", otl_var_double);
+    sim.AddResultColumn("created", otl_var_timestamp);
+    sim.AddResultColumn("flag", otl_var_int);
+    const char *arrRow1[] = { "7", "abcdefgh", "2.5", "2012-04-10 10:11:12", NULL };
+    const char *arrRow2[] = { "-3", NULL, NULL, NULL, "1" };
+    sim.AddResultRow(arrRow1);
+    sim.AddResultRow(arrRow2);
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    if( 2 != dbpool.Init("sim", 2) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    char szBuf[64];
+    const char *szValue = NULL;
+    {
+        OTL::CDBAppConn conn(&dbpool);
+        OTL::CDBCursor cur(conn, "select id, name, score, created, flag from t");
+        TEST_CHECK(5 == cur.GetColumnNum() && 0 == strcmp(cur.GetColumnName(3), "created"));
+
+        // 字符列按最大长度截断，未设置值的列为NULL
+        TEST_CHECK(cur.Next());
+        const OTL::CDBRowView &row = cur.Row();
+        TEST_CHECK(7 == row.GetLong(0) && 0 == strcmp(row.GetString(1), "abcde") && 2.5 == row.GetDouble(2));
+        TEST_CHECK(2012 == row.GetDatetime(3).year && 12 == row.GetDatetime(3).second);
+        TEST_CHECK(!row.IsNull(0) && !row.IsNull(1) && !row.IsNull(3) && row.IsNull(4));
+        szValue = OTL::CDBResultSet::FormatValue(row, 2, szBuf);
+        TEST_CHECK(NULL != szValue && 0 == strcmp(szValue, "2.5"));
+        szValue = OTL::CDBResultSet::FormatValue(row, 3, szBuf);
+        TEST_CHECK(NULL != szValue && 0 == strcmp(szValue, "2012-04-10 10:11:12"));
+        TEST_CHECK(NULL == OTL::CDBResultSet::FormatValue(row, 4, szBuf));
+
+        TEST_CHECK(cur.Next());
+        TEST_CHECK(-3 == row.GetLong(0) && row.IsNull(1) && row.IsNull(2) && row.IsNull(3) && !row.IsNull(4));
+        TEST_CHECK(0 == strcmp(row.GetString(1), "") && 0 == row.GetDouble(2));
+        szValue = OTL::CDBResultSet::FormatValue(row, 0, szBuf);
+        TEST_CHECK(NULL != szValue && 0 == strcmp(szValue, "-3"));
+        szValue = OTL::CDBResultSet::FormatValue(row, 4, szBuf);
+        TEST_CHECK(NULL != szValue && 0 == strcmp(szValue, "1"));
+        TEST_CHECK(NULL == OTL::CDBResultSet::FormatValue(row, 1, szBuf));
+
+        TEST_CHECK(!cur.Next() && 2 == cur.GetRowCount());
+        printf("[cursor] %ld rows, %d columns.\n", cur.GetRowCount(), cur.GetColumnNum());
+    }
+
+    OTL::CDBResultCache cache(&dbpool);
+    cache.Init();
+    OTL::CDBResultRef res;
+    bool bOK = cache.Query("select id, name, score, created, flag from t", res);
+    printf("[cursor] result cache load: %s.\n", bOK ? "ok" : res.GetLastError());
+    TEST_CHECK(bOK && 2 == res->GetRowNum() && 5 == res->GetColumnNum());
+    TEST_CHECK(bOK && 0 == strcmp(res->GetValue(0, 1), "abcde") && NULL == res->GetValue(1, 3));
+
+    OTL::CDBParallelQuery query(&dbpool);
+    query.SetSql("select id, name, score, created, flag from t where id >= :lo<char[12]> and id < :hi<char[12]>");
+    query.AddRange("0", "100");
+    query.AddRange("100", "200");
+    query.Run(2);
+    while( query.Next() )
+        ;
+    printf("[cursor] parallel query load: %ld rows, %s.\n", query.GetRowCount(), query.Good() ? "ok" : query.GetLastError());
+    TEST_CHECK(query.Good() && 4 == query.GetRowCount());
+    return nFailed;
+}
+
+// 测试游标的预取块：7行结果按每块3行预取，块依次为3、3、1行，跨块时行缓冲区被
+// 下一块覆盖，逐行读取的顺序和值不受影响
+int test_cursor_prefetch()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.AddResultColumn("id", otl_var_long_int);
+    sim.AddResultColumn("name", otl_var_char, 8);
+    char arrName[7][8];
+    char arrId[7][8];
+    for( int i = 0; i < 7; ++i )
+    {
+        sprintf(arrId[i], "%d", i);
+        sprintf(arrName[i], "row%d", i);
+        const char *arrRow[] = { arrId[i], arrName[i] };
+        sim.AddResultRow(arrRow);
+    }
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    if( 1 != dbpool.Init("sim", 1) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    // 按块读取
+    OTL::CDBAppConn conn(&dbpool);
+    {
+        OTL::CDBCursor cur(conn, "select id, name from t", 3);
+        int arrBlock[4];
+        for( int i = 0; i < 4; ++i )
+        {
+            arrBlock[i] = cur.FetchBlock();
+            if( 1 == i )
+                TEST_CHECK(3 == cur.RowAt(0).GetLong(0) && 0 == strcmp(cur.RowAt(2).GetString(1), "row5"));
+        }
+        printf("[prefetch] blocks %d %d %d %d, %ld rows.\n", arrBlock[0], arrBlock[1], arrBlock[2], arrBlock[3], cur.GetRowCount());
+        TEST_CHECK(3 == arrBlock[0] && 3 == arrBlock[1] && 1 == arrBlock[2] && 0 == arrBlock[3] && 7 == cur.GetRowCount());
+    }
+
+    // 逐行读取，跨块时自动读取下一块
+    {
+        OTL::CDBCursor cur(conn, "select id, name from t", 3);
+        int nRows = 0;
+        bool bInOrder = true;
+        while( cur.Next() )
+        {
+            bInOrder = bInOrder && nRows == cur.Row().GetLong(0) && 0 == strcmp(cur.Row().GetString(1), arrName[nRows]);
+            ++nRows;
+        }
+        printf("[prefetch] next: %d rows, in order %d.\n", nRows, bInOrder);
+        TEST_CHECK(7 == nRows && bInOrder && 7 == cur.GetRowCount() && !cur.Next());
+    }
+
+    // 行数正好是块大小的整数倍时，最后一次读取返回空块
+    {
+        OTL::CDBCursor cur(conn, "select id, name from t", 7);
+        TEST_CHECK(7 == cur.FetchBlock() && 0 == cur.FetchBlock() && 7 == cur.GetRowCount());
+    }
+    return nFailed;
+}
+
+// 模拟otl_stream的数组绑定：缓冲区满或flush时执行缓冲的行，值为负数的行执行失败
+// (错误码为其绝对值)，之前的行已执行，之后的行未执行
+class CFakeBulkStream
+{
+public:
+    CFakeBulkStream(int nBufSize) : m_nBufSize(nBufSize), m_nRpc(0), m_nExecuted(0), m_bBroken(false) {}
+
+    inline CFakeBulkStream& Get(void) { return *this; }
+    inline CFakeBulkStream* operator->(void) { return this; }
+    inline void SetBroken(void) { m_bBroken = true; }
+
+    CFakeBulkStream& operator<<(int v)
+    {
+        m_vecPending.push_back(v);
+        if( (int)m_vecPending.size() == m_nBufSize )
+            flush();
+        return *this;
+    }
+    void flush(void)
+    {
+        m_nRpc = 0;
+        for( size_t i = 0; i < m_vecPending.size(); ++i )
+        {
+            if( m_vecPending[i] < 0 )
+            {
+                char szMsg[64];
+                sprintf(szMsg, "ORA-%05d: fake error", -m_vecPending[i]);
+                throw otl_exception(szMsg, -m_vecPending[i]);
+            }
+            ++m_nRpc;
+            ++m_nExecuted;
+        }
+        m_vecPending.clear();
+    }
+    inline long get_rpc(void) { return m_nRpc; }
+    inline void clean(void) { m_vecPending.clear(); }
+
+    int              m_nBufSize;
+    long             m_nRpc;        // 最近一次执行处理的行数
+    long             m_nExecuted;   // 累计执行成功的行数
+    bool             m_bBroken;
+    std::vector<int> m_vecPending;
+};
+
+// 模拟连接：记录每次提交时已执行的行数
+class CFakeBulkConn
+{
+public:
+    CFakeBulkConn(CFakeBulkStream *pStream) : m_pStream(pStream) {}
+
+    inline void Commit(void) { m_vecCommits.push_back(m_pStream->m_nExecuted); }
+    inline const char *GetErrFromException(const otl_exception& e) { return (const char *)e.msg; }
+
+    CFakeBulkStream   * m_pStream;
+    std::vector<long>   m_vecCommits;
+};
+
+struct SFakeBulkBinder
+{
+    inline void operator()(CFakeBulkStream& s, int v) const { s << v; }
+};
+
+// 测试批量写入的分批与错误记录(用模拟的otl_stream)：10行每批3行，检查按批提交、出错批次的
+// 起始行与已处理行数、出错后继续或停止，以及需重连的错误总是停止并丢弃语句
+int test_bulk_write()
+{
+    int nFailed = 0;
+    std::vector<int> rows;
+    for( int i = 0; i < 10; ++i )
+        rows.push_back(i);
+
+    // 没有错误：4批(3、3、3、1行)，每3批提交一次，结束时提交剩余的1批
+    {
+        CFakeBulkStream stm(3);
+        CFakeBulkConn conn(&stm);
+        OTL::SBulkResult res = OTL::BulkWriteBatches(conn, stm, rows, SFakeBulkBinder(), OTL::SBulkOptions(3, 3, true));
+        printf("[bulk] %ld rows in %d batches, %d commits.\n", res.nRows, res.nBatches, (int)conn.m_vecCommits.size());
+        TEST_CHECK(res.Good() && 10 == res.nRows && 4 == res.nBatches && 10 == stm.m_nExecuted);
+        TEST_CHECK(2 == conn.m_vecCommits.size() && 9 == conn.m_vecCommits[0] && 10 == conn.m_vecCommits[1]);
+    }
+
+    // 第2批(第3~5行)的第4行约束冲突后继续：该批只有第3行生效，第5行未执行
+    rows[4] = -1;
+    {
+        CFakeBulkStream stm(3);
+        CFakeBulkConn conn(&stm);
+        OTL::SBulkResult res = OTL::BulkWriteBatches(conn, stm, rows, SFakeBulkBinder(), OTL::SBulkOptions(3, 0, false));
+        printf("[bulk] continue on error: %ld rows in %d batches, %d errors.\n", res.nRows, res.nBatches, (int)res.errors.size());
+        TEST_CHECK(8 == res.nRows && 4 == res.nBatches && 1 == res.errors.size() && 8 == stm.m_nExecuted);
+        TEST_CHECK(1 == res.errors.size() && 1 == res.errors[0].nBatch && 3 == res.errors[0].nFirstRow
+            && 3 == res.errors[0].nRowCount && 1 == res.errors[0].nRowsDone && 1 == res.errors[0].nErrCode);
+        TEST_CHECK(conn.m_vecCommits.empty() && !stm.m_bBroken);
+    }
+
+    // 出错后停止：不再写入之后的批次，也不提交出错的批次
+    {
+        CFakeBulkStream stm(3);
+        CFakeBulkConn conn(&stm);
+        OTL::SBulkResult res = OTL::BulkWriteBatches(conn, stm, rows, SFakeBulkBinder(), OTL::SBulkOptions(3, 1, true));
+        printf("[bulk] stop on error: %ld rows in %d batches, %d commits.\n", res.nRows, res.nBatches, (int)conn.m_vecCommits.size());
+        TEST_CHECK(4 == res.nRows && 2 == res.nBatches && 1 == res.errors.size() && 4 == stm.m_nExecuted);
+        TEST_CHECK(1 == conn.m_vecCommits.size() && 3 == conn.m_vecCommits[0]);
+    }
+
+    // 需重连的错误：不要求停止时也停止，语句被标记为损坏
+    rows[4] = 4;
+    rows[7] = -3113;
+    {
+        CFakeBulkStream stm(3);
+        CFakeBulkConn conn(&stm);
+        OTL::SBulkResult res = OTL::BulkWriteBatches(conn, stm, rows, SFakeBulkBinder(), OTL::SBulkOptions(3, 0, false));
+        printf("[bulk] reconnect error: %ld rows in %d batches, broken %d.\n", res.nRows, res.nBatches, stm.m_bBroken);
+        TEST_CHECK(7 == res.nRows && 3 == res.nBatches && 1 == res.errors.size() && stm.m_bBroken);
+        TEST_CHECK(1 == res.errors.size() && 2 == res.errors[0].nBatch && 6 == res.errors[0].nFirstRow
+            && 1 == res.errors[0].nRowsDone && 3113 == res.errors[0].nErrCode);
+    }
+
+    // 不满一批的最后一批由flush执行时出错：每2批提交一次，出错的批次之后照常提交
+    rows[7] = 7;
+    rows[9] = -1;
+    {
+        CFakeBulkStream stm(3);
+        CFakeBulkConn conn(&stm);
+        OTL::SBulkResult res = OTL::BulkWriteBatches(conn, stm, rows, SFakeBulkBinder(), OTL::SBulkOptions(3, 2, false));
+        printf("[bulk] last batch error: %ld rows in %d batches, %d commits.\n", res.nRows, res.nBatches, (int)conn.m_vecCommits.size());
+        TEST_CHECK(9 == res.nRows && 4 == res.nBatches && 1 == res.errors.size());
+        TEST_CHECK(1 == res.errors.size() && 3 == res.errors[0].nBatch && 9 == res.errors[0].nFirstRow
+            && 1 == res.errors[0].nRowCount && 0 == res.errors[0].nRowsDone);
+        TEST_CHECK(2 == conn.m_vecCommits.size() && 6 == conn.m_vecCommits[0] && 9 == conn.m_vecCommits[1]);
+    }
+    return nFailed;
+}
+
+static void grow_retry_waiter(void *pArg)
+{
+    SClassWaitArg *pWait = (SClassWaitArg *)pArg;
+    pWait->pConn = pWait->pPool->WaitConn(5000, pWait->nClass);
+}
+
+// 测试新建连接失败后的重试：服务器不可用时初始化没有连接，等待者触发的增长失败，
+// 服务器恢复后由后台线程退避重试，等待者拿到连接
+int test_grow_retry()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    sim.SetServerDown(true);
+    int nInit = dbpool.Init("sim", 1, 1);
+    printf("[grow] server down, init connected %d.\n", nInit);
+    TEST_CHECK(0 == nInit);
+
+    SClassWaitArg wait = { &dbpool, 0, NULL };
+    OTL::COTLThread thread;
+    thread.Start(grow_retry_waiter, &wait);
+    while( dbpool.GetOutstandingNum() < 1 )
+        OTL::SleepUs(1000);
+    OTL::SleepUs(300 * 1000);
+
+    unsigned long long tUp = OTL::GetTickUs();
+    sim.SetServerDown(false);
+    thread.Join();
+    unsigned long long nWaitMs = (OTL::GetTickUs() - tUp) / 1000;
+    printf("[grow] server up, waiter got connection %d after %llu ms.\n", wait.pConn != NULL, nWaitMs);
+    TEST_CHECK(NULL != wait.pConn && nWaitMs < 3000);
+    if( wait.pConn )
+        dbpool.ReleaseConn(wait.pConn);
+    return nFailed;
+}
+
+#if __cplusplus >= 202002L || ( defined(_MSVC_LANG) && _MSVC_LANG >= 202002L )
+// 最简协程类型：创建后立即执行，结束时自动销毁
+struct SCoroTask
+{
+    struct promise_type
+    {
+        SCoroTask get_return_object() { return SCoroTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static SCoroTask coro_query(OTL::CDBConnPool& pool, volatile long *pGood, volatile long *pDone)
+{
+    OTL::CDBCoroConn conn = co_await OTL::AcquireAsync(pool, 2000);
+    if( conn.Good() )
+    {
+        CSimAsyncQuery query;
+        if( co_await conn.Query(query) )
+            OTL::AtomicAdd(pGood, 1);
+    }
+    conn.Release();
+    OTL::AtomicAdd(pDone, 1);
+}
+
+// 测试协程接口：2个协程共用只有1个连接的连接池，后一个挂起等待前一个归还连接
+int test_coroutine()
+{
+    int nFailed = 0;
+    OTL::CDBSimBackend sim;
+    sim.SetQueryLatency(50 * 1000);
+    OTL::CDBConnPool dbpool;
+    dbpool.SetBackend(&sim);
+    dbpool.SetMaxConnNum(1);
+    if( 1 != dbpool.Init("sim", 1) || !dbpool.EnableAsync(2) )
+    {
+        printf("Initialized database connection pool failed, reason: %s.\n", dbpool.GetLastError());
+        return -1;
+    }
+
+    volatile long nGood = 0, nDone = 0;
+    unsigned long long tBegin = OTL::GetTickUs();
+    coro_query(dbpool, &nGood, &nDone);
+    coro_query(dbpool, &nGood, &nDone);
+    // 两个协程都已挂起，调用线程没有被阻塞
+    bool bSuspended = (0 == nDone);
+    while( nDone < 2 && OTL::GetTickUs() - tBegin < 5000 * 1000 )
+        OTL::SleepUs(1000);
+    unsigned long long nMs = (OTL::GetTickUs() - tBegin) / 1000;
+    printf("[coro] suspended %d, %ld/2 queries done in %llu ms.\n", bSuspended, nGood, nMs);
+    // 只有1个连接，两次查询必须先后执行
+    TEST_CHECK(bSuspended && 2 == nGood && nMs >= 100);
+    return nFailed;
+}
+#else
+int test_coroutine()
+{
     return 0;
 }
+#endif
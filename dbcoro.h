@@ -0,0 +1,190 @@
+/*****************************************************************************************
+File name   : dbcoro.h
+Version     : V1.0
+Description : 连接池的C++20协程接口：协程化获取连接与异步查询
+Others      : 需要C++20编译器，低于C++20时本文件为空；依赖连接池的异步执行
+              (CDBConnPool::EnableAsync)，等待连接和执行查询时挂起协程，
+              由执行线程完成后恢复，不阻塞调用协程所在的调度线程；
+              执行线程至少需要2个，以免所有线程都在等待连接
+******************************************************************************************/
+
+#ifndef __YZ_DBCORO_H__
+#define __YZ_DBCORO_H__
+
+#include "dbpool.h"
+
+#if __cplusplus >= 202002L || ( defined(_MSVC_LANG) && _MSVC_LANG >= 202002L )
+
+#include <coroutine>
+#include <memory>
+#include <utility>
+
+namespace OTL
+{
+    /******************************************************************************************/
+    // 协程恢复方式：默认在完成查询的执行线程上直接恢复；调度器可以提供pfnPost，
+    // 把协程投递回自己的线程后再恢复
+    struct SCoroResumer
+    {
+        void (*pfnPost)(std::coroutine_handle<> h, void *pArg);
+        void  *pArg;
+
+        inline void Resume(std::coroutine_handle<> h) const
+        {
+            if( pfnPost )
+                pfnPost(h, pArg);
+            else
+                h.resume();
+        }
+    };
+
+    class CDBQueryAwaiter;
+
+    // 协程持有的连接：只能移动，析构时归还连接池
+    class CDBCoroConn
+    {
+    public:
+        CDBCoroConn() = default;
+        explicit CDBCoroConn(std::unique_ptr<CDBAppConn> pConn, SCoroResumer resumer = SCoroResumer())
+            : m_pConn(std::move(pConn)), m_Resumer(resumer) {}
+        CDBCoroConn(CDBCoroConn&&) = default;
+        CDBCoroConn& operator=(CDBCoroConn&&) = default;
+
+        // 连接是否可用
+        inline bool Good(void) const { return m_pConn && m_pConn->Good(); }
+        inline const char* GetLastError(void) const { return m_pConn ? m_pConn->GetLastError() : "NULL Connection"; }
+
+        // 同步使用连接(Commit、CDBStream等)
+        inline CDBAppConn& Get(void) { return *m_pConn; }
+        inline CDBAppConn* operator->(void) { return m_pConn.get(); }
+
+        // 提前归还连接
+        inline void Release(void) { m_pConn.reset(); }
+
+        // 在执行线程上用本连接执行查询，协程挂起直到完成：
+        //     bool bOK = co_await conn.Query(query);
+        // 查询成功返回true；提交失败(未启用异步执行或队列已满)时不挂起，返回false且
+        // query.IsDone()为false
+        CDBQueryAwaiter Query(CDBAsyncQuery& query);
+
+    private:
+        std::unique_ptr<CDBAppConn> m_pConn;
+        SCoroResumer                m_Resumer = SCoroResumer();
+    };
+
+    /******************************************************************************************/
+    // co_await AcquireAsync(pool, nTimeoutMs)：有空闲连接时不挂起；连接池已满时挂起协程，
+    // 由执行线程按WaitConn排队等待，拿到连接(或超时)后恢复；结果用Good()判断
+    class CDBAcquireAwaiter
+    {
+    public:
+        CDBAcquireAwaiter(CDBConnPool& pool, int nTimeoutMs, SCoroResumer resumer)
+            : m_Task(pool, nTimeoutMs, resumer) {}
+
+        bool await_ready(void)
+        {
+            // 不等待地尝试一次
+            m_Task.m_pConn.reset(new CDBAppConn(m_Task.m_pPool, 0));
+            if( m_Task.m_pConn->Good() || 0 == m_Task.m_nTimeoutMs )
+                return true;
+            m_Task.m_pConn.reset();
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            m_Task.m_hCoro = h;
+            m_Task.SetCallback(OnDone, &m_Task);
+            if( m_Task.m_pPool->SubmitAsync(&m_Task) )
+                return true; // 之后可能已在执行线程上恢复，不能再访问this
+
+            // 未启用异步执行：在当前线程上阻塞获取
+            m_Task.m_pConn.reset(new CDBAppConn(m_Task.m_pPool, m_Task.m_nTimeoutMs));
+            return false;
+        }
+        CDBCoroConn await_resume(void)
+        {
+            return CDBCoroConn(std::move(m_Task.m_pConn), m_Task.m_Resumer);
+        }
+
+    private:
+        // 执行线程上的获取任务，不执行SQL
+        class CAcquireTask : public CDBAsyncQuery
+        {
+        public:
+            CAcquireTask(CDBConnPool& pool, int nTimeoutMs, SCoroResumer resumer)
+                : m_pPool(&pool), m_nTimeoutMs(nTimeoutMs), m_Resumer(resumer) {}
+
+            CDBConnPool                * m_pPool;
+            int                          m_nTimeoutMs;
+            SCoroResumer                 m_Resumer;
+            std::coroutine_handle<>      m_hCoro;
+            std::unique_ptr<CDBAppConn>  m_pConn;
+
+        protected:
+            virtual void Process(CDBConnPool *pPool, int /*nAcquireTimeoutMs*/)
+            {
+                m_pConn.reset(new CDBAppConn(pPool, m_nTimeoutMs));
+            }
+        };
+
+        static void OnDone(CDBAsyncQuery * /*pQuery*/, void *pArg)
+        {
+            CAcquireTask *pTask = (CAcquireTask *)pArg;
+            pTask->m_Resumer.Resume(pTask->m_hCoro);
+        }
+
+        CAcquireTask m_Task;
+    };
+
+    inline CDBAcquireAwaiter AcquireAsync(CDBConnPool& pool, int nTimeoutMs = -1,
+        SCoroResumer resumer = SCoroResumer())
+    {
+        return CDBAcquireAwaiter(pool, nTimeoutMs, resumer);
+    }
+
+    /******************************************************************************************/
+    // co_await conn.Query(query)
+    class CDBQueryAwaiter
+    {
+    public:
+        CDBQueryAwaiter(CDBCoroConn& conn, CDBAsyncQuery& query, SCoroResumer resumer)
+            : m_pConn(&conn), m_pQuery(&query), m_Resumer(resumer), m_bSubmitted(false) {}
+
+        bool await_ready(void) { return !m_pConn->Good(); }
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            m_hCoro = h;
+            m_pQuery->SetCallback(OnDone, this);
+            m_bSubmitted = true;
+            if( m_pConn->Get().GetPool()->SubmitAsync(m_pQuery, &m_pConn->Get()) )
+                return true; // 之后可能已在执行线程上恢复，不能再访问this
+
+            m_bSubmitted = false;
+            m_pQuery->SetCallback(NULL, NULL);
+            return false;
+        }
+        bool await_resume(void) { return m_bSubmitted && m_pQuery->Good(); }
+
+    private:
+        static void OnDone(CDBAsyncQuery * /*pQuery*/, void *pArg)
+        {
+            CDBQueryAwaiter *pAwaiter = (CDBQueryAwaiter *)pArg;
+            pAwaiter->m_Resumer.Resume(pAwaiter->m_hCoro);
+        }
+
+        CDBCoroConn             * m_pConn;
+        CDBAsyncQuery           * m_pQuery;
+        SCoroResumer              m_Resumer;
+        std::coroutine_handle<>   m_hCoro;
+        bool                      m_bSubmitted;
+    };
+
+    inline CDBQueryAwaiter CDBCoroConn::Query(CDBAsyncQuery& query)
+    {
+        return CDBQueryAwaiter(*this, query, m_Resumer);
+    }
+}
+
+#endif // C++20
+
+#endif //__YZ_DBCORO_H__
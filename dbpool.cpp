@@ -14,6 +14,15 @@ Date          Author              Version          Modification
 
 #include "dbpool.h"
 
+// 调用者的返回地址，用于记录取出连接的调用位置
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_ReturnAddress)
+#define DBPOOL_CALLER() _ReturnAddress()
+#else
+#define DBPOOL_CALLER() __builtin_return_address(0)
+#endif
+
 #ifdef OS_WINDOWS
 
 #ifndef _UTF8_
@@ -89,7 +98,69 @@ namespace OTL
 #endif   
     }
     /*****************************************************************
-    Function    : IsNeedReconnect
+    Function    : CDBErrClassifier::CDBErrClassifier
+    Description : 构造函数，加载默认的错误分类表
+    ******************************************************************/
+    CDBErrClassifier::CDBErrClassifier()
+    {
+        Reset();
+    }
+    /*****************************************************************
+    Function    : CDBErrClassifier::Reset
+    Description : 恢复默认的错误分类表，未列出的错误码均为DB_ERR_FATAL
+    ******************************************************************/
+    void CDBErrClassifier::Reset(void)
+    {
+        static const struct { int nCode; EDBErrCategory eCategory; } s_arrDefault[] =
+        {
+            { 28,    DB_ERR_RECONNECT },    // ORA-00028: 会话已被终止
+            { 1012,  DB_ERR_RECONNECT },    // ORA-01012: 未登录
+            { 1033,  DB_ERR_RECONNECT },    // ORA-01033: 正在初始化或关闭
+            { 1034,  DB_ERR_RECONNECT },    // ORA-01034: ORACLE不可用
+            { 1089,  DB_ERR_RECONNECT },    // ORA-01089: 正在立即关闭
+            { 2396,  DB_ERR_RECONNECT },    // ORA-02396: 超出最大空闲时间
+            { 3113,  DB_ERR_RECONNECT },    // ORA-03113: 通信通道的文件结尾
+            { 3114,  DB_ERR_RECONNECT },    // ORA-03114: 未连接到 ORACLE
+            { 3135,  DB_ERR_RECONNECT },    // ORA-03135: 失去联系
+            { 12170, DB_ERR_RECONNECT },    // ORA-12170: 连接超时
+            { 12514, DB_ERR_RECONNECT },    // ORA-12514: 监听程序无法识别服务
+            { 12528, DB_ERR_RECONNECT },    // ORA-12528: 所有适用的例程都不允许建立新连接
+            { 12537, DB_ERR_RECONNECT },    // ORA-12537: 连接被关闭
+            { 12541, DB_ERR_RECONNECT },    // ORA-12541: TNS 无监听程序（需要启动监听后再重新连接）
+            { 25408, DB_ERR_RECONNECT },    // ORA-25408: 无法安全重放调用
+            { 54,    DB_ERR_RETRY },        // ORA-00054: 资源正忙(NOWAIT)
+            { 8177,  DB_ERR_RETRY },        // ORA-08177: 无法串行访问此事务处理
+            { 30006, DB_ERR_RETRY },        // ORA-30006: 资源已被占用(WAIT超时)
+            { 60,    DB_ERR_DEADLOCK },     // ORA-00060: 等待资源时检测到死锁
+            { 1555,  DB_ERR_SNAPSHOT }      // ORA-01555: 快照过旧
+        };
+
+        memset(m_arrCategory, DB_ERR_FATAL, sizeof(m_arrCategory));
+        for( size_t i = 0; i < sizeof(s_arrDefault) / sizeof(s_arrDefault[0]); ++i )
+            m_arrCategory[s_arrDefault[i].nCode] = (unsigned char)s_arrDefault[i].eCategory;
+    }
+    /*****************************************************************
+    Function    : CDBErrClassifier::Set
+    Description : 设置错误码的分类，须在工作线程启动之前调用
+    Input       : 
+        @ errcode   : 错误码(1 ~ MAX_CODE-1)
+        @ eCategory : 分类
+    ******************************************************************/
+    void CDBErrClassifier::Set(int errcode, EDBErrCategory eCategory)
+    {
+        if( errcode > 0 && errcode < MAX_CODE )
+            m_arrCategory[errcode] = (unsigned char)eCategory;
+    }
+
+    // 在main之前初始化，之后的查询不需要加锁
+    static CDBErrClassifier s_ErrClassifier;
+
+    CDBErrClassifier& GetErrClassifier(void)
+    {
+        return s_ErrClassifier;
+    }
+    /*****************************************************************
+    Function    : CheckErrCodeForReconnect
     Description : 根据错误码判断是否需要重新连接
     Input       : 
         @ errcode : OTL异常中的错误码
@@ -100,22 +171,7 @@ namespace OTL
     ******************************************************************/
     bool CheckErrCodeForReconnect(int errcode)
     {
-        static std::set<int> setCode;
-
-        // 初始化错误码集合
-        if( setCode.empty() )
-        {
-            setCode.insert(3113);   // ORA-03113: 通信通道的文件结尾
-            setCode.insert(3114);   // ORA-03114: 未连接到 ORACLE
-            setCode.insert(3135);   // ORA-03135: 失去联系
-            setCode.insert(12541);  // ORA-12541: TNS 无监听程序（需要启动监听后再重新连接）
-        }
-
-        // 判断错误码
-        if( setCode.find( errcode ) != setCode.end() )
-            return true;
-        else
-            return false;
+        return DB_ERR_RECONNECT == s_ErrClassifier.Classify(errcode);
     }
     /*****************************************************************
     Function    : TestConnection
@@ -145,38 +201,491 @@ namespace OTL
 
         return ( db.connected == 1 ) ? true : false;
     }
+    // 按两位数字查表格式化
+    static const char s_szDigitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    // 解析n位数字，遇到非数字(包括结束符)时失败，不会越过结束符读取
+    static inline bool ParseDigits(const char *p, int n, int& value)
+    {
+        int v = 0;
+        for( int i = 0; i < n; ++i )
+        {
+            unsigned int d = (unsigned int)(unsigned char)p[i] - '0';
+            if( d > 9 )
+                return false;
+            v = v * 10 + (int)d;
+        }
+        value = v;
+        return true;
+    }
+
+    static inline bool IsLeapYear(int year)
+    {
+        return ( 0 == year % 4 && 0 != year % 100 ) || 0 == year % 400;
+    }
     /*****************************************************************
     Function    : ConvertOtlDatetime
-    Description : 转换日期时间
+    Description : 转换日期时间，单次扫描，不调用strlen/atoi
+                  支持的格式：YYYY-MM-DD、YYYYMMDD，其后可跟" HH:MI:SS"
+                  (或"THH:MI:SS")，秒之后可跟"."和1~9位小数
     Input       : 
         @ odt   : otl的日期时间类型
         @ strDT : 日期时间字符串
-    Output      : odt
+    Output      : odt(失败时不变)
     Return      : 
         成功    ： true
         失败    ： false 
     ******************************************************************/
     bool ConvertOtlDatetime( otl_datetime& odt, const char* strDT)
     {
-        if( !strDT || !*strDT ) return false;
+        static const unsigned char s_arrMonthDays[13] = { 0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+        if( !strDT ) return false;
 
-        // 字符串的日期时间格式：YYYY-MM-DD HH:mi:ss  OR  YYYY-MM-DD
-        size_t len = strlen(strDT);
-        if( 10 != len && 19 != len ) return false;
+        int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+        const char *p = strDT;
+        if( !ParseDigits(p, 4, year) ) return false;
+        p += 4;
 
-        char buf[8] = {0};
-        memcpy(buf, strDT, 4 );   buf[4] = 0; odt.year  = atoi(buf);
-        memcpy(buf, strDT+5, 2 ); buf[2] = 0; odt.month = atoi(buf);
-        memcpy(buf, strDT+8, 2 );             odt.day   = atoi(buf);
+        bool bDash = ( '-' == *p );
+        p += bDash ? 1 : 0;
+        if( !ParseDigits(p, 2, month) ) return false;
+        p += 2;
+        if( bDash && '-' != *p++ ) return false;
+        if( !ParseDigits(p, 2, day) ) return false;
+        p += 2;
 
-        if( 19 == strlen(strDT))
+        unsigned long fraction = 0;
+        int frac_precision = 0;
+        if( ' ' == *p || 'T' == *p )
         {
-            memcpy(buf, strDT+11, 2 );       odt.hour   = atoi(buf);
-            memcpy(buf, strDT+14, 2 );       odt.minute = atoi(buf);
-            memcpy(buf, strDT+17, 4 );       odt.second = atoi(buf);
+            ++p;
+            if( !ParseDigits(p, 2, hour) || ':' != p[2] ) return false;
+            p += 3;
+            if( !ParseDigits(p, 2, minute) || ':' != p[2] ) return false;
+            p += 3;
+            if( !ParseDigits(p, 2, second) ) return false;
+            p += 2;
+
+            if( '.' == *p )
+            {
+                ++p;
+                for( ; frac_precision < 9; ++frac_precision, ++p )
+                {
+                    unsigned int d = (unsigned int)(unsigned char)*p - '0';
+                    if( d > 9 )
+                        break;
+                    fraction = fraction * 10 + d;
+                }
+                if( 0 == frac_precision ) return false;
+            }
         }
+        if( '\0' != *p ) return false;
+
+        // 范围校验
+        int nMaxDay = s_arrMonthDays[( month >= 1 && month <= 12 ) ? month : 0];
+        if( 2 == month && IsLeapYear(year) )
+            nMaxDay = 29;
+        if( year < 1 || day < 1 || day > nMaxDay || hour > 23 || minute > 59 || second > 59 )
+            return false;
+
+        odt.year           = year;
+        odt.month          = month;
+        odt.day            = day;
+        odt.hour           = hour;
+        odt.minute         = minute;
+        odt.second         = second;
+        odt.fraction       = fraction;
+        odt.frac_precision = frac_precision;
         return true;
     }
+    /*****************************************************************
+    Function    : ConvertOtlDatetimes
+    Description : 批量转换一列定长的日期时间字符串(如otl_stream的char[]数组
+                  或CDBCursor的行缓冲区)，每行须以'\0'结束
+    Input       : 
+        @ pOut    : 输出数组，至少nRows个
+        @ pColumn : 第一行字符串
+        @ nStride : 相邻两行的间隔字节数
+        @ nRows   : 行数
+        @ pValid  : 每行是否转换成功，可为NULL
+    Output      : pOut、pValid
+    Return      : 转换成功的行数
+    ******************************************************************/
+    int ConvertOtlDatetimes( otl_datetime* pOut, const char* pColumn, int nStride, int nRows,
+        unsigned char* pValid /* = NULL */ )
+    {
+        int nOK = 0;
+        for( int i = 0; i < nRows; ++i, pColumn += nStride )
+        {
+            bool bOK = ConvertOtlDatetime(pOut[i], pColumn);
+            if( !bOK )
+                pOut[i] = otl_datetime();
+            if( pValid )
+                pValid[i] = bOK ? 1 : 0;
+            nOK += bOK ? 1 : 0;
+        }
+        return nOK;
+    }
+    /*****************************************************************
+    Function    : FormatOtlDatetime
+    Description : 格式化日期时间为"YYYY-MM-DD HH:MI:SS[.f]"，按两位数字查表
+    Input       : 
+        @ odt         : otl的日期时间类型
+        @ buf         : 输出缓冲区，至少30字节
+        @ nFracDigits : 小数秒位数(0~9)，按odt.frac_precision换算
+    Output      : buf
+    Return      : 字符串长度
+    ******************************************************************/
+    int FormatOtlDatetime( const otl_datetime& odt, char* buf, int nFracDigits /* = 0 */ )
+    {
+        unsigned int year = (unsigned int)odt.year % 10000;
+        memcpy(buf,      s_szDigitPairs + (year / 100) * 2, 2);
+        memcpy(buf + 2,  s_szDigitPairs + (year % 100) * 2, 2);
+        buf[4] = '-';
+        memcpy(buf + 5,  s_szDigitPairs + ((unsigned int)odt.month  % 100) * 2, 2);
+        buf[7] = '-';
+        memcpy(buf + 8,  s_szDigitPairs + ((unsigned int)odt.day    % 100) * 2, 2);
+        buf[10] = ' ';
+        memcpy(buf + 11, s_szDigitPairs + ((unsigned int)odt.hour   % 100) * 2, 2);
+        buf[13] = ':';
+        memcpy(buf + 14, s_szDigitPairs + ((unsigned int)odt.minute % 100) * 2, 2);
+        buf[16] = ':';
+        memcpy(buf + 17, s_szDigitPairs + ((unsigned int)odt.second % 100) * 2, 2);
+
+        if( nFracDigits <= 0 )
+        {
+            buf[19] = '\0';
+            return 19;
+        }
+        if( nFracDigits > 9 )
+            nFracDigits = 9;
+
+        // 换算为nFracDigits位
+        unsigned long frac = odt.fraction;
+        for( int i = odt.frac_precision; i < nFracDigits; ++i )
+            frac *= 10;
+        for( int i = nFracDigits; i < odt.frac_precision; ++i )
+            frac /= 10;
+
+        buf[19] = '.';
+        for( int i = 19 + nFracDigits; i > 19; --i )
+        {
+            buf[i] = (char)('0' + frac % 10);
+            frac /= 10;
+        }
+        buf[20 + nFracDigits] = '\0';
+        return 20 + nFracDigits;
+    }
+    /*****************************************************************
+    Function    : FormatOtlDatetimes
+    Description : 批量格式化日期时间
+    Input       : 
+        @ pIn         : 输入数组
+        @ nRows       : 行数
+        @ pOut        : 第一行的输出位置
+        @ nStride     : 相邻两行的间隔字节数，至少30
+        @ nFracDigits : 小数秒位数(0~9)
+    Output      : pOut
+    Return      : 
+    ******************************************************************/
+    void FormatOtlDatetimes( const otl_datetime* pIn, int nRows, char* pOut, int nStride, int nFracDigits /* = 0 */ )
+    {
+        for( int i = 0; i < nRows; ++i, pOut += nStride )
+            FormatOtlDatetime(pIn[i], pOut, nFracDigits);
+    }
+    /*****************************************************************
+    Function    : GetTickUs
+    Description : 获取单调时钟，不受系统时间调整影响
+    Input       : 
+    Output      : 
+    Return      : 微秒数
+    ******************************************************************/
+    unsigned long long GetTickUs(void)
+    {
+#ifdef _WIN32
+        static LARGE_INTEGER freq = { 0 };
+        LARGE_INTEGER now;
+        if( freq.QuadPart == 0 )
+            QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&now);
+        return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000ULL
+            + (unsigned long long)(now.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+    }
+    /*****************************************************************
+    Function    : SleepUs
+    Description : 休眠指定微秒数(Windows下精度为毫秒)
+    Input       : 
+        @ nUs   : 微秒数
+    ******************************************************************/
+    void SleepUs(unsigned int nUs)
+    {
+        if( 0 == nUs )
+            return;
+#ifdef _WIN32
+        Sleep((nUs + 999) / 1000);
+#else
+        struct timespec ts;
+        ts.tv_sec  = nUs / 1000000;
+        ts.tv_nsec = (nUs % 1000000) * 1000;
+        while( nanosleep(&ts, &ts) != 0 && errno == EINTR ) {}
+#endif
+    }
+
+    /*****************************************************************
+
+        COTLSession OTL会话类
+
+    *****************************************************************/
+    /*****************************************************************
+    Function    : COTLSession::COTLSession
+    Description : 构造函数，初始化OTL环境
+    ******************************************************************/
+    COTLSession::COTLSession()
+    {
+        InitEnv();
+    }
+    COTLSession::~COTLSession()
+    {
+        try
+        {
+            Logoff();
+        }
+        catch( otl_exception & )
+        {
+        }
+    }
+    /*****************************************************************
+    Function    : COTLSession::Logon
+    Description : 登录数据库，且不自动提交
+    Input       : 
+        @ conn_str  ： 连接字符串
+    ******************************************************************/
+    void COTLSession::Logon(const char *conn_str)
+    {
+        m_db.rlogon(conn_str, 0);
+    }
+    /*****************************************************************
+    Function    : COTLSession::Logoff
+    Description : 登出数据库，抛出异常时也标记为已断开
+    ******************************************************************/
+    void COTLSession::Logoff(void)
+    {
+        if( m_db.connected != 1 )
+            return;
+        try
+        {
+            m_db.logoff();
+        }
+        catch( otl_exception & )
+        {
+            m_db.connected = 0;
+            throw;
+        }
+        m_db.connected = 0;
+    }
+    /*****************************************************************
+
+        CDBStmtCache 语句缓存类
+
+    *****************************************************************/
+    /*****************************************************************
+    Function    : CDBStmtCache::CDBStmtCache
+    Description : 构造函数
+    ******************************************************************/
+    CDBStmtCache::CDBStmtCache()
+        : m_nHitNum(0)
+        , m_nMissNum(0)
+    {
+    }
+    /*****************************************************************
+    Function    : CDBStmtCache::~CDBStmtCache
+    Description : 析构函数，关闭所有缓存的语句
+    ******************************************************************/
+    CDBStmtCache::~CDBStmtCache()
+    {
+        Clear();
+    }
+    /*****************************************************************
+    Function    : CDBStmtCache::Checkout
+    Description : 取出语句，命中则复用已解析的语句，否则解析新语句
+                  （解析失败时抛出otl_exception）
+    Input       : 
+        @ db        : 语句所属的连接
+        @ buf_size  : otl_stream缓冲区大小
+        @ sql       : SQL文本
+        @ nCapacity : 缓存数量上限，0为不缓存
+    Output      : 
+        @ bReused   : 是否复用了缓存中的语句
+    Return      : 语句条目
+    ******************************************************************/
+    CDBStmtCache::SStmtEntry * CDBStmtCache::Checkout(otl_connect& db, int buf_size,
+        const char *sql, unsigned int nCapacity, bool& bReused)
+    {
+        bReused = false;
+
+        char szBuf[16] = {0};
+        sprintf(szBuf, "%d:", buf_size);
+        std::string strKey = szBuf;
+        strKey += sql;
+
+        if( nCapacity > 0 )
+        {
+            std::map<std::string, SStmtEntry*>::iterator it = m_mapStmt.find(strKey);
+            if( it != m_mapStmt.end() && !it->second->bInUse )
+            {
+                SStmtEntry *pEntry = it->second;
+                pEntry->bInUse = true;
+                m_lstLru.splice(m_lstLru.begin(), m_lstLru, pEntry->itLru);
+                ++m_nHitNum;
+                bReused = true;
+                return pEntry;
+            }
+        }
+        ++m_nMissNum;
+
+        SStmtEntry *pEntry = new SStmtEntry;
+        pEntry->pStream = new otl_stream;
+        pEntry->bInUse = true;
+        try
+        {
+            pEntry->pStream->open(buf_size, sql, db);
+        }
+        catch( otl_exception & )
+        {
+            delete pEntry->pStream;
+            delete pEntry;
+            throw;
+        }
+
+        // 同一语句正在使用中(嵌套使用)或不缓存时作为临时语句
+        if( nCapacity > 0 && m_mapStmt.find(strKey) == m_mapStmt.end() )
+        {
+            EvictLru(nCapacity - 1);
+            pEntry->strKey = strKey;
+            m_lstLru.push_front(pEntry);
+            pEntry->itLru = m_lstLru.begin();
+            m_mapStmt[strKey] = pEntry;
+        }
+        return pEntry;
+    }
+    /*****************************************************************
+    Function    : CDBStmtCache::Checkin
+    Description : 归还语句；未提交的批量数据会被flush
+    Input       : 
+        @ pEntry  : 语句条目
+        @ bBroken : 语句是否已损坏(使用中发生异常)
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBStmtCache::Checkin(SStmtEntry *pEntry, bool bBroken)
+    {
+        if( !bBroken && !pEntry->strKey.empty() )
+        {
+            try
+            {
+                if( pEntry->pStream->get_dirty_buf_len() > 0 )
+                    pEntry->pStream->flush();
+                pEntry->bInUse = false;
+                return;
+            }
+            catch( otl_exception & )
+            {
+                // flush失败，丢弃该语句
+            }
+        }
+
+        if( !pEntry->strKey.empty() )
+        {
+            m_lstLru.erase(pEntry->itLru);
+            m_mapStmt.erase(pEntry->strKey);
+        }
+        CloseEntry(pEntry);
+    }
+    /*****************************************************************
+    Function    : CDBStmtCache::Clear
+    Description : 关闭所有缓存的语句
+    Input       : 
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBStmtCache::Clear(void)
+    {
+        std::list<SStmtEntry*>::iterator it;
+        for( it = m_lstLru.begin(); it != m_lstLru.end(); ++it )
+            CloseEntry(*it);
+        m_lstLru.clear();
+        m_mapStmt.clear();
+    }
+    /*****************************************************************
+    Function    : CDBStmtCache::EvictLru
+    Description : 淘汰最近最少使用的空闲语句，直到数量不超过nCapacity
+    Input       : 
+        @ nCapacity : 保留的数量
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBStmtCache::EvictLru(unsigned int nCapacity)
+    {
+        std::list<SStmtEntry*>::iterator it = m_lstLru.end();
+        while( m_mapStmt.size() > nCapacity && it != m_lstLru.begin() )
+        {
+            --it;
+            SStmtEntry *pEntry = *it;
+            if( pEntry->bInUse )
+                continue;
+
+            it = m_lstLru.erase(it);
+            m_mapStmt.erase(pEntry->strKey);
+            CloseEntry(pEntry);
+        }
+    }
+    /*****************************************************************
+    Function    : CDBStmtCache::CloseEntry
+    Description : 关闭并释放语句(连接已断开时忽略异常)
+    ******************************************************************/
+    void CDBStmtCache::CloseEntry(SStmtEntry *pEntry)
+    {
+        try
+        {
+            pEntry->pStream->close();
+        }
+        catch( otl_exception & )
+        {
+        }
+        delete pEntry->pStream;
+        delete pEntry;
+    }
+    /*****************************************************************
+    Function    : GetCpuShard
+    Description : 获取当前线程所在CPU对应的分片下标，
+                  无法获取CPU时按线程标识分散
+    Input       : 
+        @ nShardNum : 分片数量
+    Output      : 
+    Return      : 分片下标
+    ******************************************************************/
+    int GetCpuShard(int nShardNum)
+    {
+        if( nShardNum <= 1 )
+            return 0;
+#ifdef _WIN32
+        return (int)(GetCurrentProcessorNumber() % nShardNum);
+#elif defined(__linux__)
+        int cpu = sched_getcpu();
+        return (cpu < 0) ? 0 : (cpu % nShardNum);
+#else
+        return (int)(((unsigned long)pthread_self() >> 6) % nShardNum);
+#endif
+    }
     /*****************************************************************
 
         CDBConn 连接类
@@ -189,9 +698,26 @@ namespace OTL
     Output      : 无
     Return      : 
     ******************************************************************/
-    CDBConn::CDBConn()
+    CDBConn::CDBConn(CDBSession *pSession /* = NULL */)
+        : m_pNextIdle(NULL)
+        , m_tIdleSince(0)
+#ifdef DBPOOL_DEBUG
+        , m_nCheckedOut(0)
+#endif
+        , m_nClass(-1)
+        , m_nGeneration(0)
+        , m_nFailCount(0)
+        , m_tNextRetry(0)
+        , m_pHeldPrev(NULL)
+        , m_pHeldNext(NULL)
+        , m_tCheckOut(0)
+        , m_pSite(NULL)
+        , m_bHoldWarned(false)
+        , m_bReclaimed(false)
+        , m_pSession(pSession)
     {
-        InitEnv();
+        if( NULL == m_pSession )
+            m_pSession = new COTLSession;
     }
     /*****************************************************************
     Function    : CDBConn::~CDBConn
@@ -203,6 +729,7 @@ namespace OTL
     CDBConn::~CDBConn()
     {
         Close();
+        delete m_pSession;
     }
     /*****************************************************************
     Function    : CDBConn::Connect
@@ -219,14 +746,14 @@ namespace OTL
         m_strConn = conn_str;
   	try
 		{
-            m_db.rlogon(conn_str, 0); //连接数据库，且不自动提交
+            m_pSession->Logon(conn_str); //连接数据库，且不自动提交
         }
         catch( otl_exception & e )
         {
             GetErrFromException(e);
         }
 
-        return ( m_db.connected == 1 ) ? true : false;
+        return IsConnected();
     }
     /*****************************************************************
     Function    : CDBConn::Reconnect
@@ -240,22 +767,33 @@ namespace OTL
     ******************************************************************/
     bool CDBConn::Reconnect(bool bForce /* = false */)
     {
-        if( m_db.connected == 1 && !bForce )
+        if( IsConnected() && !bForce )
             return true;
 
+        m_StmtCache.Clear(); // 游标随会话失效
+
+        // 连接已断开时logoff可能抛出异常，不能影响之后的rlogon
         try
         {
             //m_db.session_end();
             //m_db.session_reopen();  // need test it
-            m_db.logoff();
-            m_db.rlogon(m_strConn.c_str());
+            m_pSession->Logoff();
+        }
+        catch( otl_exception & )
+        {
+        }
+
+        try
+        {
+            m_pSession->Logon(m_strConn.c_str()); // 与Connect一致，不自动提交
+            ClearException();
         }
         catch( otl_exception & e )
         {
             GetErrFromException(e);
         }
 
-        return ( m_db.connected == 1 ) ? true : false;
+        return IsConnected();
     }
     /*****************************************************************
     Function    : CDBConn::Close
@@ -266,17 +804,17 @@ namespace OTL
     ******************************************************************/
     void CDBConn::Close()
     {
+        m_StmtCache.Clear();
+
         try
         {
-            if( m_db.connected == 1 )
-                m_db.logoff();
+            if( IsConnected() )
+                m_pSession->Logoff();
         }
         catch( otl_exception & e )
         {
             GetErrFromException(e);
         }
-
-        m_db.connected = 0;
     }
     /*****************************************************************
     Function    : CDBConn::IsNeedReconnect
@@ -289,13 +827,57 @@ namespace OTL
     ******************************************************************/
     bool CDBConn::IsNeedReconnect(void)
     {
-        if( ( m_db.connected == 0 ) // 未连接
-            || ( m_db.connected == 1 && CheckErrCodeForReconnect(m_err.code) ) ) // 连接异常，需要重新连接
+        bool bConnected = IsConnected();
+        if( !bConnected // 未连接
+            || ( bConnected && CheckErrCodeForReconnect(m_err.code) ) ) // 连接异常，需要重新连接
             return true;
         else
             return false;
     }
     /*****************************************************************
+    Function    : CDBConn::Ping
+    Description : 执行一次最轻量的服务器往返，检查连接是否可用，
+                  成功时清除之前记录的异常
+    Input       :     
+    Output      : 无
+    Return      : 
+        可用    ： true
+        不可用  ： false
+    ******************************************************************/
+    bool CDBConn::Ping(void)
+    {
+        if( !IsConnected() )
+            return false;
+
+        try
+        {
+            m_pSession->Ping();
+        }
+        catch( otl_exception & e )
+        {
+            GetErrFromException(e);
+            return false;
+        }
+        ClearException();
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBConn::GetDb
+    Description : 获取OTL连接对象
+    Input       :     
+    Output      : 无
+    Return      : OTL连接对象，后端不支持时抛出runtime_error
+    ******************************************************************/
+    otl_connect& CDBConn::GetDb(void)
+    {
+        otl_connect *pDb = m_pSession->GetOtlConnect();
+        if( NULL == pDb )
+        {
+            throw runtime_error("database backend does not support otl_connect");
+        }
+        return *pDb;
+    }
+    /*****************************************************************
     Function    : CDBConn::GetErrFromException
     Description : 通过异常获取错误信息字符串
     Input       : 
@@ -311,28 +893,492 @@ namespace OTL
     }
     /*****************************************************************
 
-        CDBSingletonConnPool 单件连接池类
-
-    *****************************************************************/
-    CDBSingletonConnPool CDBSingletonConnPool::m_SingletonPool;
-
-    /*****************************************************************
-
-        CDBConnPool 连接池类
+        CDBConnIdleSet 空闲连接集合类
 
     *****************************************************************/
-    //CDBConnPool CDBConnPool::m_Pool;
-
     /*****************************************************************
-    Function    : CDBConnPool::CDBConnPool
-    Description : 构造函数，初始化OTL环境
+    Function    : CDBConnIdleSet::CDBConnIdleSet
+    Description : 构造函数，分配分片
+    Input       : 
+        @ nShardNum : 分片数量，<= 0 则按CPU数量分片(最多64个)
     ******************************************************************/
-    CDBConnPool::CDBConnPool()
+    CDBConnIdleSet::CDBConnIdleSet(int nShardNum /* = 0 */)
+        : m_pShards(NULL)
+        , m_nShardNum(nShardNum)
+        , m_bLifo(false)
     {
-        InitEnv();
-    }
-    /*****************************************************************
-    Function    : CDBConnPool::~CDBConnPool
+        if( m_nShardNum <= 0 )
+        {
+#ifdef _WIN32
+            SYSTEM_INFO si;
+            GetSystemInfo(&si);
+            m_nShardNum = (int)si.dwNumberOfProcessors;
+#else
+            m_nShardNum = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        }
+        if( m_nShardNum <= 0 )
+            m_nShardNum = 1;
+        if( m_nShardNum > 64 )
+            m_nShardNum = 64;
+
+        m_pShards = new SIdleShard[m_nShardNum];
+        for( int i = 0; i < m_nShardNum; ++i )
+        {
+            m_pShards[i].pHead  = NULL;
+            m_pShards[i].pTail  = NULL;
+            m_pShards[i].nCount = 0;
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::~CDBConnIdleSet
+    Description : 析构函数，连接对象由连接池负责删除
+    ******************************************************************/
+    CDBConnIdleSet::~CDBConnIdleSet()
+    {
+        delete [] m_pShards;
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::LocalShard
+    Description : 获取当前线程所在CPU对应的分片
+    Input       : 
+    Output      : 
+    Return      : 分片下标
+    ******************************************************************/
+    int CDBConnIdleSet::LocalShard(void)
+    {
+        return GetCpuShard(m_nShardNum);
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::Push
+    Description : 放入空闲连接到本地分片，后进先出时放在链表头
+    Input       : 
+        @ pConn : 连接对象指针
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBConnIdleSet::Push(CDBConn *pConn)
+    {
+        SIdleShard &shard = m_pShards[LocalShard()];
+        pConn->m_pNextIdle = NULL;
+        pConn->m_tIdleSince = GetTickUs();
+
+        shard.lock.Lock();
+        if( m_bLifo )
+        {
+            pConn->m_pNextIdle = shard.pHead;
+            if( NULL == shard.pTail )
+                shard.pTail = pConn;
+            shard.pHead = pConn;
+        }
+        else
+        {
+            if( shard.pTail )
+                shard.pTail->m_pNextIdle = pConn;
+            else
+                shard.pHead = pConn;
+            shard.pTail = pConn;
+        }
+        AtomicAdd(&shard.nCount, 1);
+        shard.lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::Pop
+    Description : 取出空闲连接，本地分片为空时从其他分片窃取
+    Input       : 
+    Output      : 
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL(所有分片均为空)
+    ******************************************************************/
+    CDBConn * CDBConnIdleSet::Pop(void)
+    {
+        int nLocal = LocalShard();
+        for( int i = 0; i < m_nShardNum; ++i )
+        {
+            SIdleShard &shard = m_pShards[(nLocal + i) % m_nShardNum];
+            if( NULL == shard.pHead ) // 不加锁预判，跳过空分片
+                continue;
+
+            shard.lock.Lock();
+            CDBConn *pConn = shard.pHead;
+            if( pConn )
+            {
+                shard.pHead = pConn->m_pNextIdle;
+                if( NULL == shard.pHead )
+                    shard.pTail = NULL;
+                AtomicAdd(&shard.nCount, -1);
+            }
+            shard.lock.Unlock();
+
+            if( pConn )
+            {
+                pConn->m_pNextIdle = NULL;
+                return pConn;
+            }
+        }
+        return NULL;
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::ForEach
+    Description : 遍历所有空闲连接
+    Input       : 
+        @ pFunc : 访问函数
+        @ pArg  : 访问函数参数
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBConnIdleSet::ForEach(VisitFunc pFunc, void *pArg)
+    {
+        for( int i = 0; i < m_nShardNum; ++i )
+        {
+            SIdleShard &shard = m_pShards[i];
+            shard.lock.Lock();
+            for( CDBConn *p = shard.pHead; p != NULL; p = p->m_pNextIdle )
+                pFunc(p, pArg);
+            shard.lock.Unlock();
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::TakeIdleBefore
+    Description : 取出空闲时间早于tBefore的连接(用于空闲超时回收)
+    Input       : 
+        @ tBefore : 空闲起始时间上限(GetTickUs)
+        @ nMax    : 最多取出的数量
+    Output      : 
+    Return      : 以m_pNextIdle串成的链表，用NextInChain遍历；没有则为NULL
+    ******************************************************************/
+    CDBConn * CDBConnIdleSet::TakeIdleBefore(unsigned long long tBefore, int nMax)
+    {
+        CDBConn *pChain = NULL;
+        for( int i = 0; i < m_nShardNum && nMax > 0; ++i )
+        {
+            SIdleShard &shard = m_pShards[i];
+            shard.lock.Lock();
+            CDBConn *pPrev = NULL;
+            CDBConn *p = shard.pHead;
+            while( p != NULL && nMax > 0 )
+            {
+                CDBConn *pNext = p->m_pNextIdle;
+                if( p->m_tIdleSince < tBefore )
+                {
+                    if( pPrev )
+                        pPrev->m_pNextIdle = pNext;
+                    else
+                        shard.pHead = pNext;
+                    if( shard.pTail == p )
+                        shard.pTail = pPrev;
+                    AtomicAdd(&shard.nCount, -1);
+                    --nMax;
+
+                    p->m_pNextIdle = pChain;
+                    pChain = p;
+                }
+                else
+                {
+                    pPrev = p;
+                }
+                p = pNext;
+            }
+            shard.lock.Unlock();
+        }
+        return pChain;
+    }
+    /*****************************************************************
+    Function    : CDBConnIdleSet::GetCount
+    Description : 获取空闲连接数量(各分片数量之和，不加锁，为近似值)
+    Input       : 
+    Output      : 
+    Return      : 空闲连接数量
+    ******************************************************************/
+    int CDBConnIdleSet::GetCount(void)
+    {
+        long nCount = 0;
+        for( int i = 0; i < m_nShardNum; ++i )
+            nCount += m_pShards[i].nCount;
+        return (int)nCount;
+    }
+    /*****************************************************************
+
+        SPoolStats 连接池统计快照
+
+    *****************************************************************/
+    SPoolStats::SPoolStats()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+    /*****************************************************************
+    Function    : SPoolStats::PercentileUs
+    Description : 按直方图估算百分位数
+    Input       : 
+        @ pHist : 直方图(HIST_BUCKETS个桶)
+        @ p     : 百分位(0~1)
+    Output      : 
+    Return      : 所在桶的上界(微秒)
+    ******************************************************************/
+    unsigned long long SPoolStats::PercentileUs(const long long *pHist, double p)
+    {
+        long long nTotal = 0;
+        for( int i = 0; i < HIST_BUCKETS; ++i )
+            nTotal += pHist[i];
+        if( 0 == nTotal )
+            return 0;
+
+        long long nRank = (long long)(p * nTotal + 0.5);
+        if( nRank < 1 )
+            nRank = 1;
+        long long nCount = 0;
+        for( int i = 0; i < HIST_BUCKETS; ++i )
+        {
+            nCount += pHist[i];
+            if( nCount >= nRank )
+                return (0 == i) ? 0 : (1ULL << i);
+        }
+        return 1ULL << (HIST_BUCKETS - 1);
+    }
+    /*****************************************************************
+    Function    : SPoolStats::ToString
+    Description : 输出统计信息为文本
+    Input       : 
+    Output      : 
+        @ strOut : 文本
+    Return      : 
+    ******************************************************************/
+    void SPoolStats::ToString(std::string& strOut) const
+    {
+        char buf[512] = {0};
+        sprintf(buf,
+            "conns: total=%d idle=%d in_use=%d broken=%d pending=%d waiting=%d\n"
+            "acquire: ok=%lld fail=%lld wait_avg_us=%lld wait_p50_us=%llu wait_p99_us=%llu wait_p999_us=%llu\n",
+            nTotal, nIdle, nInUse, nBroken, nPending, nWaiting,
+            nAcquires, nAcquireFails,
+            nAcquires > 0 ? nWaitSumUs / nAcquires : 0LL,
+            PercentileUs(arrWaitHist, 0.5), PercentileUs(arrWaitHist, 0.99), PercentileUs(arrWaitHist, 0.999));
+        strOut = buf;
+
+        sprintf(buf,
+            "hold: count=%lld avg_us=%lld p50_us=%llu p99_us=%llu p999_us=%llu\n"
+            "connect: ok=%lld fail=%lld reconnect: ok=%lld fail=%lld\n",
+            nHolds, nHolds > 0 ? nHoldSumUs / nHolds : 0LL,
+            PercentileUs(arrHoldHist, 0.5), PercentileUs(arrHoldHist, 0.99), PercentileUs(arrHoldHist, 0.999),
+            nConnects, nConnectFails, nReconnects, nReconnectFails);
+        strOut += buf;
+
+        static const char *s_arrBreaker[] = { "closed", "open", "half_open" };
+        sprintf(buf, "breaker: state=%s rejects=%lld shed=%lld\n",
+            s_arrBreaker[nBreakerState], nBreakerRejects, nShedRejects);
+        strOut += buf;
+
+        sprintf(buf, "held: over_warn=%d oldest_ms=%llu warns=%lld reclaims=%lld reclaimed_open=%d\n",
+            nHeldOverWarn, nOldestHeldMs, nHoldWarns, nHoldReclaims, nReclaimedOpen);
+        strOut += buf;
+    }
+    /*****************************************************************
+
+        SInitResult 连接池初始化结果
+
+    *****************************************************************/
+    SInitResult::SInitResult()
+        : nRequested(0)
+        , nConnected(0)
+        , nFailed(0)
+        , nSkipped(0)
+        , nPending(0)
+        , nReadyUs(0)
+        , nTotalUs(0)
+    {
+    }
+    void SInitResult::ToString(std::string& strOut) const
+    {
+        char buf[256] = {0};
+        sprintf(buf, "init: requested=%d connected=%d failed=%d skipped=%d pending=%d ready_ms=%llu total_ms=%llu\n",
+            nRequested, nConnected, nFailed, nSkipped, nPending, nReadyUs / 1000, nTotalUs / 1000);
+        strOut = buf;
+
+        std::map<std::string, int>::const_iterator it;
+        for( it = mapErrors.begin(); it != mapErrors.end(); ++it )
+        {
+            sprintf(buf, "init error x%d: ", it->second);
+            strOut += buf;
+            strOut += it->first;
+            strOut += "\n";
+        }
+    }
+    /*****************************************************************
+
+        CDBPoolStats 连接池统计计数器类
+
+    *****************************************************************/
+    CDBPoolStats::CDBPoolStats(int nShardNum)
+        : m_pShards(NULL)
+        , m_nShardNum(nShardNum > 0 ? nShardNum : 1)
+    {
+        m_pShards = new SStatShard[m_nShardNum];
+        memset((void *)m_pShards, 0, sizeof(SStatShard) * m_nShardNum);
+    }
+    CDBPoolStats::~CDBPoolStats()
+    {
+        delete [] m_pShards;
+    }
+    /*****************************************************************
+    Function    : CDBPoolStats::BucketOf
+    Description : 计算耗时所在的直方图桶
+    ******************************************************************/
+    int CDBPoolStats::BucketOf(unsigned long long nUs)
+    {
+        int i = 0;
+        while( nUs > 0 && i < SPoolStats::HIST_BUCKETS - 1 )
+        {
+            nUs >>= 1;
+            ++i;
+        }
+        return i;
+    }
+    void CDBPoolStats::RecordAcquire(unsigned long long nWaitUs, bool bOK)
+    {
+        SStatShard &shard = m_pShards[GetCpuShard(m_nShardNum)];
+        if( !bOK )
+        {
+            AtomicAdd64(&shard.nAcquireFails, 1);
+            return;
+        }
+        AtomicAdd64(&shard.nAcquires, 1);
+        if( nWaitUs > 0 )
+            AtomicAdd64(&shard.nWaitSumUs, (long long)nWaitUs);
+        AtomicAdd64(&shard.arrWaitHist[BucketOf(nWaitUs)], 1);
+    }
+    void CDBPoolStats::RecordHold(unsigned long long nHoldUs)
+    {
+        SStatShard &shard = m_pShards[GetCpuShard(m_nShardNum)];
+        AtomicAdd64(&shard.nHolds, 1);
+        AtomicAdd64(&shard.nHoldSumUs, (long long)nHoldUs);
+        AtomicAdd64(&shard.arrHoldHist[BucketOf(nHoldUs)], 1);
+    }
+    void CDBPoolStats::RecordConnect(bool bOK)
+    {
+        SStatShard &shard = m_pShards[GetCpuShard(m_nShardNum)];
+        AtomicAdd64(bOK ? &shard.nConnects : &shard.nConnectFails, 1);
+    }
+    void CDBPoolStats::RecordReconnect(bool bOK)
+    {
+        SStatShard &shard = m_pShards[GetCpuShard(m_nShardNum)];
+        AtomicAdd64(bOK ? &shard.nReconnects : &shard.nReconnectFails, 1);
+    }
+    void CDBPoolStats::RecordReject(bool bShed)
+    {
+        SStatShard &shard = m_pShards[GetCpuShard(m_nShardNum)];
+        AtomicAdd64(bShed ? &shard.nShedRejects : &shard.nBreakerRejects, 1);
+    }
+    void CDBPoolStats::RecordHoldWatch(bool bReclaimed)
+    {
+        SStatShard &shard = m_pShards[GetCpuShard(m_nShardNum)];
+        AtomicAdd64(bReclaimed ? &shard.nHoldReclaims : &shard.nHoldWarns, 1);
+    }
+    /*****************************************************************
+    Function    : CDBPoolStats::Collect
+    Description : 汇总各分片的累计计数和直方图
+    Input       : 
+    Output      : 
+        @ stats : 统计快照
+    Return      : 
+    ******************************************************************/
+    void CDBPoolStats::Collect(SPoolStats& stats)
+    {
+        for( int i = 0; i < m_nShardNum; ++i )
+        {
+            const SStatShard &shard = m_pShards[i];
+            stats.nAcquires       += shard.nAcquires;
+            stats.nAcquireFails   += shard.nAcquireFails;
+            stats.nConnects       += shard.nConnects;
+            stats.nConnectFails   += shard.nConnectFails;
+            stats.nReconnects     += shard.nReconnects;
+            stats.nReconnectFails += shard.nReconnectFails;
+            stats.nBreakerRejects += shard.nBreakerRejects;
+            stats.nShedRejects    += shard.nShedRejects;
+            stats.nHoldWarns      += shard.nHoldWarns;
+            stats.nHoldReclaims   += shard.nHoldReclaims;
+            stats.nWaitSumUs      += shard.nWaitSumUs;
+            stats.nHoldSumUs      += shard.nHoldSumUs;
+            stats.nHolds          += shard.nHolds;
+            for( int j = 0; j < SPoolStats::HIST_BUCKETS; ++j )
+            {
+                stats.arrWaitHist[j] += shard.arrWaitHist[j];
+                stats.arrHoldHist[j] += shard.arrHoldHist[j];
+            }
+        }
+    }
+    /*****************************************************************
+
+        CDBSingletonConnPool 单件连接池类
+
+    *****************************************************************/
+    CDBSingletonConnPool CDBSingletonConnPool::m_SingletonPool;
+
+    /*****************************************************************
+
+        CDBConnPool 连接池类
+
+    *****************************************************************/
+    //CDBConnPool CDBConnPool::m_Pool;
+
+    /*****************************************************************
+    Function    : CDBConnPool::CDBConnPool
+    Description : 构造函数，初始化OTL环境
+    ******************************************************************/
+    CDBConnPool::CDBConnPool()
+        : m_nAutoAddConnNum(2)
+        , m_nMaxConnNum(0)
+        , m_nTotalConnNum(0)
+        , m_nPendingConnNum(0)
+        , m_nGrowRequest(0)
+        , m_nWaitNum(0)
+        , m_nMinIdleNum(0)
+        , m_nIdleTimeoutSec(0)
+        , m_nDemandWindowSec(0)
+        , m_dAvgInUse(0.0)
+        , m_nStmtCacheSize(20)
+        , m_nGeneration(0)
+        , m_bHealthCheck(false)
+        , m_bStopHealth(false)
+        , m_nCheckedGeneration(0)
+        , m_nHealthIntervalSec(30)
+        , m_nMaxBackoffSec(60)
+        , m_nRandSeed((unsigned int)GetTickUs())
+        , m_Stats(m_IdleSet.GetShardNum())
+        , m_pBackend(NULL)
+        , m_pAsync(NULL)
+        , m_nInitParallel(1)
+        , m_nInitMinReady(-1)
+        , m_nInitLaunchNum(0)
+        , m_tInitBegin(0)
+        , m_pInitThreads(NULL)
+        , m_nInitThreadNum(0)
+        , m_pThreadSlot(NULL)
+        , m_pSlotList(NULL)
+        , m_nSlotIdleMs(1000)
+        , m_nParkedNum(0)
+        , m_bClassed(false)
+        , m_nClassInUse(0)
+        , m_nBreakerThreshold(0)
+        , m_nBreakerOpenMs(5000)
+        , m_nShedWaitMs(0)
+        , m_nConnFailStreak(0)
+        , m_nBreakerState(DB_BREAKER_CLOSED)
+        , m_tBreakerProbe(0)
+        , m_bHoldWatch(false)
+        , m_nHoldWarnMs(0)
+        , m_nHoldReclaimMs(0)
+        , m_nHoldReclaimMax(0)
+        , m_nReclaimedOpen(0)
+        , m_pHeldList(NULL)
+        , m_pWaitHead(NULL)
+        , m_pWaitTail(NULL)
+        , m_bStopGrow(false)
+    {
+        InitEnv();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::~CDBConnPool
     Description : 析构函数，销毁连接池，关闭OTL
     ******************************************************************/
     CDBConnPool::~CDBConnPool()
@@ -341,292 +1387,4490 @@ namespace OTL
     }
     /*****************************************************************
     Function    : CDBConnPool::Init
-    Description : 初始化连接池
+    Description : 初始化连接池，并启动后台增长线程；按SetInitPolicy设置的并发数
+                  同时建立连接，单个连接失败不影响其他连接，一个连接也没有建立
+                  且每个并发都已失败时放弃剩余的连接；详细结果见GetInitResult
     Input       : 
         @ conn_str     ： 连接字符串
         @ conn_num     ： 连接数量
         @ auto_add_num :  自动增加连接数量
     Output      : 无
     Return      : 
-        成功    ： >0 (=conn_num完全成功)
+        成功    ： >0 (=conn_num完全成功；延迟模式下为返回时已建立的数量)
         失败    ： 0    
     ******************************************************************/
     int CDBConnPool::Init( const char *conn_str, int conn_num, int auto_add_num /* = 2 */ )
     {
-        if ( m_ConnList.size() > 0 ) // 防止重复初始化
-            return m_ConnList.size();
+        if( m_pInitThreads && 0 == m_nInitLaunchNum && 0 == m_nTotalConnNum )
+        {
+            // 上一次延迟初始化一个连接也没有建立，允许重新初始化
+            delete [] m_pInitThreads;
+            m_pInitThreads   = NULL;
+            m_nInitThreadNum = 0;
+        }
+        if ( m_nTotalConnNum > 0 || m_pInitThreads ) // 防止重复初始化
+            return GetConnNum();
 
         m_strConn = conn_str;
         m_nAutoAddConnNum = auto_add_num;
 
         //otl_connect::otl_initialize(1); // initialize OCI environmen
 
-        for (int i = 0; i < conn_num; ++i)
+        if( m_nMaxConnNum > 0 && conn_num > (int)m_nMaxConnNum )
+            conn_num = m_nMaxConnNum;
+        if( conn_num < 0 )
+            conn_num = 0;
+
+        // 延迟模式下未建立的连接由调用者等待，需要后台线程已运行
+        if( !m_GrowThread.IsRunning() )
+        {
+            m_bStopGrow = false;
+            m_GrowThread.Start(GrowThreadFunc, this);
+        }
+        if( m_bHealthCheck && !m_HealthThread.IsRunning() )
+        {
+            m_bStopHealth = false;
+            m_HealthThread.Start(HealthThreadFunc, this);
+        }
+
+        unsigned int nParallel = m_nInitParallel;
+        if( nParallel > (unsigned int)conn_num )
+            nParallel = (unsigned int)conn_num;
+        int nMinReady = ( m_nInitMinReady < 0 || m_nInitMinReady > conn_num ) ? conn_num : m_nInitMinReady;
+        bool bLazy = nMinReady < conn_num;
+
+        m_Lock.Lock();
+        m_InitResult = SInitResult();
+        m_InitResult.nRequested = conn_num;
+        m_InitResult.nPending   = conn_num;
+        m_tInitBegin            = GetTickUs();
+        m_nInitLaunchNum        = conn_num;
+        m_nPendingConnNum      += conn_num;
+        m_Lock.Unlock();
+
+        // 等待全部完成时调用线程也参与建立
+        m_nInitThreadNum = bLazy ? nParallel : (nParallel > 0 ? nParallel - 1 : 0);
+        if( m_nInitThreadNum > 0 )
+        {
+            m_pInitThreads = new COTLThread[m_nInitThreadNum];
+            for( unsigned int i = 0; i < m_nInitThreadNum; ++i )
+                m_pInitThreads[i].Start(InitThreadFunc, this);
+        }
+        if( !bLazy )
+            InitLoop();
+
+        m_Lock.Lock();
+        while( m_InitResult.nConnected < nMinReady && m_InitResult.nPending > 0 )
+            m_InitCond.Wait(m_Lock);
+        m_InitResult.nReadyUs = GetTickUs() - m_tInitBegin;
+        m_Lock.Unlock();
+
+        if( !bLazy && m_pInitThreads )
         {
-            CDBConn * pConn = new CDBConn;
-            if( !pConn->Connect(conn_str) )
+            delete [] m_pInitThreads;  // 已全部完成，析构时Join
+            m_pInitThreads   = NULL;
+            m_nInitThreadNum = 0;
+        }
+
+        return GetConnNum();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::SetInitPolicy
+    Description : 设置初始化策略(须在Init之前调用)
+    Input       : 
+        @ parallel_num ： 同时建立的连接数
+        @ min_ready    ： < 0 等待全部完成；否则建立min_ready个后Init即返回，
+                          其余在后台建立
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::SetInitPolicy(unsigned int parallel_num, int min_ready /* = -1 */)
+    {
+        m_nInitParallel = (parallel_num > 0) ? parallel_num : 1;
+        m_nInitMinReady = min_ready;
+    }
+    void CDBConnPool::GetInitResult(SInitResult& result)
+    {
+        m_Lock.Lock();
+        result = m_InitResult;
+        m_Lock.Unlock();
+    }
+    void CDBConnPool::InitThreadFunc(void *pArg)
+    {
+        ((CDBConnPool *)pArg)->InitLoop();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::InitLoop
+    Description : 逐个领取Init预留的连接并在锁外建立，成功的立即发布给
+                  等待者或空闲集合；一个连接也没有建立且失败数达到并发数时，
+                  认为服务器不可用，放弃剩余的连接
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::InitLoop(void)
+    {
+        m_Lock.Lock();
+        while( m_nInitLaunchNum > 0 )
+        {
+            --m_nInitLaunchNum;
+            m_Lock.Unlock();
+
+            CDBConn *pConn = NewConn();
+            bool bOK = pConn->Connect(m_strConn.c_str());
+            m_Stats.RecordConnect(bOK);
+            pConn->SetGeneration(m_nGeneration);
+
+            m_Lock.Lock();
+            --m_nPendingConnNum;
+            --m_InitResult.nPending;
+            UpdateBreaker(bOK);
+            if( bOK )
+            {
+                ++m_nTotalConnNum;
+                ++m_InitResult.nConnected;
+                PublishConn(pConn);
+                pConn = NULL;
+            }
+            else
             {
                 m_strErrMsg = pConn->GetLastError();
+                ++m_InitResult.nFailed;
+                ++m_InitResult.mapErrors[m_strErrMsg];
+                if( 0 == m_InitResult.nConnected && m_InitResult.nFailed >= (int)m_nInitParallel )
+                {
+                    m_InitResult.nSkipped += m_nInitLaunchNum;
+                    m_InitResult.nPending -= m_nInitLaunchNum;
+                    m_nPendingConnNum     -= m_nInitLaunchNum;
+                    m_nInitLaunchNum       = 0;
+                }
+            }
+            if( 0 == m_InitResult.nPending )
+                m_InitResult.nTotalUs = GetTickUs() - m_tInitBegin;
+            if( 0 == m_nPendingConnNum )
+                WakeFailFastWaiters();
+            m_InitCond.Broadcast();
+
+            if( pConn )
+            {
+                m_Lock.Unlock();
                 delete pConn;
-                break;
+                m_Lock.Lock();
+            }
+        }
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::Destroy
+    Description : 停止后台增长线程，销毁连接池
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::Destroy(void)
+    {
+        // 执行中的异步查询还持有连接，先停止执行器
+        if( m_pAsync )
+        {
+            m_pAsync->Stop();
+            delete m_pAsync;
+            m_pAsync = NULL;
+        }
+
+        m_Lock.Lock();
+        m_bStopGrow = true;
+        m_GrowCond.Signal();
+        // 延迟初始化未开始的连接不再建立
+        m_InitResult.nSkipped += m_nInitLaunchNum;
+        m_InitResult.nPending -= m_nInitLaunchNum;
+        m_nPendingConnNum     -= m_nInitLaunchNum;
+        m_nInitLaunchNum       = 0;
+        m_Lock.Unlock();
+        m_GrowThread.Join();
+        if( m_pInitThreads )
+        {
+            delete [] m_pInitThreads;
+            m_pInitThreads   = NULL;
+            m_nInitThreadNum = 0;
+        }
+
+        m_HealthLock.Lock();
+        m_bStopHealth = true;
+        m_HealthCond.Signal();
+        m_HealthLock.Unlock();
+        m_HealthThread.Join();
+
+        // 收回线程槽位中的连接，之后线程退出时不再回调
+        if( m_pThreadSlot )
+        {
+            m_Lock.Lock();
+            ReclaimThreadConns((unsigned long long)-1, false);
+            m_Lock.Unlock();
+            delete m_pThreadSlot;
+            m_pThreadSlot = NULL;
+            while( m_pSlotList )
+            {
+                SThreadSlot *pSlot = m_pSlotList;
+                m_pSlotList = pSlot->pNext;
+                delete pSlot;
             }
-            m_ConnList.push_back(pConn);
         }
 
-        return m_ConnList.size();
+        CDBConn *pConn = NULL;
+        while( NULL != (pConn = m_IdleSet.Pop()) )
+        {
+            delete pConn;
+            --m_nTotalConnNum;
+        }
+
+        m_lstBroken.splice(m_lstBroken.end(), m_lstSuspect);
+        list<CDBConn*>::iterator it;
+        for( it = m_lstBroken.begin(); it != m_lstBroken.end(); ++it )
+        {
+            delete (*it);
+            --m_nTotalConnNum;
+        }
+        m_lstBroken.clear();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::GetConn
+    Description : 从连接池中获取一个连接，没有空闲连接时请求后台线程
+                  增加连接并等待，新建连接失败或已达上限时返回NULL
+    Input       : 
+        @ bAutoAdd ： 是否自动增加连接
+        @ nClass   ： 工作负载类别
+    Output      : 无
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::GetConn(bool bAutoAdd /* = true */, int nClass /* = 0 */)
+    {
+        const void *pSite = DBPOOL_CALLER();
+        CDBConn *pConn = NULL;
+        if( 0 == m_nWaitNum && !m_bClassed )
+        {
+            // 快速路径：本线程槽位中的连接，其次只持有空闲集合的分片锁；
+            // 已有等待者时不插队，归还的连接属于等待最久的调用者
+            pConn = TakeThreadConn();
+            if( NULL == pConn )
+                pConn = PopValidConn();
+            if( pConn || !bAutoAdd )
+            {
+                m_Stats.RecordAcquire(0, pConn != NULL);
+                return CheckOut(pConn, pSite);
+            }
+        }
+
+        unsigned long long tBegin = GetTickUs();
+        m_Lock.Lock();
+        if( bAutoAdd )
+        {
+            pConn = AcquireLocked(-1, true, nClass);
+        }
+        else
+        {
+            if( nClass < 0 || nClass >= (int)m_vecClass.size() )
+                nClass = 0;
+            if( CanTakeNow(nClass) && NULL != (pConn = PopValidConn()) )
+                AssignClass(pConn, nClass);
+        }
+        m_Lock.Unlock();
+
+        m_Stats.RecordAcquire(GetTickUs() - tBegin, pConn != NULL);
+        return CheckOut(pConn, pSite);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::WaitConn
+    Description : 从连接池中获取一个连接，没有空闲连接时排队等待，
+                  由ReleaseConn或后台增长线程按优先级和先来先得的顺序直接移交连接
+    Input       : 
+        @ nTimeoutMs ： 等待超时(毫秒)，0不等待，< 0 无限等待
+        @ nClass     ： 工作负载类别
+    Output      : 无
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL(超时)
+    ******************************************************************/
+    CDBConn * CDBConnPool::WaitConn(int nTimeoutMs, int nClass /* = 0 */)
+    {
+        const void *pSite = DBPOOL_CALLER();
+        // 快速路径：已有等待者时不插队，保证先来先得
+        CDBConn *pConn = NULL;
+        if( 0 == m_nWaitNum && !m_bClassed )
+        {
+            pConn = TakeThreadConn();
+            if( NULL == pConn )
+                pConn = PopValidConn();
+            if( pConn )
+            {
+                m_Stats.RecordAcquire(0, true);
+                return CheckOut(pConn, pSite);
+            }
+        }
+
+        unsigned long long tBegin = GetTickUs();
+        m_Lock.Lock();
+        pConn = AcquireLocked(nTimeoutMs, false, nClass);
+        m_Lock.Unlock();
+
+        m_Stats.RecordAcquire(GetTickUs() - tBegin, pConn != NULL);
+        return CheckOut(pConn, pSite);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::AcquireLocked
+    Description : 获取连接的慢速路径(调用前需持有m_Lock)：没有更优先的等待者
+                  且类别允许时取空闲连接，否则请求增长并排队等待
+    Input       : 
+        @ nTimeoutMs ： 等待超时(毫秒)，0不等待，< 0 无限等待
+        @ bFailFast  ： 没有正在新建的连接时立即放弃(GetConn)
+        @ nClass     ： 工作负载类别
+    Output      : 无
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::AcquireLocked(int nTimeoutMs, bool bFailFast, int nClass)
+    {
+        if( nClass < 0 || nClass >= (int)m_vecClass.size() )
+            nClass = 0;
+
+        CDBConn *pConn = NULL;
+        if( CanTakeNow(nClass) )
+        {
+            pConn = PopValidConn();
+            if( NULL == pConn && m_pThreadSlot )
+                pConn = ReclaimThreadConns((unsigned long long)-1, true);
+            if( pConn )
+            {
+                AssignClass(pConn, nClass);
+                return pConn;
+            }
+        }
+
+        if( RejectAcquire() )
+            return NULL;
+
+        // 已用完份额的类别不增长，等待本类别归还
+        if( 0 == m_nPendingConnNum && AdmitClass(nClass) )
+            RequestGrow(m_nAutoAddConnNum);
+        if( bFailFast ? m_nPendingConnNum > 0 : 0 != nTimeoutMs )
+            pConn = WaitInQueue(nTimeoutMs, bFailFast, nClass);
+        return pConn;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::WaitInQueue
+    Description : 按优先级加入等待队列，等待连接移交(调用前需持有m_Lock)
+    Input       : 
+        @ nTimeoutMs ： 等待超时(毫秒)，< 0 无限等待
+        @ bFailFast  ： 没有正在新建的连接时立即放弃
+        @ nClass     ： 工作负载类别
+    Output      : 无
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::WaitInQueue(int nTimeoutMs, bool bFailFast, int nClass)
+    {
+        unsigned long long tBegin = GetTickUs();
+
+        SConnWaiter waiter;
+        waiter.pConn = NULL;
+        waiter.pNext = NULL;
+        waiter.bFailFast = bFailFast;
+        waiter.tEnqueue  = tBegin;
+        waiter.nClass    = nClass;
+        waiter.nPriority = m_bClassed ? m_vecClass[nClass].nPriority : 0;
+
+        // 排在所有优先级不低于自己的等待者之后
+        SConnWaiter *pPrev = NULL;
+        if( m_pWaitTail && m_pWaitTail->nPriority < waiter.nPriority )
+        {
+            for( SConnWaiter *p = m_pWaitHead; p != NULL && p->nPriority >= waiter.nPriority; p = p->pNext )
+                pPrev = p;
+        }
+        else
+        {
+            pPrev = m_pWaitTail;
+        }
+        if( pPrev )
+        {
+            waiter.pNext = pPrev->pNext;
+            pPrev->pNext = &waiter;
+        }
+        else
+        {
+            waiter.pNext = m_pWaitHead;
+            m_pWaitHead = &waiter;
+        }
+        if( NULL == waiter.pNext )
+            m_pWaitTail = &waiter;
+        AtomicAdd(&m_nWaitNum, 1);
+        FullMemoryBarrier();
+
+        while( NULL == waiter.pConn )
+        {
+            // 与ReleaseConn配合：释放者放回空闲集合后才看到等待者的情况
+            if( PickWaiter() == &waiter )
+            {
+                CDBConn *pConn = PopValidConn();
+                if( NULL == pConn && m_pThreadSlot )
+                    pConn = ReclaimThreadConns((unsigned long long)-1, true);
+                if( pConn )
+                {
+                    RemoveWaiter(&waiter);
+                    AssignClass(pConn, nClass);
+                    return pConn;
+                }
+            }
+            if( bFailFast && 0 == m_nPendingConnNum )
+                break;
+            if( DB_BREAKER_CLOSED != m_nBreakerState )
+                break;
+
+            int nWaitMs = -1;
+            if( nTimeoutMs > 0 )
+            {
+                unsigned long long nElapsed = (GetTickUs() - tBegin) / 1000;
+                if( nElapsed >= (unsigned long long)nTimeoutMs )
+                    break;
+                nWaitMs = nTimeoutMs - (int)nElapsed;
+            }
+            waiter.cond.Wait(m_Lock, nWaitMs);
+        }
+
+        if( NULL == waiter.pConn )
+        {
+            RemoveWaiter(&waiter);
+            if( DB_BREAKER_CLOSED != m_nBreakerState )
+            {
+                m_strErrMsg = "Circuit breaker is open!";
+                m_Stats.RecordReject(false);
+            }
+            else if( !bFailFast )
+            {
+                m_strErrMsg = "Wait for connection timeout!";
+            }
+        }
+        return waiter.pConn;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::RejectAcquire
+    Description : 没有可用的空闲连接时，熔断期间或队首等待过久时拒绝获取
+                  (调用前需持有m_Lock)
+    Input       : 
+    Output      : 无
+    Return      : 
+        拒绝    ： true
+        继续    ： false
+    ******************************************************************/
+    bool CDBConnPool::RejectAcquire(void)
+    {
+        if( DB_BREAKER_CLOSED != m_nBreakerState )
+        {
+            m_strErrMsg = "Circuit breaker is open!";
+            m_Stats.RecordReject(false);
+            return true;
+        }
+        if( m_nShedWaitMs > 0 && m_pWaitHead
+            && GetTickUs() - m_pWaitHead->tEnqueue > m_nShedWaitMs * 1000ULL )
+        {
+            m_strErrMsg = "Acquire queue is overloaded!";
+            m_Stats.RecordReject(true);
+            return true;
+        }
+        return false;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::UpdateBreaker
+    Description : 按新建连接的结果更新熔断器(调用前需持有m_Lock)：成功则恢复，
+                  连续失败达到阈值或试探失败则熔断，并唤醒所有等待者使其立即返回
+    Input       : 
+        @ bConnected ： 新建连接是否成功
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::UpdateBreaker(bool bConnected)
+    {
+        if( 0 == m_nBreakerThreshold )
+            return;
+        if( bConnected )
+        {
+            m_nConnFailStreak = 0;
+            m_nBreakerState = DB_BREAKER_CLOSED;
+            return;
+        }
+
+        ++m_nConnFailStreak;
+        if( DB_BREAKER_HALF_OPEN == m_nBreakerState
+            || (DB_BREAKER_CLOSED == m_nBreakerState && m_nConnFailStreak >= m_nBreakerThreshold) )
+        {
+            m_nBreakerState = DB_BREAKER_OPEN;
+            m_tBreakerProbe = GetTickUs() + m_nBreakerOpenMs * 1000ULL;
+            for( SConnWaiter *p = m_pWaitHead; p != NULL; p = p->pNext )
+                p->cond.Signal();
+            m_GrowCond.Signal();
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::SetCircuitBreaker
+    Description : 设置熔断与过载保护，fail_threshold为0时关闭并恢复
+    Input       : 
+        @ fail_threshold ： 熔断前连续新建连接失败的次数，0关闭
+        @ open_ms        ： 熔断后试探新建连接前的时间(毫秒)
+        @ shed_wait_ms   ： 队首等待超过该时间(毫秒)时拒绝新的获取，0不拒绝
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::SetCircuitBreaker(unsigned int fail_threshold, unsigned int open_ms /* = 5000 */,
+        unsigned int shed_wait_ms /* = 0 */)
+    {
+        m_Lock.Lock();
+        m_nBreakerThreshold = fail_threshold;
+        m_nBreakerOpenMs    = open_ms;
+        m_nShedWaitMs       = shed_wait_ms;
+        if( 0 == fail_threshold )
+        {
+            m_nConnFailStreak = 0;
+            m_nBreakerState   = DB_BREAKER_CLOSED;
+        }
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::AdmitClass
+    Description : 类别是否还能再使用一个连接(调用前需持有m_Lock)：未超过
+                  最大份额，并且在保证数以内，或者使用后剩余的容量仍够其他
+                  类别未用满的保证数
+    ******************************************************************/
+    bool CDBConnPool::AdmitClass(int nClass)
+    {
+        if( !m_bClassed )
+            return true;
+
+        const SWorkloadClass &cls = m_vecClass[nClass];
+        if( cls.nMaxShare > 0 && cls.nInUse >= cls.nMaxShare )
+            return false;
+        if( cls.nInUse < cls.nMinReserved || 0 == m_nMaxConnNum )
+            return true;
+
+        unsigned int nReserved = 0;
+        for( size_t i = 0; i < m_vecClass.size(); ++i )
+        {
+            if( (int)i != nClass && m_vecClass[i].nInUse < m_vecClass[i].nMinReserved )
+                nReserved += m_vecClass[i].nMinReserved - m_vecClass[i].nInUse;
+        }
+        return m_nClassInUse + 1 + nReserved <= m_nMaxConnNum;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::CanTakeNow
+    Description : 类别允许，且没有优先级不低于自己、能得到连接的等待者时，
+                  可以直接取空闲连接(调用前需持有m_Lock)
+    ******************************************************************/
+    bool CDBConnPool::CanTakeNow(int nClass)
+    {
+        if( !m_bClassed )
+            return NULL == m_pWaitHead;
+        if( !AdmitClass(nClass) )
+            return false;
+
+        int nPriority = m_vecClass[nClass].nPriority;
+        for( SConnWaiter *p = m_pWaitHead; p != NULL && p->nPriority >= nPriority; p = p->pNext )
+        {
+            if( AdmitClass(p->nClass) )
+                return false;
+        }
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::PickWaiter
+    Description : 选择下一个得到连接的等待者：队列按优先级排列，取第一个
+                  类别允许的(调用前需持有m_Lock)
+    ******************************************************************/
+    CDBConnPool::SConnWaiter * CDBConnPool::PickWaiter(void)
+    {
+        if( !m_bClassed )
+            return m_pWaitHead;
+
+        for( SConnWaiter *p = m_pWaitHead; p != NULL; p = p->pNext )
+        {
+            if( AdmitClass(p->nClass) )
+                return p;
+        }
+        return NULL;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::AssignClass
+    Description : 将取出的连接计入类别(调用前需持有m_Lock)
+    ******************************************************************/
+    void CDBConnPool::AssignClass(CDBConn *pConn, int nClass)
+    {
+        if( !m_bClassed )
+            return;
+        ++m_vecClass[nClass].nInUse;
+        ++m_nClassInUse;
+        pConn->m_nClass = nClass;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::AddWorkloadClass
+    Description : 添加工作负载类别(须在开始获取连接之前配置)，首次添加时
+                  同时建立默认类别0
+    Input       : 
+        @ name         ： 类别名称
+        @ min_reserved ： 保证的连接数
+        @ max_share    ： 最多使用的连接数，0不限
+        @ priority     ： 等待时的优先级，大的优先
+    Output      : 无
+    Return      : 
+        成功    ： 类别号
+        失败    ： -1(名称重复或保证数之和超过最大连接数)
+    ******************************************************************/
+    int CDBConnPool::AddWorkloadClass(const char *name, unsigned int min_reserved,
+        unsigned int max_share /* = 0 */, int priority /* = 0 */)
+    {
+        SWorkloadClass cls;
+        cls.strName      = name;
+        cls.nMinReserved = min_reserved;
+        cls.nMaxShare    = max_share;
+        cls.nPriority    = priority;
+        cls.nInUse       = 0;
+
+        m_Lock.Lock();
+        unsigned int nReserved = min_reserved;
+        for( size_t i = 0; i < m_vecClass.size(); ++i )
+        {
+            nReserved += m_vecClass[i].nMinReserved;
+            if( m_vecClass[i].strName == cls.strName )
+            {
+                m_strErrMsg = "Workload class already exists!";
+                m_Lock.Unlock();
+                return -1;
+            }
+        }
+        if( m_nMaxConnNum > 0 && nReserved > m_nMaxConnNum )
+        {
+            m_strErrMsg = "Reserved connections exceed max connection number!";
+            m_Lock.Unlock();
+            return -1;
+        }
+        if( m_vecClass.empty() )
+        {
+            SWorkloadClass def;
+            def.strName      = "default";
+            def.nMinReserved = 0;
+            def.nMaxShare    = 0;
+            def.nPriority    = 0;
+            def.nInUse       = 0;
+            m_vecClass.push_back(def);
+        }
+        m_vecClass.push_back(cls);
+        m_bClassed = true;
+        int nClass = (int)m_vecClass.size() - 1;
+        m_Lock.Unlock();
+        return nClass;
+    }
+    int CDBConnPool::FindWorkloadClass(const char *name)
+    {
+        int nClass = -1;
+        m_Lock.Lock();
+        for( size_t i = 0; i < m_vecClass.size(); ++i )
+        {
+            if( m_vecClass[i].strName == name )
+            {
+                nClass = (int)i;
+                break;
+            }
+        }
+        m_Lock.Unlock();
+        return nClass;
+    }
+    int CDBConnPool::GetClassInUse(int nClass)
+    {
+        int num = 0;
+        m_Lock.Lock();
+        if( nClass >= 0 && nClass < (int)m_vecClass.size() )
+            num = (int)m_vecClass[nClass].nInUse;
+        m_Lock.Unlock();
+        return num;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::RemoveWaiter
+    Description : 将放弃等待的调用者从等待队列中移除(调用前需持有m_Lock)
+    Input       : 
+        @ pWaiter ： 等待者
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::RemoveWaiter(SConnWaiter *pWaiter)
+    {
+        SConnWaiter *pPrev = NULL;
+        for( SConnWaiter *p = m_pWaitHead; p != NULL; pPrev = p, p = p->pNext )
+        {
+            if( p != pWaiter )
+                continue;
+
+            if( pPrev )
+                pPrev->pNext = p->pNext;
+            else
+                m_pWaitHead = p->pNext;
+            if( m_pWaitTail == p )
+                m_pWaitTail = pPrev;
+            AtomicAdd(&m_nWaitNum, -1);
+            break;
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::PublishConn
+    Description : 将连接移交给等待最久的调用者，没有等待者则放回空闲
+                  列表(调用前需持有m_Lock)
+    Input       : 
+        @ pConn ： 连接对象指针
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::PublishConn(CDBConn *pConn)
+    {
+        SConnWaiter *pWaiter = PickWaiter();
+        if( pWaiter )
+        {
+            RemoveWaiter(pWaiter);
+            AssignClass(pConn, pWaiter->nClass);
+            pWaiter->pConn = pConn;
+            pWaiter->cond.Signal();
+        }
+        else
+        {
+            m_IdleSet.Push(pConn);
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::DispatchIdleConns
+    Description : 将空闲集合中的连接依次移交给等待者(调用前需持有m_Lock)
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::DispatchIdleConns(void)
+    {
+        while( PickWaiter() )
+        {
+            CDBConn *pConn = PopValidConn();
+            if( NULL == pConn )
+                break;
+            PublishConn(pConn);
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::WakeFailFastWaiters
+    Description : 唤醒GetConn的等待者，使其在没有正在新建的连接时返回
+                  (调用前需持有m_Lock)
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::WakeFailFastWaiters(void)
+    {
+        for( SConnWaiter *p = m_pWaitHead; p != NULL; p = p->pNext )
+        {
+            if( p->bFailFast )
+                p->cond.Signal();
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ReleaseConn
+    Description : 释放连接，有等待者时直接移交给等待最久的调用者，
+                  否则返回到连接池中
+    Input       : 
+        @ pConn ： 连接对象指针
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::ReleaseConn( CDBConn *pConn )
+    {
+#ifdef DBPOOL_DEBUG
+        if( 0 != AtomicAdd(&pConn->m_nCheckedOut, -1) )
+        {
+            fprintf(stderr, "dbpool: connection %p returned to the pool more than once\n", (void *)pConn);
+            abort();
+        }
+#endif
+        if( m_bHoldWatch )
+        {
+            m_WatchLock.Lock();
+            bool bReclaimed = pConn->m_bReclaimed;
+            if( !bReclaimed )
+                UnlinkHeld(pConn);
+            else
+                --m_nReclaimedOpen;
+            m_WatchLock.Unlock();
+            if( bReclaimed )
+            {
+                // 已被收回并由新连接替代，关闭会话
+                delete pConn;
+                return;
+            }
+        }
+        if( pConn->m_nClass >= 0 )
+        {
+            // 按类别记账：归还后其他类别的等待者可能可以得到连接
+            m_Lock.Lock();
+            --m_vecClass[pConn->m_nClass].nInUse;
+            --m_nClassInUse;
+            pConn->m_nClass = -1;
+            if( IsSuspect(pConn) )
+                Quarantine(pConn);
+            else
+                m_IdleSet.Push(pConn);
+            DispatchIdleConns();
+            m_Lock.Unlock();
+            return;
+        }
+        if( IsSuspect(pConn) )
+        {
+            Quarantine(pConn);
+            return;
+        }
+        if( ParkThreadConn(pConn) )
+            return;
+        ReturnConn(pConn);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::CheckOut
+    Description : 记录连接被取出：启用持有时间监控时加入使用中链表；
+                  调试构建中归还两次的连接可能被同时交给两个调用者，
+                  在此处或ReleaseConn中发现时中止
+    Input       : 
+        @ pConn ： 连接对象指针，可以为NULL
+        @ pSite ： 调用位置
+    Output      : 无
+    Return      : pConn
+    ******************************************************************/
+    CDBConn * CDBConnPool::CheckOut(CDBConn *pConn, const void *pSite)
+    {
+        if( NULL == pConn )
+            return NULL;
+#ifdef DBPOOL_DEBUG
+        if( 1 != AtomicAdd(&pConn->m_nCheckedOut, 1) )
+        {
+            fprintf(stderr, "dbpool: connection %p handed out while in use\n", (void *)pConn);
+            abort();
+        }
+#endif
+        if( m_bHoldWatch )
+        {
+            m_WatchLock.Lock();
+            pConn->m_tCheckOut   = GetTickUs();
+            pConn->m_pSite       = pSite;
+            pConn->m_bHoldWarned = false;
+            pConn->m_pHeldPrev   = NULL;
+            pConn->m_pHeldNext   = m_pHeldList;
+            if( m_pHeldList )
+                m_pHeldList->m_pHeldPrev = pConn;
+            m_pHeldList = pConn;
+            m_WatchLock.Unlock();
+        }
+        return pConn;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::TagCallSite
+    Description : 用更外层的调用位置替换取出连接时记录的位置(CDBAppConn)
+    ******************************************************************/
+    void CDBConnPool::TagCallSite(CDBConn *pConn, const void *pSite)
+    {
+        if( !m_bHoldWatch )
+            return;
+        m_WatchLock.Lock();
+        pConn->m_pSite = pSite;
+        m_WatchLock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::UnlinkHeld
+    Description : 从使用中链表移除连接，不在链表中(启用监控前取出)时忽略
+                  (调用前需持有m_WatchLock)
+    ******************************************************************/
+    void CDBConnPool::UnlinkHeld(CDBConn *pConn)
+    {
+        if( pConn->m_pHeldPrev )
+            pConn->m_pHeldPrev->m_pHeldNext = pConn->m_pHeldNext;
+        else if( m_pHeldList == pConn )
+            m_pHeldList = pConn->m_pHeldNext;
+        else
+            return;
+        if( pConn->m_pHeldNext )
+            pConn->m_pHeldNext->m_pHeldPrev = pConn->m_pHeldPrev;
+        pConn->m_pHeldPrev = NULL;
+        pConn->m_pHeldNext = NULL;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::WatchHeldConns
+    Description : 检查使用中的连接(调用前需持有m_Lock)：持有超过告警阈值的
+                  计入告警，超过收回阈值的从链表移除并标记为已收回，不再
+                  计入连接数和类别，有等待者时新建连接替代；已收回未归还的
+                  会话达到上限时不再收回，避免会话数无限增长
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::WatchHeldConns(void)
+    {
+        unsigned long long tNow = GetTickUs();
+        int nReclaimed = 0;
+
+        m_WatchLock.Lock();
+        CDBConn *pConn = m_pHeldList;
+        while( pConn )
+        {
+            CDBConn *pNext = pConn->m_pHeldNext;
+            unsigned long long nHeldMs = (tNow > pConn->m_tCheckOut) ? (tNow - pConn->m_tCheckOut) / 1000 : 0;
+            if( !pConn->m_bHoldWarned && nHeldMs >= m_nHoldWarnMs )
+            {
+                pConn->m_bHoldWarned = true;
+                m_Stats.RecordHoldWatch(false);
+            }
+            if( m_nHoldReclaimMs > 0 && nHeldMs >= m_nHoldReclaimMs && m_nReclaimedOpen < m_nHoldReclaimMax )
+            {
+                UnlinkHeld(pConn);
+                pConn->m_bReclaimed = true;
+                ++m_nReclaimedOpen;
+                --m_nTotalConnNum;
+                if( pConn->m_nClass >= 0 )
+                {
+                    --m_vecClass[pConn->m_nClass].nInUse;
+                    --m_nClassInUse;
+                    pConn->m_nClass = -1;
+                }
+                m_Stats.RecordHoldWatch(true);
+                ++nReclaimed;
+            }
+            pConn = pNext;
+        }
+        m_WatchLock.Unlock();
+
+        if( nReclaimed > 0 )
+        {
+            if( m_nWaitNum > (long)m_nPendingConnNum )
+                RequestGrow((int)(m_nWaitNum - (long)m_nPendingConnNum));
+            DispatchIdleConns();
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::EnableHoldWatch
+    Description : 启用持有时间监控，由后台增长线程每秒检查一次
+    Input       : 
+        @ warn_ms    ： 告警阈值(毫秒)
+        @ reclaim_ms ： 收回阈值(毫秒)，0不收回
+        @ max_reclaimed ： 已收回而未归还的会话上限
+    Output      : 无
+    Return      : 
+        成功    ： true
+        失败    ： false(收回阈值小于告警阈值)
+    ******************************************************************/
+    bool CDBConnPool::EnableHoldWatch(unsigned int warn_ms, unsigned int reclaim_ms /* = 0 */,
+        unsigned int max_reclaimed /* = 1 */)
+    {
+        if( reclaim_ms > 0 && reclaim_ms < warn_ms )
+        {
+            m_strErrMsg = "Reclaim time is less than warning time!";
+            return false;
+        }
+
+        m_Lock.Lock();
+        m_nHoldWarnMs     = warn_ms;
+        m_nHoldReclaimMs  = reclaim_ms;
+        m_nHoldReclaimMax = max_reclaimed;
+        m_bHoldWatch      = true;
+        m_GrowCond.Signal();
+        m_Lock.Unlock();
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::GetHeldConns
+    Description : 获取持有时间超过min_held_ms的连接，按持有时间从长到短排列
+    Input       : 
+        @ min_held_ms ： 最短持有时间(毫秒)
+    Output      : 
+        @ vecHeld     ： 持有中的连接
+    Return      : 连接数量
+    ******************************************************************/
+    static bool HeldLonger(const SHeldConn& a, const SHeldConn& b)
+    {
+        return a.nHeldMs > b.nHeldMs;
+    }
+    int CDBConnPool::GetHeldConns(std::vector<SHeldConn>& vecHeld, unsigned int min_held_ms /* = 0 */)
+    {
+        vecHeld.clear();
+        unsigned long long tNow = GetTickUs();
+
+        m_WatchLock.Lock();
+        for( CDBConn *pConn = m_pHeldList; pConn != NULL; pConn = pConn->m_pHeldNext )
+        {
+            SHeldConn held;
+            held.pConn   = pConn;
+            held.pSite   = pConn->m_pSite;
+            held.nHeldMs = (tNow > pConn->m_tCheckOut) ? (tNow - pConn->m_tCheckOut) / 1000 : 0;
+            if( held.nHeldMs >= min_held_ms )
+                vecHeld.push_back(held);
+        }
+        m_WatchLock.Unlock();
+
+        std::sort(vecHeld.begin(), vecHeld.end(), HeldLonger);
+        return (int)vecHeld.size();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ReturnConn
+    Description : 将连接放回空闲集合，有等待者时移交给等待最久的调用者
+    Input       : 
+        @ pConn ： 连接对象指针
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::ReturnConn( CDBConn *pConn )
+    {
+        // 先放回空闲集合，再检查是否有等待者，与WaitInQueue的顺序相反
+        m_IdleSet.Push(pConn);
+        FullMemoryBarrier();
+        if( 0 == m_nWaitNum )
+            return;
+
+        m_Lock.Lock();
+        DispatchIdleConns();
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ReserveConn
+    Description : 在最大连接数限制内预留待新建的连接(调用前需持有m_Lock)
+    Input       : 
+        @ num   ： 期望新建的连接数量
+    Output      : 无
+    Return      : 实际预留的数量
+    ******************************************************************/
+    int CDBConnPool::ReserveConn(int num)
+    {
+        if( m_strConn.empty() )
+        {
+            m_strErrMsg = "Not initialization!";
+            return -1;
+        }
+        if( num <= 0 )
+            return 0;
+
+        unsigned int nOwned = m_nTotalConnNum + m_nPendingConnNum;
+        if( m_nMaxConnNum > 0 && nOwned + num > m_nMaxConnNum )
+        {
+            num = (nOwned < m_nMaxConnNum) ? (int)(m_nMaxConnNum - nOwned) : 0;
+            if( num <= 0 )
+            {
+                m_strErrMsg = "Reached max connection number!";
+                return 0;
+            }
+        }
+        m_nPendingConnNum += num;
+        return num;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::RequestGrow
+    Description : 请求后台线程增加连接(调用前需持有m_Lock)
+    Input       : 
+        @ num   ： 期望新建的连接数量
+    Output      : 无
+    Return      : 实际请求的数量
+    ******************************************************************/
+    int CDBConnPool::RequestGrow(int num)
+    {
+        // 熔断期间只由增长线程试探
+        if( !m_GrowThread.IsRunning() || DB_BREAKER_CLOSED != m_nBreakerState )
+            return 0;
+
+        num = ReserveConn(num);
+        if( num > 0 )
+        {
+            m_nGrowRequest += num;
+            m_GrowCond.Signal();
+        }
+        return num;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::CreateConns
+    Description : 新建已预留的连接，rlogon在锁外执行，成功后立即发布
+    Input       : 
+        @ num   ： 已预留的连接数量
+    Output      : 无
+    Return      : 成功新建的数量
+    ******************************************************************/
+    int CDBConnPool::CreateConns(int num)
+    {
+        int i = 0;
+        for ( i = 0; i < num; ++i)
+        {
+            CDBConn *pConn = NewConn();
+            bool bOK = pConn->Connect(m_strConn.c_str());
+            m_Stats.RecordConnect(bOK);
+
+            pConn->SetGeneration(m_nGeneration);
+            m_Lock.Lock();
+            UpdateBreaker(bOK);
+            if( bOK )
+            {
+                --m_nPendingConnNum;
+                ++m_nTotalConnNum;
+                PublishConn(pConn);
+            }
+            else
+            {
+                // 释放剩余的预留
+                m_nPendingConnNum -= (num - i);
+                m_strErrMsg = pConn->GetLastError();
+            }
+            if( 0 == m_nPendingConnNum )
+                WakeFailFastWaiters();
+            m_Lock.Unlock();
+
+            if( !bOK )
+            {
+                delete pConn;
+                break;
+            }
+        }
+        return i;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::EnableAsync
+    Description : 启用异步执行，启动执行线程(须在Init之后调用，只能启用一次)
+    Input       : 
+        @ thread_num         ： 执行线程数，即并发执行的查询数
+        @ max_queue          ： 排队上限，0为不限
+        @ acquire_timeout_ms ： 获取连接的等待超时(毫秒)，< 0 无限等待
+    Output      : 无
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBConnPool::EnableAsync(unsigned int thread_num, unsigned int max_queue /* = 0 */,
+        int acquire_timeout_ms /* = -1 */)
+    {
+        m_Lock.Lock();
+        if( m_strConn.empty() || m_pAsync || 0 == thread_num )
+        {
+            m_strErrMsg = m_pAsync ? "Async executor already enabled!" : "Not initialization!";
+            m_Lock.Unlock();
+            return false;
+        }
+        m_pAsync = new CDBAsyncExecutor(this);
+        m_Lock.Unlock();
+
+        return m_pAsync->Start(thread_num, max_queue, acquire_timeout_ms);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::SubmitAsync
+    Description : 提交异步查询
+    Input       : 
+        @ pQuery ： 查询对象，完成前调用者须保证其有效
+        @ pConn  ： 执行查询的连接，NULL为由执行线程从池中获取
+    Output      : 无
+    Return      : 
+        成功    ： true
+        失败    ： false(未启用异步执行或队列已满，查询对象未被修改)
+    ******************************************************************/
+    bool CDBConnPool::SubmitAsync(CDBAsyncQuery *pQuery, CDBAppConn *pConn /* = NULL */)
+    {
+        return m_pAsync && m_pAsync->Submit(pQuery, pConn);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::NewConn
+    Description : 用当前后端创建(未连接的)连接对象
+    ******************************************************************/
+    CDBConn * CDBConnPool::NewConn(void)
+    {
+        return new CDBConn(m_pBackend ? m_pBackend->CreateSession() : NULL);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::GrowThreadFunc
+    Description : 后台增长线程入口
+    ******************************************************************/
+    void CDBConnPool::GrowThreadFunc(void *pArg)
+    {
+        ((CDBConnPool *)pArg)->GrowLoop();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::GrowLoop
+    Description : 后台增长线程，按请求新建连接；仍有等待者时继续增长，
+                  新建失败时按退避间隔重试；启用自适应策略时每秒维护一次连接数
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::GrowLoop(void)
+    {
+        const int MAINTAIN_INTERVAL_MS = 1000;
+        const int GROW_RETRY_MIN_MS    = 50;
+        const int GROW_RETRY_MAX_MS    = 2000;
+        unsigned long long tNextMaintain = GetTickUs() + MAINTAIN_INTERVAL_MS * 1000ULL;
+        unsigned long long tRetryGrow = 0;  // 新建失败后下一次重试的时间，0表示无需重试
+        int nRetryMs = GROW_RETRY_MIN_MS;
+
+        m_Lock.Lock();
+        while( !m_bStopGrow )
+        {
+            if( tRetryGrow > 0 && GetTickUs() >= tRetryGrow )
+            {
+                // 等待者只在排队时请求一次增长，新建失败后由增长线程替其重试
+                tRetryGrow = 0;
+                if( m_nWaitNum > (long)m_nPendingConnNum )
+                    RequestGrow(m_nAutoAddConnNum);
+                continue;
+            }
+
+            if( DB_BREAKER_OPEN == m_nBreakerState && GetTickUs() >= m_tBreakerProbe )
+            {
+                // 半开：试探新建一个连接，由UpdateBreaker按结果恢复或继续熔断；
+                // 已达最大连接数时无法试探，直接恢复
+                m_nBreakerState = DB_BREAKER_HALF_OPEN;
+                if( ReserveConn(1) <= 0 )
+                {
+                    m_nConnFailStreak = 0;
+                    m_nBreakerState = DB_BREAKER_CLOSED;
+                    continue;
+                }
+                m_Lock.Unlock();
+                CreateConns(1);
+                m_Lock.Lock();
+                continue;
+            }
+
+            if( (IsAdaptive() || m_pThreadSlot || m_bHoldWatch) && GetTickUs() >= tNextMaintain )
+            {
+                tNextMaintain = GetTickUs() + MAINTAIN_INTERVAL_MS * 1000ULL;
+                // 线程槽位中空闲过久的连接放回空闲集合，参与回收和健康检查
+                if( m_pThreadSlot )
+                    ReclaimThreadConns(GetTickUs() - m_nSlotIdleMs * 1000ULL, false);
+                if( m_bHoldWatch )
+                    WatchHeldConns();
+                if( !IsAdaptive() )
+                    continue;
+                CDBConn *pEvicted = MaintainConns();
+                if( pEvicted )
+                {
+                    // 关闭连接需要网络交互，在锁外执行
+                    m_Lock.Unlock();
+                    while( pEvicted )
+                    {
+                        CDBConn *pNext = CDBConnIdleSet::NextInChain(pEvicted);
+                        delete pEvicted;
+                        pEvicted = pNext;
+                    }
+                    m_Lock.Lock();
+                }
+                continue;
+            }
+
+            if( 0 == m_nGrowRequest )
+            {
+                int nWaitMs = -1;
+                if( IsAdaptive() || m_pThreadSlot || m_bHoldWatch )
+                {
+                    unsigned long long tNow = GetTickUs();
+                    nWaitMs = (tNextMaintain > tNow) ? (int)((tNextMaintain - tNow) / 1000) + 1 : 0;
+                }
+                if( DB_BREAKER_OPEN == m_nBreakerState )
+                {
+                    unsigned long long tNow = GetTickUs();
+                    int nProbeMs = (m_tBreakerProbe > tNow) ? (int)((m_tBreakerProbe - tNow) / 1000) + 1 : 0;
+                    if( nWaitMs < 0 || nProbeMs < nWaitMs )
+                        nWaitMs = nProbeMs;
+                }
+                if( tRetryGrow > 0 )
+                {
+                    unsigned long long tNow = GetTickUs();
+                    int nRetryWaitMs = (tRetryGrow > tNow) ? (int)((tRetryGrow - tNow) / 1000) + 1 : 0;
+                    if( nWaitMs < 0 || nRetryWaitMs < nWaitMs )
+                        nWaitMs = nRetryWaitMs;
+                }
+                m_GrowCond.Wait(m_Lock, nWaitMs);
+                continue;
+            }
+
+            int num = (int)m_nGrowRequest;
+            m_nGrowRequest = 0;
+            m_Lock.Unlock();
+
+            int nAdded = CreateConns(num);
+
+            m_Lock.Lock();
+            if( nAdded == num )
+            {
+                nRetryMs   = GROW_RETRY_MIN_MS;
+                tRetryGrow = 0;
+                // 新建成功但等待者仍多于正在新建的连接，继续增长
+                if( !m_bStopGrow && m_nWaitNum > (long)m_nPendingConnNum )
+                    RequestGrow(m_nAutoAddConnNum);
+            }
+            else if( m_nWaitNum > (long)m_nPendingConnNum )
+            {
+                // 新建失败且仍有等待者，退避后重试，避免WaitConn无限期等待
+                tRetryGrow = GetTickUs() + nRetryMs * 1000ULL;
+                nRetryMs = (nRetryMs * 2 > GROW_RETRY_MAX_MS) ? GROW_RETRY_MAX_MS : nRetryMs * 2;
+            }
+        }
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::IsAdaptive
+    Description : 是否启用了自适应连接数策略(调用前需持有m_Lock)
+    ******************************************************************/
+    bool CDBConnPool::IsAdaptive(void)
+    {
+        return m_nMinIdleNum > 0 || m_nIdleTimeoutSec > 0 || m_nDemandWindowSec > 0;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::MaintainConns
+    Description : 自适应维护连接数(调用前需持有m_Lock)：
+                  目标连接数 = max(平均并发使用量, 当前使用量) + 最少空闲数，
+                  不足时请求增长，超出时回收空闲超时的连接
+    Input       : 
+    Output      : 无
+    Return      : 被回收的连接链表(由调用者在锁外删除)，没有则为NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::MaintainConns(void)
+    {
+        int nIdle  = GetConnNum();
+        int nInUse = (int)m_nTotalConnNum - nIdle;
+        if( nInUse < 0 )
+            nInUse = 0;
+
+        // 指数移动平均，窗口内约有demand_window_sec个采样
+        double dDemand = nInUse;
+        if( m_nDemandWindowSec > 0 )
+        {
+            m_dAvgInUse += (nInUse - m_dAvgInUse) * 2.0 / (m_nDemandWindowSec + 1);
+            if( m_dAvgInUse > dDemand )
+                dDemand = m_dAvgInUse;
+        }
+
+        int nTarget = (int)(dDemand + 0.999) + (int)m_nMinIdleNum;
+        if( m_nMaxConnNum > 0 && nTarget > (int)m_nMaxConnNum )
+            nTarget = (int)m_nMaxConnNum;
+
+        int nOwned = (int)(m_nTotalConnNum + m_nPendingConnNum);
+        if( nOwned < nTarget )
+        {
+            RequestGrow(nTarget - nOwned);
+            return NULL;
+        }
+        if( 0 == m_nIdleTimeoutSec )
+            return NULL;
+
+        int nEvict = (int)m_nTotalConnNum - nTarget;
+        if( nEvict > nIdle - (int)m_nMinIdleNum )
+            nEvict = nIdle - (int)m_nMinIdleNum;
+        if( nEvict <= 0 )
+            return NULL;
+
+        unsigned long long tBefore = GetTickUs() - m_nIdleTimeoutSec * 1000000ULL;
+        CDBConn *pChain = m_IdleSet.TakeIdleBefore(tBefore, nEvict);
+        for( CDBConn *p = pChain; p != NULL; p = CDBConnIdleSet::NextInChain(p) )
+            --m_nTotalConnNum;
+        return pChain;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::SetAdaptivePolicy
+    Description : 设置自适应连接数策略，并唤醒后台线程开始维护
+    Input       : 
+        @ min_idle          ： 最少空闲连接数
+        @ idle_timeout_sec  ： 空闲超时回收(秒)，0不回收
+        @ demand_window_sec ： 并发使用量移动平均的窗口(秒)，0不预先增长
+        @ bLifo             ： 是否后进先出复用连接
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::SetAdaptivePolicy(unsigned int min_idle, unsigned int idle_timeout_sec,
+        unsigned int demand_window_sec /* = 60 */, bool bLifo /* = true */)
+    {
+        m_IdleSet.SetLifo(bLifo);
+
+        m_Lock.Lock();
+        m_nMinIdleNum      = min_idle;
+        m_nIdleTimeoutSec  = idle_timeout_sec;
+        m_nDemandWindowSec = demand_window_sec;
+        m_GrowCond.Signal();
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::AddConnNum
+    Description : 增加连接池中的连接，新建连接时不持有连接池锁
+    Input       : 
+        @ num   ： 连接数量    
+    Output      : 无
+    Return      :   
+        成功    ： > 0 (=num完全成功)
+        失败    ： <= 0    
+    ******************************************************************/
+    int CDBConnPool::AddConnNum(int num)
+    {
+        m_Lock.Lock();
+        num = ReserveConn(num);
+        m_Lock.Unlock();
+
+        if( num <= 0 )
+            return num;
+        return CreateConns(num);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ReduceConnNum
+    Description : 减少连接池中的连接
+    Input       : 
+        @ num   ： 连接数量    
+    Output      : 无
+    Return      :     
+    ******************************************************************/
+    void CDBConnPool::ReduceConnNum(int num)
+    {
+        int size = GetConnNum();
+        size = (num <= size) ? num : size;
+        for( int i = 0; i < size; ++i)
+        {
+            m_Lock.Lock();
+            CDBConn *pConn = m_IdleSet.Pop();
+            if( NULL != pConn )
+                --m_nTotalConnNum;
+            m_Lock.Unlock();
+
+            if( NULL != pConn )
+                delete pConn;
+            else
+                break;
+        }
+    }
+
+    /*****************************************************************
+    Function    : CDBConnPool::EnableThreadCache
+    Description : 启用线程亲和的连接槽位(须在Init之后调用，只能启用一次)
+    Input       : 
+        @ idle_ms ： 槽位中的连接空闲超过该时间(毫秒)后收回
+    Output      : 无
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBConnPool::EnableThreadCache(unsigned int idle_ms /* = 1000 */)
+    {
+        m_Lock.Lock();
+        if( m_strConn.empty() || m_pThreadSlot )
+        {
+            m_strErrMsg = m_pThreadSlot ? "Thread cache already enabled!" : "Not initialization!";
+            m_Lock.Unlock();
+            return false;
+        }
+        m_nSlotIdleMs = idle_ms;
+        m_pThreadSlot = new COTLThreadLocal(ThreadSlotExit);
+        m_GrowCond.Signal();
+        m_Lock.Unlock();
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::TakeThreadConn
+    Description : 取出本线程槽位中的连接，槽位为空时不访问共享数据
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::TakeThreadConn(void)
+    {
+        if( NULL == m_pThreadSlot || m_bClassed )
+            return NULL;
+        SThreadSlot *pSlot = (SThreadSlot *)m_pThreadSlot->Get();
+        if( NULL == pSlot || NULL == pSlot->pConn )
+            return NULL;
+
+        // 与收回者竞争，原子交换取出
+        CDBConn *pConn = (CDBConn *)AtomicExchangePtr((void * volatile *)&pSlot->pConn, NULL);
+        if( NULL == pConn )
+            return NULL;
+        AtomicAdd(&m_nParkedNum, -1);
+        if( IsSuspect(pConn) )
+        {
+            Quarantine(pConn);
+            return NULL;
+        }
+        return pConn;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ParkThreadConn
+    Description : 没有等待者时将连接放入本线程的空槽位，首次使用时分配槽位
+    Input       : 
+        @ pConn ： 连接对象指针
+    Return      : 
+        成功    ： true
+        失败    ： false(未启用、槽位已占用或有等待者，由调用者放回空闲集合)
+    ******************************************************************/
+    bool CDBConnPool::ParkThreadConn(CDBConn *pConn)
+    {
+        if( NULL == m_pThreadSlot || 0 != m_nWaitNum || m_bClassed )
+            return false;
+
+        SThreadSlot *pSlot = (SThreadSlot *)m_pThreadSlot->Get();
+        if( NULL == pSlot )
+        {
+            m_Lock.Lock();
+            for( pSlot = m_pSlotList; pSlot != NULL && !pSlot->bFree; pSlot = pSlot->pNext )
+                ;
+            if( NULL == pSlot )
+            {
+                pSlot = new SThreadSlot;
+                pSlot->pConn = NULL;
+                pSlot->pPool = this;
+                pSlot->pNext = m_pSlotList;
+                m_pSlotList  = pSlot;
+            }
+            pSlot->bFree = false;
+            m_Lock.Unlock();
+            m_pThreadSlot->Set(pSlot);
+        }
+        if( NULL != pSlot->pConn )
+            return false;
+
+        pSlot->tParked = GetTickUs();
+        AtomicAdd(&m_nParkedNum, 1);
+        FullMemoryBarrier();
+        pSlot->pConn = pConn;
+        FullMemoryBarrier();
+
+        // 与WaitInQueue配合：放入后才出现的等待者可能没有看到该连接，取回后正常归还
+        if( 0 != m_nWaitNum )
+        {
+            pConn = (CDBConn *)AtomicExchangePtr((void * volatile *)&pSlot->pConn, NULL);
+            if( pConn )
+            {
+                AtomicAdd(&m_nParkedNum, -1);
+                ReturnConn(pConn);
+            }
+        }
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ThreadSlotExit
+    Description : 线程退出时归还其槽位中的连接，槽位留给其他线程复用
+    Input       : 
+        @ pValue ： 槽位
+    ******************************************************************/
+    void OTL_TLS_CALLBACK CDBConnPool::ThreadSlotExit(void *pValue)
+    {
+        SThreadSlot *pSlot = (SThreadSlot *)pValue;
+        CDBConnPool *pPool = pSlot->pPool;
+        CDBConn *pConn = (CDBConn *)AtomicExchangePtr((void * volatile *)&pSlot->pConn, NULL);
+        if( pConn )
+        {
+            // 线程退出时槽位已从TLS清除，不能经ReleaseConn再放入
+            AtomicAdd(&pPool->m_nParkedNum, -1);
+            if( pPool->IsSuspect(pConn) )
+                pPool->Quarantine(pConn);
+            else
+                pPool->ReturnConn(pConn);
+        }
+        pPool->m_Lock.Lock();
+        pSlot->bFree = true;
+        pPool->m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ReclaimThreadConns
+    Description : 收回线程槽位中放入时间早于tBefore的连接(调用前需持有m_Lock)
+    Input       : 
+        @ tBefore  ： 放入时间(微秒)，-1为全部
+        @ bTakeOne ： 返回第一个收回的连接，否则全部发布给等待者/空闲集合
+    Output      : 无
+    Return      : 
+        bTakeOne时收回的连接，没有则为NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::ReclaimThreadConns(unsigned long long tBefore, bool bTakeOne)
+    {
+        for( SThreadSlot *pSlot = m_pSlotList; pSlot != NULL; pSlot = pSlot->pNext )
+        {
+            if( NULL == pSlot->pConn || pSlot->tParked >= tBefore )
+                continue;
+            CDBConn *pConn = (CDBConn *)AtomicExchangePtr((void * volatile *)&pSlot->pConn, NULL);
+            if( NULL == pConn )
+                continue;
+            AtomicAdd(&m_nParkedNum, -1);
+
+            if( IsSuspect(pConn) )
+                Quarantine(pConn);
+            else if( bTakeOne )
+                return pConn;
+            else
+                PublishConn(pConn);
+        }
+        return NULL;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::EnableHealthCheck
+    Description : 启用后台健康检查线程
+    Input       : 
+        @ interval_sec    ： ping空闲超过该时间的连接(秒)
+        @ max_backoff_sec ： 重连退避的最长时间(秒)
+    Output      : 无
+    Return      : 
+        成功    ： true
+        失败    ： false(线程启动失败)
+    ******************************************************************/
+    bool CDBConnPool::EnableHealthCheck(unsigned int interval_sec, unsigned int max_backoff_sec /* = 60 */)
+    {
+        m_HealthLock.Lock();
+        m_nHealthIntervalSec = (interval_sec > 0) ? interval_sec : 1;
+        m_nMaxBackoffSec     = (max_backoff_sec > 0) ? max_backoff_sec : 1;
+        m_bHealthCheck       = true;
+        m_HealthCond.Signal();
+        m_HealthLock.Unlock();
+
+        if( m_HealthThread.IsRunning() )
+            return true;
+        m_bStopHealth = false;
+        m_nCheckedGeneration = m_nGeneration;
+        return m_HealthThread.Start(HealthThreadFunc, this);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::GetBrokenConnNum
+    Description : 获取等待验证或等待重连的连接数量
+    ******************************************************************/
+    int CDBConnPool::GetBrokenConnNum(void)
+    {
+        m_HealthLock.Lock();
+        int num = (int)(m_lstSuspect.size() + m_lstBroken.size());
+        m_HealthLock.Unlock();
+        return num;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::PopValidConn
+    Description : 从空闲集合取出已验证的连接，未验证的交给健康检查线程
+    Input       : 
+    Output      : 无
+    Return      : 
+        成功    ： 连接指针
+        失败    ： NULL
+    ******************************************************************/
+    CDBConn * CDBConnPool::PopValidConn(void)
+    {
+        for( ;; )
+        {
+            CDBConn *pConn = m_IdleSet.Pop();
+            if( NULL == pConn || !IsSuspect(pConn) )
+                return pConn;
+            Quarantine(pConn);
+        }
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::IsSuspect
+    Description : 启用健康检查时，连接在连接池代数变化后未重新验证，
+                  或记录了需要重连的错误，则需要验证
+    ******************************************************************/
+    bool CDBConnPool::IsSuspect(CDBConn *pConn)
+    {
+        return m_bHealthCheck
+            && ( pConn->GetGeneration() != m_nGeneration || pConn->IsNeedReconnect() );
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::Quarantine
+    Description : 将连接交给健康检查线程验证(可在持有m_Lock时调用)
+    ******************************************************************/
+    void CDBConnPool::Quarantine(CDBConn *pConn)
+    {
+        m_HealthLock.Lock();
+        m_lstSuspect.push_back(pConn);
+        m_HealthCond.Signal();
+        m_HealthLock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::HealthThreadFunc
+    Description : 后台健康检查线程入口
+    ******************************************************************/
+    void CDBConnPool::HealthThreadFunc(void *pArg)
+    {
+        ((CDBConnPool *)pArg)->HealthLoop();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::HealthLoop
+    Description : 后台健康检查：验证被隔离的连接、重连到期的失败连接，
+                  定期或在连接池代数变化后取出空闲连接进行ping；
+                  验证通过的连接重新发布，失败的按退避时间等待重连
+    Input       : 
+    Output      : 无
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::HealthLoop(void)
+    {
+        unsigned long long tNextSweep = GetTickUs() + m_nHealthIntervalSec * 1000000ULL;
+
+        m_HealthLock.Lock();
+        while( !m_bStopHealth )
+        {
+            unsigned long long tNow = GetTickUs();
+            unsigned long long tWake = tNextSweep;
+
+            std::list<CDBConn*> lstWork;
+            lstWork.splice(lstWork.end(), m_lstSuspect);
+            list<CDBConn*>::iterator it = m_lstBroken.begin();
+            while( it != m_lstBroken.end() )
+            {
+                if( (*it)->m_tNextRetry <= tNow )
+                {
+                    lstWork.push_back(*it);
+                    it = m_lstBroken.erase(it);
+                    continue;
+                }
+                if( (*it)->m_tNextRetry < tWake )
+                    tWake = (*it)->m_tNextRetry;
+                ++it;
+            }
+
+            long nGeneration = m_nGeneration;
+            bool bSweep = (tNow >= tNextSweep) || (nGeneration != m_nCheckedGeneration);
+            if( lstWork.empty() && !bSweep )
+            {
+                m_HealthCond.Wait(m_HealthLock, (int)((tWake - tNow) / 1000) + 1);
+                continue;
+            }
+            m_HealthLock.Unlock();
+
+            if( bSweep )
+            {
+                // 代数变化后验证全部空闲连接，否则只验证空闲超过间隔的连接
+                unsigned long long tBefore = (nGeneration != m_nCheckedGeneration)
+                    ? tNow + 1 : tNow - m_nHealthIntervalSec * 1000000ULL;
+                m_nCheckedGeneration = nGeneration;
+                tNextSweep = tNow + m_nHealthIntervalSec * 1000000ULL;
+
+                CDBConn *pChain = m_IdleSet.TakeIdleBefore(tBefore, 0x7fffffff);
+                while( pChain )
+                {
+                    CDBConn *pNext = CDBConnIdleSet::NextInChain(pChain);
+                    lstWork.push_back(pChain);
+                    pChain = pNext;
+                }
+            }
+
+            for( it = lstWork.begin(); it != lstWork.end(); ++it )
+            {
+                CDBConn *pConn = *it;
+                long nValidGeneration = m_nGeneration;
+                if( !m_bStopHealth && ValidateConn(pConn) )
+                {
+                    pConn->m_nFailCount = 0;
+                    pConn->SetGeneration(nValidGeneration);
+                    m_Lock.Lock();
+                    PublishConn(pConn);
+                    m_Lock.Unlock();
+                    continue;
+                }
+
+                ++pConn->m_nFailCount;
+                pConn->m_tNextRetry = GetTickUs() + NextBackoffUs(pConn->m_nFailCount);
+                m_HealthLock.Lock();
+                m_lstBroken.push_back(pConn);
+                m_HealthLock.Unlock();
+            }
+
+            m_HealthLock.Lock();
+        }
+        m_HealthLock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::ValidateConn
+    Description : 验证连接：首次失败前只ping，之后到期时重连，
+                  使大量连接同时失效时的重连按退避时间错开
+    Input       : 
+        @ pConn ： 连接对象指针
+    Output      : 无
+    Return      : 
+        可用    ： true
+        不可用  ： false
+    ******************************************************************/
+    bool CDBConnPool::ValidateConn(CDBConn *pConn)
+    {
+        if( 0 == pConn->m_nFailCount )
+            return pConn->Ping();
+
+        bool bOK = pConn->Reconnect(true);
+        m_Stats.RecordReconnect(bOK);
+        if( bOK && DB_BREAKER_CLOSED != m_nBreakerState )
+        {
+            // 重连成功说明服务器已恢复，不必等待试探
+            m_Lock.Lock();
+            UpdateBreaker(true);
+            m_Lock.Unlock();
+        }
+        return bOK;
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::NextBackoffUs
+    Description : 计算带随机抖动的指数退避时间：上限为
+                  min(1秒 * 2^(n-1), max_backoff_sec)，实际取其一半到全部之间
+    Input       : 
+        @ nFailCount ： 连续失败次数
+    Output      : 无
+    Return      : 退避时间(微秒)
+    ******************************************************************/
+    unsigned long long CDBConnPool::NextBackoffUs(int nFailCount)
+    {
+        unsigned long long nMax = m_nMaxBackoffSec * 1000000ULL;
+        unsigned long long nBackoff = 1000000ULL;
+        for( int i = 1; i < nFailCount && nBackoff < nMax; ++i )
+            nBackoff *= 2;
+        if( nBackoff > nMax )
+            nBackoff = nMax;
+
+        m_nRandSeed = m_nRandSeed * 1103515245 + 12345; // 只在健康检查线程中使用
+        unsigned long long nHalf = nBackoff / 2;
+        return nHalf + (nHalf > 0 ? ((m_nRandSeed >> 8) * 1000ULL) % nHalf : 0);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::GetStats
+    Description : 获取统计快照，连接数在连接池锁内读取
+    Input       : 
+    Output      : 
+        @ stats : 统计快照
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::GetStats(SPoolStats& stats)
+    {
+        stats = SPoolStats();
+        int nBroken = GetBrokenConnNum();
+
+        m_Lock.Lock();
+        stats.nTotal   = (int)m_nTotalConnNum;
+        stats.nIdle    = GetConnNum();
+        stats.nBroken  = nBroken;
+        stats.nInUse   = stats.nTotal - stats.nIdle - stats.nBroken;
+        stats.nPending = (int)m_nPendingConnNum;
+        stats.nWaiting = (int)m_nWaitNum;
+        stats.nBreakerState = m_nBreakerState;
+        m_Lock.Unlock();
+        if( stats.nInUse < 0 )
+            stats.nInUse = 0;
+
+        if( m_bHoldWatch )
+        {
+            unsigned long long tNow = GetTickUs();
+            m_WatchLock.Lock();
+            for( CDBConn *pConn = m_pHeldList; pConn != NULL; pConn = pConn->m_pHeldNext )
+            {
+                unsigned long long nHeldMs = (tNow > pConn->m_tCheckOut) ? (tNow - pConn->m_tCheckOut) / 1000 : 0;
+                if( nHeldMs >= m_nHoldWarnMs )
+                    ++stats.nHeldOverWarn;
+                if( nHeldMs > stats.nOldestHeldMs )
+                    stats.nOldestHeldMs = nHeldMs;
+            }
+            stats.nReclaimedOpen = (int)m_nReclaimedOpen;
+            m_WatchLock.Unlock();
+        }
+
+        m_Stats.Collect(stats);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::DumpStats
+    Description : 输出统计信息为文本
+    Input       : 
+    Output      : 
+        @ strOut : 文本
+    Return      : 
+    ******************************************************************/
+    void CDBConnPool::DumpStats(std::string& strOut)
+    {
+        SPoolStats stats;
+        GetStats(stats);
+        stats.ToString(strOut);
+
+        char buf[256] = {0};
+        m_Lock.Lock();
+        for( size_t i = 0; i < m_vecClass.size(); ++i )
+        {
+            const SWorkloadClass &cls = m_vecClass[i];
+            sprintf(buf, "class %s: in_use=%u min=%u max=%u priority=%d\n",
+                cls.strName.c_str(), cls.nInUse, cls.nMinReserved, cls.nMaxShare, cls.nPriority);
+            strOut += buf;
+        }
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : SetConnException
+    Description : 空闲集合访问函数，设置连接的异常信息
+    ******************************************************************/
+    static void SetConnException(CDBConn *pConn, void *pArg)
+    {
+        pConn->SetException(*(const otl_exception *)pArg);
+    }
+    /*****************************************************************
+    Function    : CDBConnPool::SetAllConnExceptions
+    Description : 设置连接池中的连接的异常信息(当网络断开或者数据库服务器出现异常时)
+    Input       : 
+        @ e     ： 外部异常对象
+    Output      : 无
+    Return      :
+    ******************************************************************/
+    void CDBConnPool::SetAllConnExceptions(const otl_exception& e )
+    {
+        if( m_pThreadSlot )
+        {
+            m_Lock.Lock();
+            ReclaimThreadConns((unsigned long long)-1, false);
+            m_Lock.Unlock();
+        }
+        m_IdleSet.ForEach(SetConnException, (void *)&e);
+
+        // 之前验证过的连接全部需要重新验证
+        AtomicAdd(&m_nGeneration, 1);
+        if( m_bHealthCheck )
+        {
+            m_HealthLock.Lock();
+            m_HealthCond.Signal();
+            m_HealthLock.Unlock();
+        }
+    }
+
+    /*****************************************************************
+        
+        CDBPoolGroup 多节点连接池组
+
+    ******************************************************************/
+    CDBPoolGroup::CDBPoolGroup()
+        : m_pBackend(NULL)
+        , m_nEjectFailNum(3)
+        , m_nEjectBaseMs(1000)
+        , m_nEjectMaxMs(60000)
+        , m_nProbeMs(200)
+        , m_nRoundRobin(0)
+    {
+    }
+    CDBPoolGroup::~CDBPoolGroup()
+    {
+        Destroy();
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::AddEndpoint
+    Description : 添加节点并初始化其连接池；初始化时一个连接也没有建立的
+                  节点仍然加入，但处于剔除状态，到期后再试用
+    Input       : 
+        @ conn_str : 连接字符串
+        @ conn_num : 连接数量
+        @ weight   : 权重，未归还连接数按权重折算后比较
+        @ bPrimary : 是否主库(写请求只路由到主库)
+        @ pBackend : 数据库后端，NULL为SetBackend设置的后端
+    Output      : 无
+    Return      : 
+        成功    ： 节点序号
+        失败    ： -1
+    ******************************************************************/
+    int CDBPoolGroup::AddEndpoint(const char *conn_str, int conn_num, int weight /* = 1 */,
+        bool bPrimary /* = false */, CDBBackend *pBackend /* = NULL */)
+    {
+        if( NULL == conn_str || weight <= 0 )
+        {
+            m_strErrMsg = "Invalid endpoint parameters!";
+            return -1;
+        }
+
+        SEndpoint *pEndpoint   = new SEndpoint;
+        pEndpoint->pPool       = new CDBConnPool;
+        pEndpoint->nWeight     = weight;
+        pEndpoint->bPrimary    = bPrimary;
+        pEndpoint->nFailCount  = 0;
+        pEndpoint->nEjectNum   = 0;
+        pEndpoint->tEjectUntil = 0;
+
+        pEndpoint->pPool->SetBackend(pBackend ? pBackend : m_pBackend);
+        if( pEndpoint->pPool->Init(conn_str, conn_num) <= 0 && conn_num > 0 )
+        {
+            m_strErrMsg = pEndpoint->pPool->GetLastError();
+            pEndpoint->nFailCount  = m_nEjectFailNum;
+            pEndpoint->nEjectNum   = 1;
+            pEndpoint->tEjectUntil = GetTickUs() + m_nEjectBaseMs * 1000ULL;
+        }
+
+        m_Lock.Lock();
+        m_vecEndpoint.push_back(pEndpoint);
+        m_Lock.Unlock();
+        return (int)m_vecEndpoint.size() - 1;
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::Destroy
+    Description : 销毁所有节点的连接池
+    ******************************************************************/
+    void CDBPoolGroup::Destroy(void)
+    {
+        m_Lock.Lock();
+        for( size_t i = 0; i < m_vecEndpoint.size(); ++i )
+        {
+            delete m_vecEndpoint[i]->pPool;
+            delete m_vecEndpoint[i];
+        }
+        m_vecEndpoint.clear();
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::SetEjectPolicy
+    Description : 设置剔除策略
+    Input       : 
+        @ fail_num : 连续失败多少次剔除
+        @ base_ms  : 第一次剔除的时间(毫秒)，之后每次连续剔除加倍
+        @ max_ms   : 最长剔除时间(毫秒)
+        @ probe_ms : 剔除到期试用时获取连接的最长等待(毫秒)，避免在宕机的节点上无限等待
+    ******************************************************************/
+    void CDBPoolGroup::SetEjectPolicy(int fail_num, unsigned int base_ms, unsigned int max_ms,
+        unsigned int probe_ms /* = 200 */)
+    {
+        m_Lock.Lock();
+        m_nEjectFailNum = (fail_num > 0) ? fail_num : 1;
+        m_nEjectBaseMs  = base_ms;
+        m_nEjectMaxMs   = (max_ms > base_ms) ? max_ms : base_ms;
+        m_nProbeMs      = probe_ms;
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::IsAvailable
+    Description : 节点是否可以接受请求：未被剔除，或剔除已到期(试用)
+    ******************************************************************/
+    bool CDBPoolGroup::IsAvailable(SEndpoint *pEndpoint, unsigned long long tNow)
+    {
+        return 0 == pEndpoint->tEjectUntil || tNow >= pEndpoint->tEjectUntil;
+    }
+    bool CDBPoolGroup::IsEjected(int nEndpoint)
+    {
+        return !IsAvailable(m_vecEndpoint[nEndpoint], GetTickUs());
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::GetAcquireTimeout
+    Description : 在节点上获取连接的等待时间：试用中(剔除已到期但尚未成功)
+                  的节点不超过试用等待时间，其他节点使用调用者的等待时间
+    Input       : 
+        @ nEndpoint  : 节点序号
+        @ nTimeoutMs : 调用者的等待超时(毫秒)，< 0 无限等待
+    Output      : 无
+    Return      : 等待超时(毫秒)
+    ******************************************************************/
+    int CDBPoolGroup::GetAcquireTimeout(int nEndpoint, int nTimeoutMs)
+    {
+        if( 0 == m_vecEndpoint[nEndpoint]->tEjectUntil )
+            return nTimeoutMs;
+        if( nTimeoutMs < 0 || nTimeoutMs > (int)m_nProbeMs )
+            return (int)m_nProbeMs;
+        return nTimeoutMs;
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::Route
+    Description : 选择节点：只读请求在可用的备库中选择未归还连接数/权重
+                  最小的，没有可用备库时使用主库；写请求使用主库。
+                  负载相同时从轮转位置开始选择，避免总是集中到第一个节点
+    Input       : 
+        @ bReadOnly : 是否只读请求
+        @ nExclude  : 排除的节点(本次已失败)，-1为不排除
+    Output      : 无
+    Return      : 
+        成功    ： 节点序号
+        失败    ： -1
+    ******************************************************************/
+    int CDBPoolGroup::Route(bool bReadOnly, int nExclude /* = -1 */)
+    {
+        int nNum = (int)m_vecEndpoint.size();
+        if( 0 == nNum )
+            return -1;
+
+        unsigned long long tNow = GetTickUs();
+        int nStart = (int)((unsigned long)AtomicAdd(&m_nRoundRobin, 1) % (unsigned long)nNum);
+
+        // 第一轮只读请求只选备库，第二轮选主库
+        for( int nRound = bReadOnly ? 0 : 1; nRound < 2; ++nRound )
+        {
+            int nBest = -1;
+            long long nBestOut = 0, nBestWeight = 1;
+            for( int i = 0; i < nNum; ++i )
+            {
+                int n = (nStart + i) % nNum;
+                SEndpoint *pEndpoint = m_vecEndpoint[n];
+                if( n == nExclude || pEndpoint->bPrimary != (1 == nRound) || !IsAvailable(pEndpoint, tNow) )
+                    continue;
+
+                long long nOut = pEndpoint->pPool->GetOutstandingNum();
+                if( nOut < 0 )
+                    nOut = 0;
+                // nOut/nWeight < nBestOut/nBestWeight
+                if( nBest < 0 || nOut * nBestWeight < nBestOut * pEndpoint->nWeight )
+                {
+                    nBest       = n;
+                    nBestOut    = nOut;
+                    nBestWeight = pEndpoint->nWeight;
+                }
+            }
+            if( nBest >= 0 )
+                return nBest;
+        }
+
+        // 写请求没有其他选择，主库被剔除时仍然尝试
+        if( !bReadOnly )
+        {
+            for( int i = 0; i < nNum; ++i )
+            {
+                if( i != nExclude && m_vecEndpoint[i]->bPrimary )
+                    return i;
+            }
+        }
+        return -1;
+    }
+    /*****************************************************************
+    Function    : CDBPoolGroup::ReportResult
+    Description : 报告节点上的结果：成功清除失败计数并恢复节点；连续失败
+                  达到次数则剔除，剔除时间按连续剔除次数倍增；试用中的节点
+                  失败则立即再次剔除
+    Input       : 
+        @ nEndpoint : 节点序号
+        @ bOK       : 是否成功
+    ******************************************************************/
+    void CDBPoolGroup::ReportResult(int nEndpoint, bool bOK)
+    {
+        if( nEndpoint < 0 || nEndpoint >= (int)m_vecEndpoint.size() )
+            return;
+
+        SEndpoint *pEndpoint = m_vecEndpoint[nEndpoint];
+        if( bOK && 0 == pEndpoint->nFailCount )
+            return; // 常见情况不加锁
+
+        m_Lock.Lock();
+        if( bOK )
+        {
+            pEndpoint->nFailCount  = 0;
+            pEndpoint->nEjectNum   = 0;
+            pEndpoint->tEjectUntil = 0;
+        }
+        else if( AtomicAdd(&pEndpoint->nFailCount, 1) >= (long)m_nEjectFailNum )
+        {
+            unsigned long long tNow = GetTickUs();
+            if( IsAvailable(pEndpoint, tNow) ) // 已剔除的不重复计算
+            {
+                unsigned long long nMs = m_nEjectBaseMs;
+                for( int i = 0; i < pEndpoint->nEjectNum && nMs < m_nEjectMaxMs; ++i )
+                    nMs *= 2;
+                if( nMs > m_nEjectMaxMs )
+                    nMs = m_nEjectMaxMs;
+                pEndpoint->tEjectUntil = tNow + nMs * 1000ULL;
+                ++pEndpoint->nEjectNum;
+            }
+        }
+        m_Lock.Unlock();
+    }
+
+    /*****************************************************************
+        
+        CDBAppConn 应用连接类(已连接好)
+
+    ******************************************************************/
+    /*****************************************************************
+    Function    : CDBAppConn::CDBAppConn
+    Description : 构造函数
+    Input       : 
+        @ pPool : 连接池指针
+    Output      : 
+    Return      :
+    ******************************************************************/
+    CDBAppConn::CDBAppConn(CDBConnPool *pPool)
+        : m_pConn(NULL)
+        , m_pPool(NULL)
+        , m_pGroup(NULL)
+        , m_nEndpoint(-1)
+        , m_bReadOnly(false)
+        , m_tAcquired(0)
+    {
+        m_pPool = pPool;
+        m_pConn = pPool->GetConn();
+        AfterAcquire(DBPOOL_CALLER());
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::CDBAppConn
+    Description : 构造函数，连接池已满时最多等待nTimeoutMs毫秒
+    Input       : 
+        @ pPool      : 连接池指针
+        @ nTimeoutMs : 等待超时(毫秒)，< 0 无限等待
+    Output      : 
+    Return      :
+    ******************************************************************/
+    CDBAppConn::CDBAppConn(CDBConnPool *pPool, int nTimeoutMs, int nClass /* = 0 */)
+        : m_pConn(NULL)
+        , m_pPool(NULL)
+        , m_pGroup(NULL)
+        , m_nEndpoint(-1)
+        , m_bReadOnly(false)
+        , m_tAcquired(0)
+    {
+        m_pPool = pPool;
+        m_pConn = pPool->WaitConn(nTimeoutMs, nClass);
+        AfterAcquire(DBPOOL_CALLER());
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::CDBAppConn
+    Description : 构造函数，从连接池组获取连接；节点上获取不到连接(包括等待
+                  超时)或连接不可用时报告失败并换一个节点重试一次，
+                  试用中的节点只等待较短的时间
+    Input       : 
+        @ pGroup     : 连接池组指针
+        @ bReadOnly  : 是否只读请求
+        @ nTimeoutMs : 等待超时(毫秒)，< 0 无限等待
+    Output      : 
+    Return      :
+    ******************************************************************/
+    CDBAppConn::CDBAppConn(CDBPoolGroup *pGroup, bool bReadOnly, int nTimeoutMs /* = -1 */)
+        : m_pConn(NULL)
+        , m_pPool(NULL)
+        , m_pGroup(pGroup)
+        , m_nEndpoint(-1)
+        , m_bReadOnly(false)
+        , m_tAcquired(0)
+    {
+        int nFailed = -1;
+        for( int nTry = 0; nTry < 2; ++nTry )
+        {
+            m_bReadOnly = bReadOnly;
+            int nEndpoint = pGroup->Route(bReadOnly, nFailed);
+            if( nEndpoint < 0 )
+                break;
+
+            m_nEndpoint = nEndpoint;
+            m_pPool = pGroup->GetPool(nEndpoint);
+            m_pConn = m_pPool->WaitConn(pGroup->GetAcquireTimeout(nEndpoint, nTimeoutMs));
+            AfterAcquire(DBPOOL_CALLER());
+            if( Good() )
+            {
+                pGroup->ReportResult(nEndpoint, true);
+                return;
+            }
+
+            pGroup->ReportResult(nEndpoint, false);
+            Release();
+            nFailed = nEndpoint;
+        }
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::AfterAcquire
+    Description : 获取连接后的处理：记录获取时间和调用位置，没有连接上
+                  或连接异常则重新连接
+    ******************************************************************/
+    void CDBAppConn::AfterAcquire(const void *pSite)
+    {
+        if( !m_pConn )
+            return;
+
+        m_tAcquired = GetTickUs();
+        m_pPool->TagCallSite(m_pConn, pSite);
+        if( m_pConn->IsNeedReconnect() )  // 没有连接上或连接异常则重新连接
+            Reconnect(true);
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Reconnect
+    Description : 重新连接，当不可用时进行尝试
+    Input       : 
+        @ bForce ： 强制重连标识
+    Output      : 
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBAppConn::Reconnect(bool bForce /* = false */)
+    {
+        if( !m_pConn )
+            return false;
+        if( !bForce && m_pConn->IsConnected() )
+            return true;
+
+        bool bOK = m_pConn->Reconnect(bForce);
+        m_pPool->m_Stats.RecordReconnect(bOK);
+        return bOK;
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::~CDBAppConn
+    Description : 析构函数
+    ******************************************************************/
+    CDBAppConn::~CDBAppConn()
+    {
+        Release();
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::CDBAppConn
+    Description : 构造空句柄
+    ******************************************************************/
+    CDBAppConn::CDBAppConn()
+        : m_pConn(NULL)
+        , m_pPool(NULL)
+        , m_pGroup(NULL)
+        , m_nEndpoint(-1)
+        , m_bReadOnly(false)
+        , m_tAcquired(0)
+    {
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Transfer
+    Description : 转移所有权：归还本句柄的连接，接管other的连接及其所属的
+                  连接池/节点和获取时间，other变为空句柄
+    Input       : 
+        @ other : 转出连接的句柄
+    ******************************************************************/
+    void CDBAppConn::Transfer(CDBAppConn& other)
+    {
+        if( &other == this )
+            return;
+        Release();
+        Swap(other);
+    }
+    void CDBAppConn::Swap(CDBAppConn& other)
+    {
+        std::swap(m_pConn, other.m_pConn);
+        std::swap(m_pPool, other.m_pPool);
+        std::swap(m_pGroup, other.m_pGroup);
+        std::swap(m_nEndpoint, other.m_nEndpoint);
+        std::swap(m_bReadOnly, other.m_bReadOnly);
+        std::swap(m_tAcquired, other.m_tAcquired);
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Detach
+    Description : 放弃所有权并返回连接，持有时间记录到此为止
+    Return      : 
+        连接指针，空句柄返回NULL
+    ******************************************************************/
+    CDBConn * CDBAppConn::Detach(void)
+    {
+        CDBConn *pConn = m_pConn;
+        if( pConn )
+        {
+            m_pPool->m_Stats.RecordHold(GetTickUs() - m_tAcquired);
+            m_pConn = NULL;
+        }
+        return pConn;
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Attach
+    Description : 接管从连接池取出的连接(Detach的结果或GetConn/WaitConn
+                  的返回值)，先归还本句柄原有的连接
+    Input       : 
+        @ pPool : 连接所属的连接池
+        @ pConn : 连接
+    ******************************************************************/
+    void CDBAppConn::Attach(CDBConnPool *pPool, CDBConn *pConn)
+    {
+        Release();
+        m_pPool     = pPool;
+        m_pConn     = pConn;
+        m_pGroup    = NULL;
+        m_nEndpoint = -1;
+        m_bReadOnly = false;
+        m_tAcquired = GetTickUs();
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::otl_connect
+    Description : 获取otl_connect对象
+    Input       : 
+    Output      : 
+    Return      :     
+    ******************************************************************/
+    CDBAppConn::operator otl_connect&(void) const
+    {
+        if (!m_pConn)
+        {
+            throw runtime_error("cannot get database connection ");
+        }
+        return m_pConn->GetDb();
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Release
+    Description : 释放连接
+    Input       : 
+    Output      : 
+    Return      :     
+    ******************************************************************/
+    void CDBAppConn::Release(void)
+    {
+        if (m_pConn)
+        {
+            m_pPool->m_Stats.RecordHold(GetTickUs() - m_tAcquired);
+            m_pPool->ReleaseConn(m_pConn);
+            m_pConn = NULL;
+        }
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Commit
+    Description : 提交事务（在调用时需要捕捉异常）
+    Input       : 
+    Output      : 
+    Return      :     
+    ******************************************************************/
+    void CDBAppConn::Commit(void)
+    {
+        if( !m_pConn )
+        {
+            throw runtime_error("cannot get database connection ");
+        }
+        m_pConn->GetSession().Commit();
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Execute
+    Description : 直接执行SQL语句，不返回结果集（在调用时需要捕捉异常）
+    Input       : 
+        @ sql   : SQL语句
+    Output      : 
+    Return      : 影响的行数
+    ******************************************************************/
+    long CDBAppConn::Execute(const char *sql)
+    {
+        if( !m_pConn )
+        {
+            throw runtime_error("cannot get database connection ");
+        }
+        return m_pConn->GetSession().Execute(sql);
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Rollback
+    Description : 回滚事务（调用时不需要捕捉异常）
+    Input       : pException 异常
+    Output      : 
+    Return      : true: success, false: failed
+    ******************************************************************/
+    bool CDBAppConn::Rollback(otl_exception* pException /* = NULL */)
+    {
+        // 根据错误码判断是否需要Rollback
+        if( pException && CheckErrCodeForReconnect(pException->code) )
+            return true;
+
+        if( !m_pConn )
+        {
+            throw runtime_error("cannot get database connection ");
+        }
+
+        try
+        {
+            m_pConn->GetSession().Rollback();
+        }
+        catch (otl_exception& e)
+        {
+            if( pException ) *pException = e;
+            return false;
+        }
+        return true;
+    }
+
+    /*****************************************************************
+    Function    : CDBAppConn::GetErrFromException
+    Description : 通过异常获取错误信息字符串
+    Input       : 
+        @ e     : 调用时产生的错误异常对象
+    Output      : 无
+    Return      : 错误信息字符串
+    ******************************************************************/
+    const char* CDBAppConn::GetErrFromException(const otl_exception& e)
+    {
+        // 是否都需要设置异常，当网络断开或者数据库服务器出现异常时
+        if( m_pPool && m_pPool->GetConnNum() > 0 && CheckErrCodeForReconnect(e.code) )
+        {
+            m_pPool->SetAllConnExceptions(e);
+        }
+        if( m_pGroup && CheckErrCodeForReconnect(e.code) )
+        {
+            m_pGroup->ReportResult(m_nEndpoint, false);
+        }
+        return m_pConn ? m_pConn->GetErrFromException(e) : "NULL Connection";
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::ExecuteIdempotent
+    Description : 直接执行幂等的SQL语句，可重试的错误按策略重试
+    Input       : 
+        @ sql    : SQL语句
+        @ policy : 重试策略
+    Output      : 
+    Return      : 影响的行数，失败时抛出otl_exception
+    ******************************************************************/
+    long CDBAppConn::ExecuteIdempotent(const char *sql, const SRetryPolicy& policy /* = SRetryPolicy() */)
+    {
+        for( int nAttempt = 0; ; ++nAttempt )
+        {
+            try
+            {
+                if( !Good() )
+                    throw otl_exception(GetLastError(), 3114);
+                return Execute(sql);
+            }
+            catch( otl_exception & e )
+            {
+                if( !PrepareRetry(e, nAttempt, policy) )
+                    throw;
+            }
+        }
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::PrepareRetry
+    Description : 幂等操作出错后准备下一次尝试：记录错误并回滚，按分类决定
+                  是否重试；连接失效时归还并获取新的连接(连接池组中优先
+                  换一个节点)，然后按指数退避(带随机抖动)等待
+    Input       : 
+        @ e        : 本次的异常
+        @ nAttempt : 已失败的次数-1
+        @ policy   : 重试策略
+    Output      : 
+    Return      : 
+        重试    ： true
+        放弃    ： false
+    ******************************************************************/
+    bool CDBAppConn::PrepareRetry(const otl_exception& e, int nAttempt, const SRetryPolicy& policy)
+    {
+        EDBErrCategory eCategory = GetErrClassifier().Classify(e.code);
+        GetErrFromException(e);
+        if( m_pConn && DB_ERR_RECONNECT != eCategory )
+            Rollback();
+
+        if( !CDBErrClassifier::IsRetryable(eCategory) || nAttempt >= policy.nMaxRetries || NULL == m_pPool )
+            return false;
+
+        // 等待时间为[d/2, d)，d = base * 2^nAttempt
+        unsigned long long nDelayMs = policy.nBaseDelayMs;
+        for( int i = 0; i < nAttempt && nDelayMs < policy.nMaxDelayMs; ++i )
+            nDelayMs *= 2;
+        if( nDelayMs > policy.nMaxDelayMs )
+            nDelayMs = policy.nMaxDelayMs;
+        unsigned int nSeed = (unsigned int)GetTickUs() * 1103515245U + 12345U;
+        unsigned long long nDelayUs = nDelayMs * 500ULL + (nSeed >> 8) % (nDelayMs * 500ULL + 1);
+
+        if( DB_ERR_RECONNECT == eCategory )
+        {
+            Release();
+            SleepUs((unsigned int)nDelayUs);
+            return Reacquire(policy.nAcquireTimeoutMs) || nAttempt + 1 < policy.nMaxRetries;
+        }
+        SleepUs((unsigned int)nDelayUs);
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::Reacquire
+    Description : 归还当前连接后重新获取；连接池组中先换一个节点，没有
+                  其他节点时使用原来的节点
+    Input       : 
+        @ nTimeoutMs : 获取连接的等待超时(毫秒)
+    Output      : 
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBAppConn::Reacquire(int nTimeoutMs)
+    {
+        Release();
+        if( m_pGroup )
+        {
+            int nEndpoint = m_pGroup->Route(m_bReadOnly, m_nEndpoint);
+            if( nEndpoint >= 0 )
+            {
+                m_nEndpoint = nEndpoint;
+                m_pPool     = m_pGroup->GetPool(nEndpoint);
+            }
+        }
+
+        m_pConn = m_pPool->WaitConn(nTimeoutMs);
+        AfterAcquire(DBPOOL_CALLER());
+        if( m_pGroup )
+            m_pGroup->ReportResult(m_nEndpoint, Good());
+        return Good();
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::CheckoutStream
+    Description : 从连接的语句缓存中取出语句(解析失败时抛出otl_exception)
+    Input       : 
+        @ buf_size : otl_stream缓冲区大小
+        @ sql      : SQL文本
+    Output      : 
+        @ bReused  : 是否复用了缓存中的语句
+    Return      : 语句条目
+    ******************************************************************/
+    CDBStmtCache::SStmtEntry * CDBAppConn::CheckoutStream(int buf_size, const char *sql, bool& bReused)
+    {
+        if( !m_pConn )
+        {
+            throw runtime_error("cannot get database connection ");
+        }
+        return m_pConn->GetStmtCache().Checkout(m_pConn->GetDb(), buf_size, sql,
+            m_pPool->GetStmtCacheSize(), bReused);
+    }
+    /*****************************************************************
+    Function    : CDBAppConn::CheckinStream
+    Description : 归还语句到连接的语句缓存
+    Input       : 
+        @ pEntry  : 语句条目
+        @ bBroken : 语句是否已损坏
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBAppConn::CheckinStream(CDBStmtCache::SStmtEntry *pEntry, bool bBroken)
+    {
+        if( m_pConn )
+            m_pConn->GetStmtCache().Checkin(pEntry, bBroken);
+    }
+
+    /*****************************************************************
+        
+        CDBStream 缓存语句类
+
+    ******************************************************************/
+    // 当前未捕获的异常数，C++17之前只能区分有无
+    static inline int UncaughtExceptions(void)
+    {
+#if __cplusplus >= 201703L || ( defined(_MSVC_LANG) && _MSVC_LANG >= 201703L )
+        return std::uncaught_exceptions();
+#else
+        return std::uncaught_exception() ? 1 : 0;
+#endif
+    }
+    /*****************************************************************
+    Function    : CDBStream::CDBStream
+    Description : 构造函数，从连接的语句缓存中取出语句；复用没有输入
+                  变量的语句时rewind重新执行
+    Input       : 
+        @ conn     : 应用连接
+        @ buf_size : otl_stream缓冲区大小
+        @ sql      : SQL文本
+    ******************************************************************/
+    CDBStream::CDBStream(CDBAppConn& conn, int buf_size, const char *sql)
+        : m_pCache(NULL)
+        , m_pEntry(NULL)
+        , m_bReused(false)
+        , m_bBroken(false)
+        , m_nUncaught(UncaughtExceptions())
+    {
+        m_pEntry = conn.CheckoutStream(buf_size, sql, m_bReused);
+        m_pCache = &conn.GetConn()->GetStmtCache();
+        if( m_bReused )
+        {
+            try
+            {
+                int nInVars = 0;
+                m_pEntry->pStream->describe_in_vars(nInVars);
+                if( 0 == nInVars )
+                    m_pEntry->pStream->rewind();
+            }
+            catch( otl_exception & )
+            {
+                m_pCache->Checkin(m_pEntry, true);
+                throw;
+            }
+        }
+    }
+    /*****************************************************************
+    Function    : CDBStream::~CDBStream
+    Description : 析构函数，归还语句到取出时的缓存；出过错或因本语句
+                  生存期内的异常退出时丢弃该语句
+    ******************************************************************/
+    CDBStream::~CDBStream()
+    {
+        m_pCache->Checkin(m_pEntry, m_bBroken || UncaughtExceptions() > m_nUncaught);
+    }
+
+    /*****************************************************************
+        
+        CDBRowView 结果行视图类
+
+    ******************************************************************/
+    /*****************************************************************
+    Function    : CDBRowView::GetString
+    Description : 获取字符列的值
+    Input       : 
+        @ col   : 列序号(从0开始)
+    Output      : 
+    Return      : 字符串(NULL值为空串)，非字符列抛出runtime_error
+    ******************************************************************/
+    const char * CDBRowView::GetString(int col) const
+    {
+        if( (*m_pColumns)[col].nType != otl_var_char )
+            throw runtime_error("column is not a character column");
+        return IsNull(col) ? "" : Data(col);
+    }
+    /*****************************************************************
+    Function    : CDBRowView::GetDouble
+    Description : 获取数值列的值
+    Input       : 
+        @ col   : 列序号(从0开始)
+    Output      : 
+    Return      : 数值(NULL值为0)，非数值列抛出runtime_error
+    ******************************************************************/
+    double CDBRowView::GetDouble(int col) const
+    {
+        if( IsNull(col) )
+            return 0;
+
+        const char *p = Data(col);
+        switch( (*m_pColumns)[col].nType )
+        {
+        case otl_var_double:        return *(const double *)p;
+        case otl_var_float:         return *(const float *)p;
+        case otl_var_int:           return *(const int *)p;
+        case otl_var_unsigned_int:  return *(const unsigned int *)p;
+        case otl_var_short:         return *(const short *)p;
+        case otl_var_long_int:      return *(const long *)p;
+#ifdef OTL_BIGINT
+        case otl_var_bigint:        return (double)*(const OTL_BIGINT *)p;
+#endif
+        default:
+            throw runtime_error("column is not a numeric column");
+        }
+    }
+    /*****************************************************************
+    Function    : CDBRowView::GetLong
+    Description : 获取数值列的值(截断为整数)
+    Input       : 
+        @ col   : 列序号(从0开始)
+    Output      : 
+    Return      : 数值(NULL值为0)，非数值列抛出runtime_error
+    ******************************************************************/
+    long CDBRowView::GetLong(int col) const
+    {
+        if( IsNull(col) )
+            return 0;
+
+        const char *p = Data(col);
+        switch( (*m_pColumns)[col].nType )
+        {
+        case otl_var_int:           return *(const int *)p;
+        case otl_var_unsigned_int:  return (long)*(const unsigned int *)p;
+        case otl_var_short:         return *(const short *)p;
+        case otl_var_long_int:      return *(const long *)p;
+#ifdef OTL_BIGINT
+        case otl_var_bigint:        return (long)*(const OTL_BIGINT *)p;
+#endif
+        default:
+            return (long)GetDouble(col);
+        }
+    }
+    /*****************************************************************
+    Function    : CDBRowView::GetDatetime
+    Description : 获取日期时间列的值
+    Input       : 
+        @ col   : 列序号(从0开始)
+    Output      : 
+    Return      : 日期时间，非日期时间列抛出runtime_error
+    ******************************************************************/
+    const otl_datetime& CDBRowView::GetDatetime(int col) const
+    {
+        if( (*m_pColumns)[col].nType != otl_var_timestamp )
+            throw runtime_error("column is not a datetime column");
+        return *(const otl_datetime *)Data(col);
+    }
+
+    /*****************************************************************
+        
+        CDBCursor 只进游标类
+
+    ******************************************************************/
+    /*****************************************************************
+    Function    : CDBCursor::CDBCursor
+    Description : 构造函数，会话提供结果来源时从结果来源读取，否则打开(或从
+                  语句缓存复用)预取大小为nPrefetchRows的语句
+    Input       : 
+        @ conn          : 应用连接
+        @ sql           : SELECT语句
+        @ nPrefetchRows : 每次数组预取的行数
+    ******************************************************************/
+    CDBCursor::CDBCursor(CDBAppConn& conn, const char *sql, int nPrefetchRows /* = 500 */)
+        : m_pStream(NULL)
+        , m_pSource(NULL)
+        , m_nPrefetchRows(nPrefetchRows > 0 ? nPrefetchRows : 1)
+        , m_nRowSize(0)
+        , m_pBuffer(NULL)
+        , m_nBlockRows(0)
+        , m_nCurRow(0)
+        , m_nRowCount(0)
+    {
+        if( conn.Good() )
+            m_pSource = conn.GetConn()->GetSession().OpenRowSource(sql);
+        if( NULL == m_pSource )
+            m_pStream = new CDBStream(conn, m_nPrefetchRows, sql);
+    }
+    /*****************************************************************
+    Function    : CDBCursor::~CDBCursor
+    Description : 析构函数，归还语句，释放结果来源和行缓冲区
+    ******************************************************************/
+    CDBCursor::~CDBCursor()
+    {
+        delete m_pStream;
+        delete m_pSource;
+        delete [] m_pBuffer;
+    }
+    /*****************************************************************
+    Function    : CDBCursor::DescribeColumns
+    Description : 获取结果集的列描述并分配行缓冲区(只执行一次)
+    Input       : 
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBCursor::DescribeColumns(void)
+    {
+        if( m_pBuffer )
+            return;
+
+        if( m_pSource )
+        {
+            m_pSource->Describe(m_Columns);
+        }
+        else
+        {
+            int nDesc = 0;
+            otl_column_desc *pDesc = m_pStream->Get().describe_select(nDesc);
+            m_Columns.resize(nDesc);
+            for( int i = 0; i < nDesc; ++i )
+            {
+                m_Columns[i].strName = pDesc[i].name;
+                m_Columns[i].nType   = pDesc[i].otl_var_dbtype;
+                m_Columns[i].nSize   = pDesc[i].dbsize;
+            }
+        }
+
+        // 行首为每列一个字节的NULL标志，列数据按8字节对齐
+        int nDesc   = (int)m_Columns.size();
+        int nOffset = (nDesc + 7) & ~7;
+        for( int i = 0; i < nDesc; ++i )
+        {
+            SCursorColumn &col = m_Columns[i];
+            switch( col.nType )
+            {
+            case otl_var_char:          col.nSize = col.nSize + 1;            break;
+            case otl_var_double:        col.nSize = sizeof(double);           break;
+            case otl_var_float:         col.nSize = sizeof(float);            break;
+            case otl_var_int:           col.nSize = sizeof(int);              break;
+            case otl_var_unsigned_int:  col.nSize = sizeof(unsigned int);     break;
+            case otl_var_short:         col.nSize = sizeof(short);            break;
+            case otl_var_long_int:      col.nSize = sizeof(long);             break;
+#ifdef OTL_BIGINT
+            case otl_var_bigint:        col.nSize = sizeof(OTL_BIGINT);       break;
+#endif
+            case otl_var_timestamp:     col.nSize = sizeof(otl_datetime);     break;
+            default:
+                throw runtime_error(string("unsupported column type: ") + col.strName);
+            }
+            col.nOffset = nOffset;
+            nOffset += (col.nSize + 7) & ~7;
+        }
+        m_nRowSize = (nOffset > 0) ? nOffset : 8;
+        m_pBuffer  = new char[m_nPrefetchRows * m_nRowSize];
+    }
+    /*****************************************************************
+    Function    : CDBCursor::ReadRow
+    Description : 从otl_stream或结果来源读取一行到行缓冲区
+    Input       : 
+        @ pRow  : 行缓冲区
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBCursor::ReadRow(char *pRow)
+    {
+        if( m_pSource )
+        {
+            for( size_t i = 0; i < m_Columns.size(); ++i )
+                pRow[i] = m_pSource->Read(m_Columns[i], pRow + m_Columns[i].nOffset) ? 1 : 0;
+            return;
+        }
+
+        otl_stream &stm = m_pStream->Get();
+        for( size_t i = 0; i < m_Columns.size(); ++i )
+        {
+            char *p = pRow + m_Columns[i].nOffset;
+            switch( m_Columns[i].nType )
+            {
+            case otl_var_char:          stm >> p;                       break;
+            case otl_var_double:        stm >> *(double *)p;            break;
+            case otl_var_float:         stm >> *(float *)p;             break;
+            case otl_var_int:           stm >> *(int *)p;               break;
+            case otl_var_unsigned_int:  stm >> *(unsigned int *)p;      break;
+            case otl_var_short:         stm >> *(short *)p;             break;
+            case otl_var_long_int:      stm >> *(long *)p;              break;
+#ifdef OTL_BIGINT
+            case otl_var_bigint:        stm >> *(OTL_BIGINT *)p;        break;
+#endif
+            case otl_var_timestamp:     stm >> *(otl_datetime *)p;      break;
+            }
+            pRow[i] = stm.is_null() ? 1 : 0;
+        }
+    }
+    /*****************************************************************
+    Function    : CDBCursor::FetchBlock
+    Description : 读取下一块数据到行缓冲区，覆盖上一块
+    Input       : 
+    Output      : 
+    Return      : 本块的行数，0表示没有更多数据
+    ******************************************************************/
+    int CDBCursor::FetchBlock(void)
+    {
+        DescribeColumns();
+
+        m_nBlockRows = 0;
+        m_nCurRow    = 0;
+        while( m_nBlockRows < m_nPrefetchRows && !(m_pSource ? m_pSource->Eof() : m_pStream->Get().eof()) )
+        {
+            ReadRow(m_pBuffer + m_nBlockRows * m_nRowSize);
+            ++m_nBlockRows;
+        }
+        m_nRowCount += m_nBlockRows;
+        return m_nBlockRows;
+    }
+    /*****************************************************************
+    Function    : CDBCursor::RowAt
+    Description : 获取当前块中的行
+    Input       : 
+        @ nRow  : 行在当前块中的序号
+    Output      : 
+    Return      : 行视图
+    ******************************************************************/
+    CDBRowView CDBCursor::RowAt(int nRow) const
+    {
+        return CDBRowView(&m_Columns, m_pBuffer + nRow * m_nRowSize);
+    }
+    /*****************************************************************
+    Function    : CDBCursor::Next
+    Description : 移动到下一行，当前块读完时读取下一块
+    Input       : 
+    Output      : 
+    Return      : 
+        有数据  ： true，通过Row()访问
+        结束    ： false
+    ******************************************************************/
+    bool CDBCursor::Next(void)
+    {
+        if( m_nCurRow + 1 < m_nBlockRows )
+        {
+            ++m_nCurRow;
+        }
+        else if( 0 == FetchBlock() )
+        {
+            return false;
+        }
+        m_Row = RowAt(m_nCurRow);
+        return true;
+    }
+
+    /*****************************************************************
+        
+        CDBAsyncQuery 异步查询类
+
+    ******************************************************************/
+    CDBAsyncQuery::CDBAsyncQuery(const char *sql /* = NULL */, int nPrefetchRows /* = 100 */)
+        : m_nPrefetchRows(nPrefetchRows > 0 ? nPrefetchRows : 1)
+        , m_pCallback(NULL)
+        , m_pCallbackArg(NULL)
+        , m_bDone(false)
+        , m_nErrCode(0)
+        , m_nRpc(0)
+        , m_pNextQueued(NULL)
+        , m_pRunConn(NULL)
+    {
+        if( sql )
+            m_strSql = sql;
+    }
+    CDBAsyncQuery::~CDBAsyncQuery()
+    {
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::Bind
+    Description : 按顺序添加一个字符串输入变量
+    Input       : 
+        @ value : 变量值，NULL为空值
+    Return      : 自身，便于连续调用
+    ******************************************************************/
+    CDBAsyncQuery& CDBAsyncQuery::Bind(const char *value)
+    {
+        m_vecBinds.push_back(value ? value : "");
+        m_vecBindNull.push_back(value ? 0 : 1);
+        return *this;
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::Wait
+    Description : 等待查询完成(未设置回调时使用)
+    Input       : 
+        @ nTimeoutMs : 等待超时(毫秒)，< 0 无限等待
+    Return      : 
+        完成    ： true
+        超时    ： false
+    ******************************************************************/
+    bool CDBAsyncQuery::Wait(int nTimeoutMs /* = -1 */)
+    {
+        unsigned long long tDeadline = GetTickUs() + (nTimeoutMs > 0 ? nTimeoutMs : 0) * 1000ULL;
+
+        m_Lock.Lock();
+        while( !m_bDone )
+        {
+            int nWaitMs = -1;
+            if( nTimeoutMs >= 0 )
+            {
+                unsigned long long tNow = GetTickUs();
+                if( tNow >= tDeadline )
+                    break;
+                nWaitMs = (int)((tDeadline - tNow + 999) / 1000);
+            }
+            m_Cond.Wait(m_Lock, nWaitMs);
+        }
+        bool bDone = m_bDone;
+        m_Lock.Unlock();
+        return bDone;
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::GetValue
+    Description : 获取结果集中的值
+    Input       : 
+        @ row   : 行序号(从0开始)
+        @ col   : 列序号(从0开始)
+    Return      : 值，NULL值返回NULL
+    ******************************************************************/
+    const char * CDBAsyncQuery::GetValue(int row, int col)
+    {
+        size_t n = (size_t)row * m_vecColumns.size() + col;
+        return m_vecNull[n] ? NULL : m_vecValues[n].c_str();
+    }
+    void CDBAsyncQuery::AddValue(const char *value)
+    {
+        m_vecValues.push_back(value ? value : "");
+        m_vecNull.push_back(value ? 0 : 1);
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::IsSelect
+    Description : 是否查询语句(select/with开头，忽略前导空白和括号)
+    ******************************************************************/
+    bool CDBAsyncQuery::IsSelect(const char *sql)
+    {
+        while( *sql == ' ' || *sql == '\t' || *sql == '\r' || *sql == '\n' || *sql == '(' )
+            ++sql;
+#ifdef _WIN32
+        return 0 == _strnicmp(sql, "select", 6) || 0 == _strnicmp(sql, "with", 4);
+#else
+        return 0 == strncasecmp(sql, "select", 6) || 0 == strncasecmp(sql, "with", 4);
+#endif
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::Run
+    Description : 默认执行方式：查询语句用只进游标读取全部结果并转为字符串，
+                  其他语句用缓存语句执行、取影响行数并提交
+    Input       : 
+        @ conn  : 已获取的连接
+    Output      : 
+    Return      : 
+    ******************************************************************/
+    void CDBAsyncQuery::Run(CDBAppConn& conn)
+    {
+        if( !IsSelect(m_strSql.c_str()) )
+        {
+            CDBStream stm(conn, 1, m_strSql.c_str());
+            for( size_t i = 0; i < m_vecBinds.size(); ++i )
+            {
+                if( m_vecBindNull[i] )
+                    stm.Get() << otl_null();
+                else
+                    stm.Get() << m_vecBinds[i].c_str();
+            }
+            SetRpc(stm->get_rpc());
+            conn.Commit();
+            return;
+        }
+
+        CDBCursor cur(conn, m_strSql.c_str(), m_nPrefetchRows);
+        for( size_t i = 0; i < m_vecBinds.size(); ++i )
+        {
+            if( m_vecBindNull[i] )
+                cur << otl_null();
+            else
+                cur << m_vecBinds[i].c_str();
+        }
+
+        int nCols = cur.GetColumnNum();
+        for( int i = 0; i < nCols; ++i )
+            AddColumn(cur.GetColumnName(i));
+
+        char szBuf[64];
+        while( cur.Next() )
+        {
+            const CDBRowView &row = cur.Row();
+            for( int i = 0; i < nCols; ++i )
+                AddValue(CDBResultSet::FormatValue(row, i, szBuf));
+        }
+        SetRpc(cur.GetRowCount());
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::Reset
+    Description : 提交前清除上一次的结果
+    ******************************************************************/
+    void CDBAsyncQuery::Reset(void)
+    {
+        m_bDone    = false;
+        m_nErrCode = 0;
+        m_nRpc     = 0;
+        m_strErrMsg.clear();
+        m_vecColumns.clear();
+        m_vecValues.clear();
+        m_vecNull.clear();
+        m_pNextQueued = NULL;
+        m_pRunConn    = NULL;
+    }
+    void CDBAsyncQuery::SetError(int nErrCode, const char *msg)
+    {
+        m_nErrCode  = nErrCode;
+        m_strErrMsg = (msg && *msg) ? msg : "unknown error";
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::Process
+    Description : 执行线程上的处理：在提交时指定的连接上执行，或从池中
+                  获取连接执行，执行完先归还连接
+    Input       : 
+        @ pPool             ： 连接池
+        @ nAcquireTimeoutMs ： 获取连接的等待超时(毫秒)
+    ******************************************************************/
+    void CDBAsyncQuery::Process(CDBConnPool *pPool, int nAcquireTimeoutMs)
+    {
+        if( m_pRunConn )
+        {
+            RunOn(*m_pRunConn);
+            return;
+        }
+
+        CDBAppConn conn(pPool, nAcquireTimeoutMs);
+        RunOn(conn);
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::RunOn
+    Description : 在连接上调用Run，出错时回滚并记录错误
+    Input       : 
+        @ conn  : 连接
+    ******************************************************************/
+    void CDBAsyncQuery::RunOn(CDBAppConn& conn)
+    {
+        if( !conn.Good() )
+        {
+            SetError(0, conn.GetLastError());
+            return;
+        }
+
+        try
+        {
+            Run(conn);
+        }
+        catch( otl_exception & e )
+        {
+            SetError(e.code, conn.GetErrFromException(e));
+            conn.Rollback();
+        }
+        catch( std::exception & e )
+        {
+            SetError(0, e.what());
+            conn.Rollback();
+        }
+    }
+    /*****************************************************************
+    Function    : CDBAsyncQuery::Complete
+    Description : 标记完成：有回调时调用回调(之后不再访问本对象)，
+                  否则唤醒等待者
+    ******************************************************************/
+    void CDBAsyncQuery::Complete(void)
+    {
+        if( m_pCallback )
+        {
+            m_bDone = true;
+            m_pCallback(this, m_pCallbackArg);
+            return;
+        }
+
+        m_Lock.Lock();
+        m_bDone = true;
+        m_Cond.Broadcast();
+        m_Lock.Unlock();
+    }
+
+    /*****************************************************************
+        
+        CDBAsyncExecutor 异步查询执行器
+
+    ******************************************************************/
+    CDBAsyncExecutor::CDBAsyncExecutor(CDBConnPool *pPool)
+        : m_pPool(pPool)
+        , m_pHead(NULL)
+        , m_pTail(NULL)
+        , m_pConnHead(NULL)
+        , m_pConnTail(NULL)
+        , m_nQueueNum(0)
+        , m_nAcquiring(0)
+        , m_nMaxQueue(0)
+        , m_nAcquireTimeoutMs(-1)
+        , m_bStop(false)
+        , m_pThreads(NULL)
+        , m_nThreadNum(0)
+    {
+    }
+    CDBAsyncExecutor::~CDBAsyncExecutor()
+    {
+        Stop();
+    }
+    /*****************************************************************
+    Function    : CDBAsyncExecutor::Start
+    Description : 启动执行线程
+    Input       : 
+        @ thread_num         ： 执行线程数
+        @ max_queue          ： 排队上限，0为不限
+        @ acquire_timeout_ms ： 获取连接的等待超时(毫秒)
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBAsyncExecutor::Start(unsigned int thread_num, unsigned int max_queue, int acquire_timeout_ms)
+    {
+        if( m_pThreads || 0 == thread_num )
+            return false;
+
+        m_nMaxQueue         = max_queue;
+        m_nAcquireTimeoutMs = acquire_timeout_ms;
+        m_bStop             = false;
+        m_nThreadNum        = thread_num;
+        m_pThreads          = new COTLThread[thread_num];
+        for( unsigned int i = 0; i < thread_num; ++i )
+        {
+            if( !m_pThreads[i].Start(ThreadFunc, this) )
+            {
+                Stop();
+                return false;
+            }
+        }
+        return true;
+    }
+    /*****************************************************************
+    Function    : CDBAsyncExecutor::Stop
+    Description : 停止执行线程：执行中的查询完成后退出，排队中的查询以错误结束
+    ******************************************************************/
+    void CDBAsyncExecutor::Stop(void)
+    {
+        m_Lock.Lock();
+        m_bStop = true;
+        CDBAsyncQuery *pQueued = m_pConnHead;
+        if( m_pConnTail )
+            m_pConnTail->m_pNextQueued = m_pHead;
+        else
+            pQueued = m_pHead;
+        m_pHead = m_pTail = m_pConnHead = m_pConnTail = NULL;
+        m_nQueueNum = 0;
+        m_Cond.Broadcast();
+        m_Lock.Unlock();
+
+        for( unsigned int i = 0; i < m_nThreadNum; ++i )
+            m_pThreads[i].Join();
+        delete [] m_pThreads;
+        m_pThreads   = NULL;
+        m_nThreadNum = 0;
+
+        while( pQueued )
+        {
+            CDBAsyncQuery *pNext = pQueued->m_pNextQueued;
+            pQueued->SetError(0, "async executor stopped");
+            pQueued->Complete();
+            pQueued = pNext;
+        }
+    }
+    /*****************************************************************
+    Function    : CDBAsyncExecutor::Submit
+    Description : 将查询加入队列尾部
+    Input       : 
+        @ pQuery ： 查询对象
+        @ pConn  ： 执行查询的连接，NULL为从池中获取
+    Return      : 
+        成功    ： true
+        失败    ： false(已停止或队列已满)
+    ******************************************************************/
+    bool CDBAsyncExecutor::Submit(CDBAsyncQuery *pQuery, CDBAppConn *pConn /* = NULL */)
+    {
+        m_Lock.Lock();
+        if( m_bStop || ( m_nMaxQueue > 0 && m_nQueueNum >= m_nMaxQueue ) )
+        {
+            m_Lock.Unlock();
+            return false;
+        }
+
+        pQuery->Reset();
+        pQuery->m_pRunConn = pConn;
+        if( pConn )
+            PushQueue(m_pConnHead, m_pConnTail, pQuery);
+        else
+            PushQueue(m_pHead, m_pTail, pQuery);
+        ++m_nQueueNum;
+        m_Cond.Signal();
+        m_Lock.Unlock();
+        return true;
+    }
+    void CDBAsyncExecutor::ThreadFunc(void *pArg)
+    {
+        ((CDBAsyncExecutor *)pArg)->WorkLoop();
+    }
+    void CDBAsyncExecutor::PushQueue(CDBAsyncQuery *&pHead, CDBAsyncQuery *&pTail, CDBAsyncQuery *pQuery)
+    {
+        if( pTail )
+            pTail->m_pNextQueued = pQuery;
+        else
+            pHead = pQuery;
+        pTail = pQuery;
+    }
+    /*****************************************************************
+    Function    : CDBAsyncExecutor::PopQueued
+    Description : 取出下一个可执行的查询：先取在已获取的连接上执行的，
+                  需要获取连接的查询在其占用的线程数未达上限时才取
+    Input       : 
+    Output      : 无
+    Return      : 查询对象，没有可执行的返回NULL
+    ******************************************************************/
+    CDBAsyncQuery * CDBAsyncExecutor::PopQueued(void)
+    {
+        CDBAsyncQuery **ppHead = &m_pConnHead, **ppTail = &m_pConnTail;
+        if( NULL == m_pConnHead )
+        {
+            unsigned int nMaxAcquiring = (m_nThreadNum > 1) ? m_nThreadNum - 1 : 1;
+            if( NULL == m_pHead || m_nAcquiring >= nMaxAcquiring )
+                return NULL;
+            ppHead = &m_pHead;
+            ppTail = &m_pTail;
+            ++m_nAcquiring;
+        }
+
+        CDBAsyncQuery *pQuery = *ppHead;
+        *ppHead = pQuery->m_pNextQueued;
+        if( NULL == *ppHead )
+            *ppTail = NULL;
+        pQuery->m_pNextQueued = NULL;
+        --m_nQueueNum;
+        return pQuery;
+    }
+    /*****************************************************************
+    Function    : CDBAsyncExecutor::WorkLoop
+    Description : 执行线程：取出可执行的查询执行，直到停止
+    ******************************************************************/
+    void CDBAsyncExecutor::WorkLoop(void)
+    {
+        m_Lock.Lock();
+        while( !m_bStop )
+        {
+            CDBAsyncQuery *pQuery = PopQueued();
+            if( NULL == pQuery )
+            {
+                m_Cond.Wait(m_Lock);
+                continue;
+            }
+
+            bool bAcquire = ( NULL == pQuery->m_pRunConn );
+            m_Lock.Unlock();
+            pQuery->Process(m_pPool, m_nAcquireTimeoutMs);
+            pQuery->Complete(); // 之后不能再访问pQuery
+            m_Lock.Lock();
+
+            if( bAcquire )
+                --m_nAcquiring;
+        }
+        m_Lock.Unlock();
+    }
+
+    /*****************************************************************
+        
+        CDBWriteUnit 组提交的写入单元
+
+    ******************************************************************/
+    CDBWriteUnit::CDBWriteUnit(const char *sql /* = NULL */)
+        : m_bDone(false)
+        , m_nErrCode(0)
+        , m_nRpc(0)
+        , m_pNextQueued(NULL)
+    {
+        if( sql )
+            m_strSql = sql;
+    }
+    CDBWriteUnit::~CDBWriteUnit()
+    {
+    }
+    CDBWriteUnit& CDBWriteUnit::Bind(const char *value)
+    {
+        m_vecBinds.push_back(value ? value : "");
+        m_vecBindNull.push_back(value ? 0 : 1);
+        return *this;
+    }
+    /*****************************************************************
+    Function    : CDBWriteUnit::Wait
+    Description : 等待提交完成
+    Input       : 
+        @ nTimeoutMs : 等待超时(毫秒)，< 0 无限等待
+    Return      : 
+        完成    ： true
+        超时    ： false
+    ******************************************************************/
+    bool CDBWriteUnit::Wait(int nTimeoutMs /* = -1 */)
+    {
+        unsigned long long tDeadline = GetTickUs() + (nTimeoutMs > 0 ? nTimeoutMs : 0) * 1000ULL;
+
+        m_Lock.Lock();
+        while( !m_bDone )
+        {
+            int nWaitMs = -1;
+            if( nTimeoutMs >= 0 )
+            {
+                unsigned long long tNow = GetTickUs();
+                if( tNow >= tDeadline )
+                    break;
+                nWaitMs = (int)((tDeadline - tNow + 999) / 1000);
+            }
+            m_Cond.Wait(m_Lock, nWaitMs);
+        }
+        bool bDone = m_bDone;
+        m_Lock.Unlock();
+        return bDone;
+    }
+    /*****************************************************************
+    Function    : CDBWriteUnit::Apply
+    Description : 默认写入方式：用缓存语句绑定字符串变量执行，不提交
+    Input       : 
+        @ conn  : 组提交线程的连接
+    ******************************************************************/
+    void CDBWriteUnit::Apply(CDBAppConn& conn)
+    {
+        CDBStream stm(conn, 1, m_strSql.c_str());
+        for( size_t i = 0; i < m_vecBinds.size(); ++i )
+        {
+            if( m_vecBindNull[i] )
+                stm.Get() << otl_null();
+            else
+                stm.Get() << m_vecBinds[i].c_str();
+        }
+        SetRpc(stm->get_rpc());
+    }
+    /*****************************************************************
+    Function    : CDBWriteUnit::Complete
+    Description : 记录结果并唤醒等待者
+    Input       : 
+        @ nErrCode : 错误码
+        @ msg      : 错误信息，NULL为成功
+    ******************************************************************/
+    void CDBWriteUnit::Complete(int nErrCode, const char *msg)
+    {
+        m_Lock.Lock();
+        m_nErrCode = nErrCode;
+        if( msg )
+            m_strErrMsg = *msg ? msg : "unknown error";
+        m_bDone = true;
+        m_Cond.Broadcast();
+        m_Lock.Unlock();
+    }
+
+    /*****************************************************************
+        
+        CDBGroupCommitter 组提交
+
+    ******************************************************************/
+    CDBGroupCommitter::CDBGroupCommitter(CDBConnPool *pPool)
+        : m_pPool(pPool)
+        , m_pHead(NULL)
+        , m_pTail(NULL)
+        , m_nQueueNum(0)
+        , m_tFirstQueued(0)
+        , m_nWindowMs(2)
+        , m_nMaxBatch(64)
+        , m_nAcquireTimeoutMs(5000)
+        , m_bStop(true)
+        , m_nBatchNum(0)
+        , m_nUnitNum(0)
+    {
+    }
+    CDBGroupCommitter::~CDBGroupCommitter()
+    {
+        Stop();
+    }
+    /*****************************************************************
+    Function    : CDBGroupCommitter::Start
+    Description : 启动组提交线程
+    Input       : 
+        @ window_ms          ： 第一个单元到达后最多等待的时间(毫秒)
+        @ max_batch          ： 每批最多的单元数，达到时立即执行
+        @ acquire_timeout_ms ： 获取连接的等待超时(毫秒)
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBGroupCommitter::Start(unsigned int window_ms /* = 2 */, unsigned int max_batch /* = 64 */,
+        int acquire_timeout_ms /* = 5000 */)
+    {
+        if( m_Thread.IsRunning() )
+            return false;
+
+        m_nWindowMs         = window_ms;
+        m_nMaxBatch         = (max_batch > 0) ? max_batch : 1;
+        m_nAcquireTimeoutMs = acquire_timeout_ms;
+        m_bStop             = false;
+        return m_Thread.Start(ThreadFunc, this);
+    }
+    /*****************************************************************
+    Function    : CDBGroupCommitter::Stop
+    Description : 停止组提交线程，排队中的单元执行完后退出
+    ******************************************************************/
+    void CDBGroupCommitter::Stop(void)
+    {
+        m_Lock.Lock();
+        m_bStop = true;
+        m_Cond.Signal();
+        m_Lock.Unlock();
+        m_Thread.Join();
+    }
+    /*****************************************************************
+    Function    : CDBGroupCommitter::Submit
+    Description : 将写入单元加入队列，达到批量上限时唤醒组提交线程
+    Input       : 
+        @ pUnit ： 写入单元，完成前调用者须保证其有效
+    Return      : 
+        成功    ： true
+        失败    ： false(已停止)
+    ******************************************************************/
+    bool CDBGroupCommitter::Submit(CDBWriteUnit *pUnit)
+    {
+        pUnit->m_bDone    = false;
+        pUnit->m_nErrCode = 0;
+        pUnit->m_nRpc     = 0;
+        pUnit->m_strErrMsg.clear();
+        pUnit->m_pNextQueued = NULL;
+
+        m_Lock.Lock();
+        if( m_bStop )
+        {
+            m_Lock.Unlock();
+            return false;
+        }
+        if( m_pTail )
+        {
+            m_pTail->m_pNextQueued = pUnit;
+        }
+        else
+        {
+            m_pHead = pUnit;
+            m_tFirstQueued = GetTickUs();
+        }
+        m_pTail = pUnit;
+        ++m_nQueueNum;
+
+        // 第一个单元开始计时，满一批时立即执行，其他时候不必唤醒
+        if( 1 == m_nQueueNum || m_nQueueNum == m_nMaxBatch )
+            m_Cond.Signal();
+        m_Lock.Unlock();
+        return true;
+    }
+    bool CDBGroupCommitter::Write(CDBWriteUnit *pUnit)
+    {
+        return Submit(pUnit) && pUnit->Wait() && pUnit->Good();
+    }
+    void CDBGroupCommitter::ThreadFunc(void *pArg)
+    {
+        ((CDBGroupCommitter *)pArg)->WorkLoop();
+    }
+    /*****************************************************************
+    Function    : CDBGroupCommitter::WorkLoop
+    Description : 组提交线程：等待第一个单元，再等到时间窗口结束或满一批，
+                  取出一批执行；执行期间到达的单元组成下一批
+    ******************************************************************/
+    void CDBGroupCommitter::WorkLoop(void)
+    {
+        std::vector<CDBWriteUnit*> vecBatch;
+        vecBatch.reserve(m_nMaxBatch);
+
+        m_Lock.Lock();
+        for( ;; )
+        {
+            if( NULL == m_pHead )
+            {
+                if( m_bStop )
+                    break;
+                m_Cond.Wait(m_Lock);
+                continue;
+            }
+
+            unsigned long long tDeadline = m_tFirstQueued + m_nWindowMs * 1000ULL;
+            unsigned long long tNow = GetTickUs();
+            if( !m_bStop && m_nQueueNum < m_nMaxBatch && tNow < tDeadline )
+            {
+                m_Cond.Wait(m_Lock, (int)((tDeadline - tNow + 999) / 1000));
+                continue;
+            }
+
+            vecBatch.clear();
+            while( m_pHead && vecBatch.size() < m_nMaxBatch )
+            {
+                vecBatch.push_back(m_pHead);
+                m_pHead = m_pHead->m_pNextQueued;
+                --m_nQueueNum;
+            }
+            if( NULL == m_pHead )
+                m_pTail = NULL;
+            else
+                m_tFirstQueued = GetTickUs();
+
+            m_Lock.Unlock();
+            ApplyBatch(vecBatch);
+            m_Lock.Lock();
+        }
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBGroupCommitter::ApplyBatch
+    Description : 在一个连接上执行整批并提交一次。某个单元失败时整批回滚，
+                  该单元以错误结束，其余单元重新执行；提交失败或连接失效时
+                  整批以错误结束
+    Input       : 
+        @ vecBatch ： 本批的写入单元
+    ******************************************************************/
+    void CDBGroupCommitter::ApplyBatch(std::vector<CDBWriteUnit*>& vecBatch)
+    {
+        CDBAppConn conn(m_pPool, m_nAcquireTimeoutMs);
+        if( !conn.Good() )
+        {
+            for( size_t i = 0; i < vecBatch.size(); ++i )
+                vecBatch[i]->Complete(0, conn.GetLastError());
+            return;
+        }
+
+        while( !vecBatch.empty() )
+        {
+            size_t n = 0;
+            int nErrCode = 0;
+            std::string strErrMsg;
+            try
+            {
+                for( ; n < vecBatch.size(); ++n )
+                    vecBatch[n]->Apply(conn);
+                conn.Commit();
+
+                AtomicAdd64(&m_nBatchNum, 1);
+                AtomicAdd64(&m_nUnitNum, (long long)vecBatch.size());
+                for( size_t i = 0; i < vecBatch.size(); ++i )
+                    vecBatch[i]->Complete(0, NULL);
+                return;
+            }
+            catch( otl_exception & e )
+            {
+                nErrCode  = e.code;
+                strErrMsg = conn.GetErrFromException(e);
+            }
+            catch( std::exception & e )
+            {
+                strErrMsg = e.what();
+            }
+            conn.Rollback();
+
+            if( n >= vecBatch.size() || CheckErrCodeForReconnect(nErrCode) )
+            {
+                // 提交失败或连接失效，整批的结果未知/已丢失
+                for( size_t i = 0; i < vecBatch.size(); ++i )
+                    vecBatch[i]->Complete(nErrCode, strErrMsg.c_str());
+                return;
+            }
+
+            vecBatch[n]->Complete(nErrCode, strErrMsg.c_str());
+            vecBatch.erase(vecBatch.begin() + n);
+        }
+    }
+
+    /*****************************************************************
+        
+        CDBResultSet 查询结果
+
+    ******************************************************************/
+    CDBResultSet::CDBResultSet()
+        : m_nRef(1)
+        , m_nErrCode(0)
+        , m_nMemSize(sizeof(CDBResultSet))
+    {
+    }
+    const char *CDBResultSet::GetValue(int row, int col) const
+    {
+        size_t idx = (size_t)row * m_vecColumns.size() + col;
+        return m_vecNull[idx] ? NULL : m_vecValues[idx].c_str();
+    }
+    void CDBResultSet::AddColumn(const char *name)
+    {
+        m_vecColumns.push_back(name);
+        m_nMemSize += sizeof(std::string) + m_vecColumns.back().capacity();
+    }
+    void CDBResultSet::AddValue(const char *value)
+    {
+        m_vecValues.push_back(value ? value : "");
+        m_vecNull.push_back(value ? 0 : 1);
+        m_nMemSize += sizeof(std::string) + 1 + m_vecValues.back().capacity();
+    }
+    void CDBResultSet::SetError(int nErrCode, const char *msg)
+    {
+        m_nErrCode  = nErrCode;
+        m_strErrMsg = (msg && *msg) ? msg : "unknown error";
+    }
+    /*****************************************************************
+    Function    : CDBResultSet::Fetch
+    Description : 读取游标的全部结果并转为字符串
+    Input       : 
+        @ cur   : 已绑定输入变量的游标
+    ******************************************************************/
+    void CDBResultSet::Fetch(CDBCursor& cur)
+    {
+        int nCols = cur.GetColumnNum();
+        for( int i = 0; i < nCols; ++i )
+            AddColumn(cur.GetColumnName(i));
+
+        char szBuf[64];
+        while( cur.Next() )
+        {
+            const CDBRowView &row = cur.Row();
+            for( int i = 0; i < nCols; ++i )
+                AddValue(FormatValue(row, i, szBuf));
+        }
+    }
+    /*****************************************************************
+    Function    : CDBResultSet::FormatValue
+    Description : 将当前行的一列转为字符串：日期时间为yyyy-mm-dd hh:mi:ss，
+                  浮点数保留15位有效数字
+    Input       : 
+        @ row   : 当前行
+        @ col   : 列号
+        @ szBuf : 转换用的缓冲区，至少64字节
+    Return      : 
+        字符串，NULL值返回NULL
+    ******************************************************************/
+    const char *CDBResultSet::FormatValue(const CDBRowView& row, int col, char *szBuf)
+    {
+        if( row.IsNull(col) )
+            return NULL;
+
+        switch( row.GetColumnType(col) )
+        {
+        case otl_var_char:
+            return row.GetString(col);
+        case otl_var_timestamp:
+            {
+                const otl_datetime &dt = row.GetDatetime(col);
+                sprintf(szBuf, "%04d-%02d-%02d %02d:%02d:%02d",
+                    dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
+            }
+            break;
+        case otl_var_double:
+        case otl_var_float:
+            sprintf(szBuf, "%.15g", row.GetDouble(col));
+            break;
+        default:
+            sprintf(szBuf, "%ld", row.GetLong(col));
+            break;
+        }
+        return szBuf;
+    }
+
+    CDBResultRef& CDBResultRef::operator=(const CDBResultRef& other)
+    {
+        if( other.m_pResult )
+            other.m_pResult->AddRef();
+        Reset();
+        m_pResult = other.m_pResult;
+        return *this;
+    }
+    void CDBResultRef::Reset(void)
+    {
+        if( m_pResult )
+        {
+            m_pResult->Release();
+            m_pResult = NULL;
+        }
+    }
+    void CDBResultRef::Attach(CDBResultSet *pResult)
+    {
+        if( pResult )
+            pResult->AddRef();
+        Reset();
+        m_pResult = pResult;
+    }
+
+    /*****************************************************************
+        
+        CDBResultCache 查询结果缓存
+
+    ******************************************************************/
+    CDBResultCache::CDBResultCache(CDBConnPool *pPool)
+        : m_pPool(pPool)
+        , m_nMaxBytes(64 << 20)
+        , m_nDefaultTTLMs(60000)
+        , m_nAcquireTimeoutMs(5000)
+        , m_pHead(NULL)
+        , m_pTail(NULL)
+        , m_nMemSize(0)
+        , m_nHitNum(0)
+        , m_nMissNum(0)
+        , m_nEvictNum(0)
+    {
+    }
+    CDBResultCache::~CDBResultCache()
+    {
+        Clear();
+    }
+    void CDBResultCache::Init(size_t nMaxBytes /* = 64 << 20 */, unsigned int nDefaultTTLMs /* = 60000 */,
+        int nAcquireTimeoutMs /* = 5000 */)
+    {
+        m_Lock.Lock();
+        m_nMaxBytes         = nMaxBytes;
+        m_nDefaultTTLMs     = nDefaultTTLMs;
+        m_nAcquireTimeoutMs = nAcquireTimeoutMs;
+        Evict();
+        m_Lock.Unlock();
+    }
+    void CDBResultCache::SetStatementTTL(const char *sql, unsigned int nTTLMs)
+    {
+        m_Lock.Lock();
+        m_mapTTL[sql] = nTTLMs;
+        m_Lock.Unlock();
+    }
+    unsigned int CDBResultCache::GetTTL(const char *sql)
+    {
+        if( m_mapTTL.empty() )
+            return m_nDefaultTTLMs;
+        std::map<std::string, unsigned int>::const_iterator it = m_mapTTL.find(sql);
+        return (it != m_mapTTL.end()) ? it->second : m_nDefaultTTLMs;
+    }
+    /*****************************************************************
+    Function    : CDBResultCache::MakeKey
+    Description : 生成缓存键：SQL + '\0' + 各输入变量(长度:值，空值为N)，
+                  同一语句的键在映射中相邻，便于按语句失效
+    ******************************************************************/
+    void CDBResultCache::MakeKey(std::string& strKey, const char *sql, const char * const *binds, int nBinds)
+    {
+        strKey = sql;
+        strKey.push_back('\0');
+        char szLen[16];
+        for( int i = 0; i < nBinds; ++i )
+        {
+            if( NULL == binds[i] )
+            {
+                strKey.push_back('N');
+                continue;
+            }
+            size_t nLen = strlen(binds[i]);
+            sprintf(szLen, "%u:", (unsigned int)nLen);
+            strKey.append(szLen);
+            strKey.append(binds[i], nLen);
+        }
+    }
+    /*****************************************************************
+    Function    : CDBResultCache::Query
+    Description : 查询：命中且未过期时直接返回缓存的结果；同一键正在加载时等待
+                  其结果；否则由本线程获取连接加载，成功的结果按有效期缓存
+    Input       : 
+        @ sql    : SQL语句
+        @ binds  : 输入变量，NULL为空值
+        @ nBinds : 输入变量个数
+    Output      : 
+        @ result : 查询结果(失败时含错误信息)
+    Return      : 
+        成功    ： true
+        失败    ： false
+    ******************************************************************/
+    bool CDBResultCache::Query(const char *sql, const char * const *binds, int nBinds, CDBResultRef& result)
+    {
+        std::string strKey;
+        MakeKey(strKey, sql, binds, nBinds);
+
+        m_Lock.Lock();
+        unsigned int nTTLMs = GetTTL(sql);
+        if( 0 == nTTLMs )
+        {
+            // 不缓存的语句
+            ++m_nMissNum;
+            m_Lock.Unlock();
+            CDBResultSet *pResult = LoadResult(sql, binds, nBinds);
+            result.Attach(pResult);
+            pResult->Release();
+            return result.Good();
+        }
+
+        SEntry *pEntry = NULL;
+        EntryMap::iterator it = m_mapEntry.find(strKey);
+        if( it != m_mapEntry.end() )
+        {
+            pEntry = it->second;
+            if( pEntry->bLoading )
+            {
+                // 其他线程正在加载，等待其结果
+                ++m_nHitNum;
+                ++pEntry->nWaiters;
+                while( pEntry->bLoading )
+                    m_Cond.Wait(m_Lock);
+                result.Attach(pEntry->pResult);
+                if( 0 == --pEntry->nWaiters && pEntry->bDetached )
+                    FreeEntry(pEntry);
+                m_Lock.Unlock();
+                return result.Good();
+            }
+            if( GetTickUs() < pEntry->tExpire )
+            {
+                ++m_nHitNum;
+                Unlink(pEntry);
+                LinkFront(pEntry);
+                result.Attach(pEntry->pResult);
+                m_Lock.Unlock();
+                return true;
+            }
+
+            // 已过期：原结果交给仍持有引用的调用者，本条目重新加载
+            Unlink(pEntry);
+            m_nMemSize -= pEntry->nMemSize;
+            pEntry->nMemSize = 0;
+            pEntry->pResult->Release();
+            pEntry->pResult  = NULL;
+            pEntry->bLoading = true;
+        }
+        else
+        {
+            pEntry = new SEntry;
+            pEntry->strKey    = strKey;
+            pEntry->pResult   = NULL;
+            pEntry->tExpire   = 0;
+            pEntry->nMemSize  = 0;
+            pEntry->bLoading  = true;
+            pEntry->bDetached = false;
+            pEntry->nWaiters  = 0;
+            pEntry->pPrev     = NULL;
+            pEntry->pNext     = NULL;
+            m_mapEntry.insert(EntryMap::value_type(strKey, pEntry));
+        }
+        ++m_nMissNum;
+        m_Lock.Unlock();
+
+        CDBResultSet *pResult = LoadResult(sql, binds, nBinds);
+
+        m_Lock.Lock();
+        pEntry->pResult  = pResult;
+        pEntry->bLoading = false;
+        if( pEntry->nWaiters > 0 )
+            m_Cond.Broadcast();
+        result.Attach(pResult);
+
+        if( pEntry->bDetached )
+        {
+            // 加载期间已失效，结果只交给本次的调用者和等待者
+            if( 0 == pEntry->nWaiters )
+                FreeEntry(pEntry);
+        }
+        else if( !pResult->Good() )
+        {
+            // 错误不缓存
+            Detach(pEntry);
+        }
+        else
+        {
+            pEntry->tExpire  = GetTickUs() + nTTLMs * 1000ULL;
+            pEntry->nMemSize = pResult->GetMemSize() + pEntry->strKey.capacity() + sizeof(SEntry);
+            m_nMemSize += pEntry->nMemSize;
+            LinkFront(pEntry);
+            Evict();
+        }
+        m_Lock.Unlock();
+        return result.Good();
+    }
+    /*****************************************************************
+    Function    : CDBResultCache::LoadResult
+    Description : 获取连接并加载查询结果，失败时返回含错误信息的结果
+    Return      : 
+        新的查询结果(引用计数为1)
+    ******************************************************************/
+    CDBResultSet *CDBResultCache::LoadResult(const char *sql, const char * const *binds, int nBinds)
+    {
+        CDBResultSet *pResult = new CDBResultSet;
+        CDBAppConn conn(m_pPool, m_nAcquireTimeoutMs);
+        if( !conn.Good() )
+        {
+            pResult->SetError(0, conn.GetLastError());
+            return pResult;
+        }
+
+        try
+        {
+            Load(conn, sql, binds, nBinds, *pResult);
+        }
+        catch( otl_exception & e )
+        {
+            std::string strErrMsg = conn.GetErrFromException(e);
+            conn.Rollback();
+            // 丢弃已读取的部分结果
+            pResult->Release();
+            pResult = new CDBResultSet;
+            pResult->SetError(e.code, strErrMsg.c_str());
+        }
+        catch( std::exception & e )
+        {
+            pResult->Release();
+            pResult = new CDBResultSet;
+            pResult->SetError(0, e.what());
+        }
+        return pResult;
     }
     /*****************************************************************
-    Function    : CDBConnPool::Destroy
-    Description : 销毁连接池
-    Input       : 
-    Output      : 无
-    Return      : 
+    Function    : CDBResultCache::Load
+    Description : 默认加载方式：用只进游标读取全部结果
     ******************************************************************/
-    void CDBConnPool::Destroy(void)
+    void CDBResultCache::Load(CDBAppConn& conn, const char *sql, const char * const *binds, int nBinds,
+        CDBResultSet& result)
     {
-        list<CDBConn*>::iterator it ;
-        for (it = m_ConnList.begin(); it != m_ConnList.end(); ++it)
+        CDBCursor cur(conn, sql);
+        for( int i = 0; i < nBinds; ++i )
         {
-            delete (*it);
+            if( NULL == binds[i] )
+                cur << otl_null();
+            else
+                cur << binds[i];
         }
-        m_ConnList.clear();
+        result.Fetch(cur);
     }
     /*****************************************************************
-    Function    : CDBConnPool::GetConn
-    Description : 从连接池中获取一个连接
-    Input       : 
-        @ bAutoAdd ： 是否自动增加连接
-    Output      : 无
-    Return      : 
-        成功    ： 连接指针
-        失败    ： NULL
+    Function    : CDBResultCache::Invalidate
+    Description : 使指定语句+输入变量的结果失效
     ******************************************************************/
-    CDBConn * CDBConnPool::GetConn(bool bAutoAdd /* = true */)
+    void CDBResultCache::Invalidate(const char *sql, const char * const *binds, int nBinds)
     {
-        CDBConn *pConn = NULL;
+        std::string strKey;
+        MakeKey(strKey, sql, binds, nBinds);
+
         m_Lock.Lock();
+        EntryMap::iterator it = m_mapEntry.find(strKey);
+        if( it != m_mapEntry.end() )
+            Detach(it->second);
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBResultCache::Invalidate
+    Description : 使指定语句所有输入变量的结果失效
+    ******************************************************************/
+    void CDBResultCache::Invalidate(const char *sql)
+    {
+        std::string strBegin(sql);
+        strBegin.push_back('\0');
+        std::string strEnd(sql);
+        strEnd.push_back('\1');
 
-        if (m_ConnList.size() == 0)
+        m_Lock.Lock();
+        EntryMap::iterator it = m_mapEntry.lower_bound(strBegin);
+        while( it != m_mapEntry.end() && it->first < strEnd )
         {
-            if( !bAutoAdd || AddConnNum(m_nAutoAddConnNum) <= 0 )
-            {
-                m_Lock.Unlock();
-                return NULL;
-            }
+            SEntry *pEntry = (it++)->second;
+            Detach(pEntry);
         }
-        pConn = m_ConnList.front();
-        m_ConnList.pop_front();
-
         m_Lock.Unlock();
-        return pConn;
     }
-    /*****************************************************************
-    Function    : CDBConnPool::ReleaseConn
-    Description : 释放连接，返回到连接池中
-    Input       : 
-        @ pConn ： 连接对象指针
-    Output      : 无
-    Return      : 
-    ******************************************************************/
-    void CDBConnPool::ReleaseConn( CDBConn *pConn )
+    void CDBResultCache::Clear(void)
     {
         m_Lock.Lock();
-        m_ConnList.push_back(pConn);
+        while( !m_mapEntry.empty() )
+            Detach(m_mapEntry.begin()->second);
         m_Lock.Unlock();
     }
+    void CDBResultCache::LinkFront(SEntry *pEntry)
+    {
+        pEntry->pPrev = NULL;
+        pEntry->pNext = m_pHead;
+        if( m_pHead )
+            m_pHead->pPrev = pEntry;
+        else
+            m_pTail = pEntry;
+        m_pHead = pEntry;
+    }
+    void CDBResultCache::Unlink(SEntry *pEntry)
+    {
+        if( pEntry->pPrev )
+            pEntry->pPrev->pNext = pEntry->pNext;
+        else if( m_pHead == pEntry )
+            m_pHead = pEntry->pNext;
+        else
+            return; // 不在链表中
+
+        if( pEntry->pNext )
+            pEntry->pNext->pPrev = pEntry->pPrev;
+        else
+            m_pTail = pEntry->pPrev;
+        pEntry->pPrev = NULL;
+        pEntry->pNext = NULL;
+    }
     /*****************************************************************
-    Function    : CDBConnPool::AddConnNum
-    Description : 增加连接池中的连接
-    Input       : 
-        @ num   ： 连接数量    
-    Output      : 无
-    Return      :   
-        成功    ： > 0 (=num完全成功)
-        失败    ： <= 0    
+    Function    : CDBResultCache::Detach
+    Description : 从缓存中移除条目；正在加载或有等待者的条目由加载线程/
+                  最后一个等待者删除
     ******************************************************************/
-    int CDBConnPool::AddConnNum(int num)
+    void CDBResultCache::Detach(SEntry *pEntry)
     {
-        if( m_strConn.empty() )
+        m_mapEntry.erase(pEntry->strKey);
+        Unlink(pEntry);
+        m_nMemSize -= pEntry->nMemSize;
+        pEntry->nMemSize  = 0;
+        pEntry->bDetached = true;
+        if( !pEntry->bLoading && 0 == pEntry->nWaiters )
+            FreeEntry(pEntry);
+    }
+    void CDBResultCache::FreeEntry(SEntry *pEntry)
+    {
+        if( pEntry->pResult )
+            pEntry->pResult->Release();
+        delete pEntry;
+    }
+    /*****************************************************************
+    Function    : CDBResultCache::Evict
+    Description : 超过内存上限时从最久未使用的一端淘汰
+    ******************************************************************/
+    void CDBResultCache::Evict(void)
+    {
+        while( m_nMemSize > m_nMaxBytes && m_pTail )
         {
-            m_strErrMsg = "Not initialization!";
-            return -1;
+            ++m_nEvictNum;
+            Detach(m_pTail);
         }
-        int i = 0;
-        for ( i = 0; i < num; ++i)
+    }
+
+    /*****************************************************************
+        
+        CDBParallelQuery 分区并行查询
+
+    ******************************************************************/
+    CDBParallelQuery::CDBParallelQuery(CDBConnPool *pPool)
+        : m_pPool(pPool)
+        , m_nOrderCol(-1)
+        , m_bNumeric(false)
+        , m_bDesc(false)
+        , m_nAcquireTimeoutMs(-1)
+        , m_pThreads(NULL)
+        , m_nThreadNum(0)
+        , m_nActiveNum(0)
+        , m_nNextPart(0)
+        , m_bFailed(false)
+        , m_nConsumed(0)
+        , m_pCurResult(NULL)
+        , m_nCurRow(0)
+        , m_nRowCount(0)
+        , m_bMergeReady(false)
+    {
+    }
+    CDBParallelQuery::~CDBParallelQuery()
+    {
+        // 未领取的分区不再执行
+        m_bFailed = true;
+        Wait();
+        Clear();
+    }
+    CDBParallelQuery& CDBParallelQuery::Bind(const char *value)
+    {
+        m_vecBinds.push_back(value ? value : "");
+        m_vecBindNull.push_back(value ? 0 : 1);
+        return *this;
+    }
+    void CDBParallelQuery::AddRange(const char *lo, const char *hi)
+    {
+        SPartition part;
+        part.vecBinds.push_back(lo);
+        part.vecBinds.push_back(hi);
+        part.pResult = NULL;
+        part.nCurRow = 0;
+        m_vecParts.push_back(part);
+    }
+    void CDBParallelQuery::AddBuckets(int nBuckets)
+    {
+        char szNum[16], szBucket[16];
+        sprintf(szNum, "%d", nBuckets);
+        for( int i = 0; i < nBuckets; ++i )
         {
-            CDBConn *pConn = new CDBConn;
-            if( !pConn->Connect(m_strConn.c_str()) )
-            {
-                m_strErrMsg = pConn->GetLastError();
-                delete pConn;
-                break;
-            }
-            m_ConnList.push_back(pConn);
+            sprintf(szBucket, "%d", i);
+            AddRange(szNum, szBucket);
         }
-        return i;
+    }
+    void CDBParallelQuery::SetOrderBy(int col, bool bNumeric /* = false */, bool bDesc /* = false */)
+    {
+        m_nOrderCol = col;
+        m_bNumeric  = bNumeric;
+        m_bDesc     = bDesc;
     }
     /*****************************************************************
-    Function    : CDBConnPool::ReduceConnNum
-    Description : 减少连接池中的连接
+    Function    : CDBParallelQuery::Run
+    Description : 启动执行线程，每个线程获取一个连接后依次领取分区执行
     Input       : 
-        @ num   ： 连接数量    
+        @ max_conns          ： 最多使用的连接数
+        @ acquire_timeout_ms ： 获取连接的等待超时(毫秒)，< 0 无限等待
     Output      : 无
-    Return      :     
+    Return      : 
+        成功    ： true
+        失败    ： false(没有SQL或分区、无法启动线程)
     ******************************************************************/
-    void CDBConnPool::ReduceConnNum(int num)
+    bool CDBParallelQuery::Run(unsigned int max_conns, int acquire_timeout_ms /* = -1 */)
     {
-        int size = (int)m_ConnList.size();
-        size = (num <= size) ? num : size;
-        for( int i = 0; i < size; ++i)
+        if( m_strSql.empty() || m_vecParts.empty() )
         {
-            CDBConn *pConn = GetConn(false);
+            m_strErrMsg = "No SQL or partition!";
+            return false;
+        }
 
-            if( NULL != pConn )
-                delete pConn;
-            else
+        // 上一次执行未等待时先等待其结束
+        Wait();
+        Clear();
+        m_nAcquireTimeoutMs = acquire_timeout_ms;
+        m_nThreadNum = (max_conns > 0) ? max_conns : 1;
+        if( m_nThreadNum > m_vecParts.size() )
+            m_nThreadNum = (unsigned int)m_vecParts.size();
+
+        m_pThreads   = new COTLThread[m_nThreadNum];
+        m_nActiveNum = m_nThreadNum;
+        for( unsigned int i = 0; i < m_nThreadNum; ++i )
+        {
+            if( !m_pThreads[i].Start(WorkerFunc, this) )
+            {
+                m_Lock.Lock();
+                m_nActiveNum -= m_nThreadNum - i;
+                if( 0 == m_nActiveNum )
+                    Fail("Failed to start parallel query thread!");
+                m_Lock.Unlock();
                 break;
+            }
         }
+        return !m_bFailed;
     }
-
     /*****************************************************************
-    Function    : CDBConnPool::SetAllConnExceptions
-    Description : 设置连接池中的连接的异常信息(当网络断开或者数据库服务器出现异常时)
-    Input       : 
-        @ e     ： 外部异常对象
-    Output      : 无
-    Return      :
+    Function    : CDBParallelQuery::Wait
+    Description : 等待全部执行线程退出
     ******************************************************************/
-    void CDBConnPool::SetAllConnExceptions(const otl_exception& e )
+    bool CDBParallelQuery::Wait(void)
     {
-        m_Lock.Lock();
-        list<CDBConn*>::iterator iter = m_ConnList.begin();
-        for( ; iter != m_ConnList.end(); iter++ )
-            (*iter)->SetException(e);
-        m_Lock.Unlock();
+        if( m_pThreads )
+        {
+            for( unsigned int i = 0; i < m_nThreadNum; ++i )
+                m_pThreads[i].Join();
+            delete [] m_pThreads;
+            m_pThreads   = NULL;
+            m_nThreadNum = 0;
+        }
+        return !m_bFailed;
     }
-
-    /*****************************************************************
-        
-        CDBAppConn 应用连接类(已连接好)
-
-    ******************************************************************/
     /*****************************************************************
-    Function    : CDBAppConn::CDBAppConn
-    Description : 构造函数
-    Input       : 
-        @ pPool : 连接池指针
-    Output      : 
-    Return      :
+    Function    : CDBParallelQuery::Clear
+    Description : 释放上一次执行的结果(线程已全部退出)
     ******************************************************************/
-    CDBAppConn::CDBAppConn(CDBConnPool *pPool)
-        : m_pConn(NULL)
-        , m_pPool(NULL)
+    void CDBParallelQuery::Clear(void)
     {
-        m_pPool = pPool;
-        m_pConn = pPool->GetConn();
-
-        if( m_pConn && m_pConn->IsNeedReconnect() )  // 没有连接上或连接异常则重新连接
-            m_pConn->Reconnect(true);
+        for( size_t i = 0; i < m_vecParts.size(); ++i )
+        {
+            if( m_vecParts[i].pResult )
+                m_vecParts[i].pResult->Release();
+            m_vecParts[i].pResult = NULL;
+            m_vecParts[i].nCurRow = 0;
+        }
+        m_vecDone.clear();
+        m_nNextPart   = 0;
+        m_nActiveNum  = 0;
+        m_bFailed     = false;
+        m_strErrMsg.clear();
+        m_nConsumed   = 0;
+        m_pCurResult  = NULL;
+        m_nCurRow     = 0;
+        m_nRowCount   = 0;
+        m_bMergeReady = false;
+    }
+    void CDBParallelQuery::Fail(const char *msg)
+    {
+        if( !m_bFailed )
+        {
+            m_strErrMsg = (msg && *msg) ? msg : "unknown error";
+            m_bFailed   = true;
+        }
+        m_Cond.Broadcast();
+    }
+    void CDBParallelQuery::WorkerFunc(void *pArg)
+    {
+        ((CDBParallelQuery *)pArg)->WorkLoop();
     }
     /*****************************************************************
-    Function    : CDBAppConn::~CDBAppConn
-    Description : 析构函数
+    Function    : CDBParallelQuery::WorkLoop
+    Description : 执行线程：获取连接后依次领取分区执行；最后一个退出的
+                  线程发现仍有分区未完成时(都没有取得连接)以错误结束
     ******************************************************************/
-    CDBAppConn::~CDBAppConn()
+    void CDBParallelQuery::WorkLoop(void)
     {
-        Release();
+        std::string strErrMsg;
+        {
+            CDBAppConn conn(m_pPool, m_nAcquireTimeoutMs);
+            if( conn.Good() )
+            {
+                long nPart = 0;
+                while( !m_bFailed && (nPart = AtomicAdd(&m_nNextPart, 1) - 1) < (long)m_vecParts.size() )
+                    RunPartition(conn, m_vecParts[nPart]);
+            }
+            else
+            {
+                strErrMsg = conn.GetLastError();
+            }
+        }
+
+        m_Lock.Lock();
+        if( 0 == --m_nActiveNum && m_vecDone.size() < m_vecParts.size() )
+            Fail(strErrMsg.empty() ? "Failed to acquire connection!" : strErrMsg.c_str());
+        m_Lock.Unlock();
     }
     /*****************************************************************
-    Function    : CDBAppConn::otl_connect
-    Description : 获取otl_connect对象
-    Input       : 
-    Output      : 
-    Return      :     
+    Function    : CDBParallelQuery::RunPartition
+    Description : 执行一个分区，完成后加入完成队列；失败时以错误结束整个查询
     ******************************************************************/
-    CDBAppConn::operator otl_connect&(void) const
+    void CDBParallelQuery::RunPartition(CDBAppConn& conn, SPartition& part)
     {
-        if (!m_pConn)
+        std::vector<const char *> vecBinds;
+        for( size_t i = 0; i < m_vecBinds.size(); ++i )
+            vecBinds.push_back(m_vecBindNull[i] ? NULL : m_vecBinds[i].c_str());
+        for( size_t i = 0; i < part.vecBinds.size(); ++i )
+            vecBinds.push_back(part.vecBinds[i].c_str());
+
+        CDBResultSet *pResult = new CDBResultSet;
+        try
         {
-            throw runtime_error("cannot get database connection ");
+            Load(conn, m_strSql.c_str(), vecBinds.empty() ? NULL : &vecBinds[0], (int)vecBinds.size(), *pResult);
         }
-        return m_pConn->GetDb();
+        catch( otl_exception & e )
+        {
+            std::string strErrMsg = conn.GetErrFromException(e);
+            conn.Rollback();
+            pResult->SetError(e.code, strErrMsg.c_str());
+        }
+        catch( std::exception & e )
+        {
+            pResult->SetError(0, e.what());
+        }
+
+        m_Lock.Lock();
+        part.pResult = pResult;
+        m_vecDone.push_back((int)(&part - &m_vecParts[0]));
+        if( !pResult->Good() )
+            Fail(pResult->GetLastError());
+        m_Cond.Broadcast();
+        m_Lock.Unlock();
     }
     /*****************************************************************
-    Function    : CDBAppConn::Release
-    Description : 释放连接
-    Input       : 
-    Output      : 
-    Return      :     
+    Function    : CDBParallelQuery::Load
+    Description : 默认加载方式：用只进游标读取分区的全部结果
     ******************************************************************/
-    void CDBAppConn::Release(void)
+    void CDBParallelQuery::Load(CDBAppConn& conn, const char *sql, const char * const *binds, int nBinds,
+        CDBResultSet& result)
     {
-        if (m_pConn)
+        CDBCursor cur(conn, sql);
+        for( int i = 0; i < nBinds; ++i )
         {
-            m_pPool->ReleaseConn(m_pConn);
-            m_pConn = NULL;
+            if( NULL == binds[i] )
+                cur << otl_null();
+            else
+                cur << binds[i];
         }
+        result.Fetch(cur);
     }
     /*****************************************************************
-    Function    : CDBAppConn::Commit
-    Description : 提交事务（在调用时需要捕捉异常）
+    Function    : CDBParallelQuery::Next
+    Description : 移动到合并结果的下一行：不排序时依次读取先完成的分区，
+                  排序时等待全部完成后归并
     Input       : 
-    Output      : 
-    Return      :     
+    Output      : 无
+    Return      : 
+        有数据  ： true
+        结束    ： false(没有更多行，或有分区失败，见GetLastError)
     ******************************************************************/
-    void CDBAppConn::Commit(void)
+    bool CDBParallelQuery::Next(void)
     {
-        if( !m_pConn )
+        if( m_nOrderCol >= 0 )
+            return NextMerged();
+
+        while( true )
         {
-            throw runtime_error("cannot get database connection ");
+            if( m_pCurResult && ++m_nCurRow < m_pCurResult->GetRowNum() )
+            {
+                ++m_nRowCount;
+                return true;
+            }
+
+            m_Lock.Lock();
+            while( !m_bFailed && m_nConsumed >= m_vecDone.size() && m_nConsumed < m_vecParts.size() && m_pThreads )
+                m_Cond.Wait(m_Lock, -1);
+            if( m_bFailed || m_nConsumed >= m_vecDone.size() )
+            {
+                m_pCurResult = NULL;
+                m_Lock.Unlock();
+                return false;
+            }
+            m_pCurResult = m_vecParts[m_vecDone[m_nConsumed++]].pResult;
+            m_nCurRow = -1;
+            m_Lock.Unlock();
         }
-        m_pConn->GetDb().commit();
     }
     /*****************************************************************
-    Function    : CDBAppConn::Rollback
-    Description : 回滚事务（调用时不需要捕捉异常）
-    Input       : pException 异常
-    Output      : 
-    Return      : true: success, false: failed
+    Function    : CDBParallelQuery::NextMerged
+    Description : 归并各分区已排序的结果，每次取当前行最小(降序为最大)的分区
     ******************************************************************/
-    bool CDBAppConn::Rollback(otl_exception* pException /* = NULL */)
+    bool CDBParallelQuery::NextMerged(void)
     {
-        // 根据错误码判断是否需要Rollback
-        if( pException && CheckErrCodeForReconnect(pException->code) )
-            return true;
-
-        if( !m_pConn )
+        if( !m_bMergeReady )
         {
-            throw runtime_error("cannot get database connection ");
+            if( !Wait() )
+                return false;
+            m_bMergeReady = true;
+        }
+        else if( m_pCurResult )
+        {
+            // 当前行所在分区前进一行
+            for( size_t i = 0; i < m_vecParts.size(); ++i )
+            {
+                if( m_vecParts[i].pResult == m_pCurResult )
+                {
+                    ++m_vecParts[i].nCurRow;
+                    break;
+                }
+            }
         }
 
-        try
+        SPartition *pBest = NULL;
+        for( size_t i = 0; i < m_vecParts.size(); ++i )
         {
-            m_pConn->GetDb().rollback();
+            SPartition &part = m_vecParts[i];
+            if( NULL == part.pResult || part.nCurRow >= part.pResult->GetRowNum() )
+                continue;
+            if( NULL == pBest || CompareRows(part, *pBest) < 0 )
+                pBest = &part;
         }
-        catch (otl_exception& e)
+        if( NULL == pBest )
         {
-            if( pException ) *pException = e;
+            m_pCurResult = NULL;
             return false;
         }
+
+        m_pCurResult = pBest->pResult;
+        m_nCurRow    = pBest->nCurRow;
+        ++m_nRowCount;
         return true;
     }
-
     /*****************************************************************
-    Function    : CDBAppConn::GetErrFromException
-    Description : 通过异常获取错误信息字符串
-    Input       : 
-        @ e     : 调用时产生的错误异常对象
-    Output      : 无
-    Return      : 错误信息字符串
+    Function    : CDBParallelQuery::CompareRows
+    Description : 按排序列比较两个分区的当前行，NULL值排在最后
+    Return      : 
+        < 0     ： a在前
+        = 0     ： 相等
+        > 0     ： b在前
     ******************************************************************/
-    const char* CDBAppConn::GetErrFromException(const otl_exception& e)
+    int CDBParallelQuery::CompareRows(SPartition& a, SPartition& b)
     {
-        // 是否都需要设置异常，当网络断开或者数据库服务器出现异常时
-        if( m_pPool && m_pPool->GetConnNum() > 0 && CheckErrCodeForReconnect(e.code) )
+        const char *va = a.pResult->GetValue(a.nCurRow, m_nOrderCol);
+        const char *vb = b.pResult->GetValue(b.nCurRow, m_nOrderCol);
+        if( NULL == va || NULL == vb )
+            return (NULL == va) - (NULL == vb);
+
+        int nCmp = 0;
+        if( m_bNumeric )
         {
-            m_pPool->SetAllConnExceptions(e);
+            double da = strtod(va, NULL), db = strtod(vb, NULL);
+            nCmp = (da < db) ? -1 : (da > db ? 1 : 0);
         }
-        return m_pConn ? m_pConn->GetErrFromException(e) : "NULL Connection";
+        else
+        {
+            nCmp = strcmp(va, vb);
+        }
+        return m_bDesc ? -nCmp : nCmp;
+    }
+    int CDBParallelQuery::GetColumnNum(void)
+    {
+        return m_pCurResult ? m_pCurResult->GetColumnNum() : 0;
+    }
+    const char *CDBParallelQuery::GetColumnName(int col)
+    {
+        return m_pCurResult ? m_pCurResult->GetColumnName(col) : NULL;
+    }
+    const char *CDBParallelQuery::GetValue(int col)
+    {
+        return m_pCurResult ? m_pCurResult->GetValue(m_nCurRow, col) : NULL;
     }
     /******************************************************************************************/
 }
@@ -18,7 +18,12 @@ Date          Author              Version          Modification
 #ifdef _WIN32
     #include <Windows.h>    
 #else
-
+    #include <pthread.h>
+    #include <sched.h>
+    #include <unistd.h>
+    #include <time.h>
+    #include <errno.h>
+    #include <strings.h>
 #endif
 
 /***********************************************
@@ -74,12 +79,26 @@ Date          Author              Version          Modification
 #endif // support 64-bit signed integers
 
 
+// 未在编译选项中指定OTL数据库类型时，默认为Oracle 11g
+#if !defined(OTL_ORA7) && !defined(OTL_ORA8) && !defined(OTL_ORA8I) && !defined(OTL_ORA9I) \
+    && !defined(OTL_ORA10G) && !defined(OTL_ORA10G_R2) && !defined(OTL_ORA11G) \
+    && !defined(OTL_ORA11G_R2) && !defined(OTL_ORA12C) && !defined(OTL_ODBC) && !defined(OTL_DB2_CLI)
 #define OTL_ORA11G
+#endif
 #include "otl/otlv4.h"
 
+// 调试构建(_DEBUG，或在编译选项中定义DBPOOL_DEBUG)检查每个连接只被归还一次
+#if defined(_DEBUG) && !defined(DBPOOL_DEBUG)
+#define DBPOOL_DEBUG
+#endif
+
+#include <algorithm>
+#include <exception>
 #include <list>
+#include <map>
 #include <string>
 #include <set>
+#include <vector>
 using namespace std;
 
 /******************************************************************************************/
@@ -93,18 +112,74 @@ namespace OTL
     // 拼接OTL异常中的信息
     void GetErrorInfo(const otl_exception& e, string& errInfo);
 
-    // 根据错误码判断是否需要重新连接
+    // 根据错误码判断是否需要重新连接(错误分类为DB_ERR_RECONNECT)
     bool CheckErrCodeForReconnect(int errcode);
 
     // 测试数据库连接
     bool TestConnection(const char* pzConn, std::string* pstrErrMsg = NULL );
     
-    // 转换日期时间
+    // 转换日期时间：支持YYYY-MM-DD、YYYYMMDD，及其后跟" HH:MI:SS"(或"THH:MI:SS")
+    // 和最多9位小数秒；校验各字段的范围(含闰年)，失败时odt不变
     bool ConvertOtlDatetime( otl_datetime& odt, const char* strDT);
+
+    // 批量转换一列定长的日期时间字符串(第i行位于pColumn + i * nStride)，
+    // pValid不为NULL时输出每行是否转换成功；返回成功的行数，失败的行置为1900-01-01
+    int ConvertOtlDatetimes( otl_datetime* pOut, const char* pColumn, int nStride, int nRows,
+        unsigned char* pValid = NULL );
+
+    // 格式化为"YYYY-MM-DD HH:MI:SS"，nFracDigits(0~9)大于0时追加小数秒；
+    // buf至少30字节，返回字符串长度
+    int FormatOtlDatetime( const otl_datetime& odt, char* buf, int nFracDigits = 0 );
+    // 批量格式化，第i行写入pOut + i * nStride(nStride至少30)
+    void FormatOtlDatetimes( const otl_datetime* pIn, int nRows, char* pOut, int nStride, int nFracDigits = 0 );
+
+    // 获取单调时钟(微秒)，用于超时和耗时统计
+    unsigned long long GetTickUs(void);
+
+    // 休眠指定微秒数(Windows下精度为毫秒)
+    void SleepUs(unsigned int nUs);
+
+    // 获取当前线程所在CPU对应的分片下标(0 ~ nShardNum-1)
+    int GetCpuShard(int nShardNum);
+
+    // 原子操作
+    inline long AtomicAdd(volatile long *pValue, long nDelta) // 返回相加后的值
+    {
+#ifdef _WIN32
+        return InterlockedExchangeAdd(pValue, nDelta) + nDelta;
+#else
+        return __sync_add_and_fetch(pValue, nDelta);
+#endif
+    }
+    inline long long AtomicAdd64(volatile long long *pValue, long long nDelta) // 返回相加后的值
+    {
+#ifdef _WIN32
+        return InterlockedExchangeAdd64(pValue, nDelta) + nDelta;
+#else
+        return __sync_add_and_fetch(pValue, nDelta);
+#endif
+    }
+    inline void *AtomicExchangePtr(void * volatile *ppValue, void *pNew) // 返回原值
+    {
+#ifdef _WIN32
+        return InterlockedExchangePointer((PVOID volatile *)ppValue, pNew);
+#else
+        return __sync_lock_test_and_set(ppValue, pNew);
+#endif
+    }
+    inline void FullMemoryBarrier(void)
+    {
+#ifdef _WIN32
+        MemoryBarrier();
+#else
+        __sync_synchronize();
+#endif
+    }
     /******************************************************************************************/
     // 线程锁类
     class COTLThreadLock
     {
+        friend class COTLThreadCond;
     private:
 #ifdef _WIN32
         CRITICAL_SECTION m_crtlLock;
@@ -153,11 +228,357 @@ namespace OTL
         }
     };
     /******************************************************************************************/
+    // 条件变量类（与COTLThreadLock配合使用）
+    class COTLThreadCond
+    {
+    private:
+#ifdef _WIN32
+        CONDITION_VARIABLE m_crtlCond;
+#else
+        pthread_cond_t     m_crtlCond;
+#endif
+
+    public:
+        COTLThreadCond()
+        {
+#ifdef _WIN32
+            InitializeConditionVariable(&m_crtlCond);
+#else
+            // 超时基于单调时钟，避免系统时间被调整时等待提前结束或无限延长
+            pthread_condattr_t attr;
+            pthread_condattr_init( &attr );
+            pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+            pthread_cond_init( &m_crtlCond, &attr );
+            pthread_condattr_destroy( &attr );
+#endif
+        }
+        virtual ~COTLThreadCond()
+        {
+#ifdef _WIN32
+#else
+            pthread_cond_destroy( &m_crtlCond );
+#endif
+        }
+
+        // 等待通知，调用前必须已持有lock；nTimeoutMs < 0 表示无限等待
+        // 返回false表示超时（可能存在伪唤醒，调用者需循环判断条件）
+        bool Wait(COTLThreadLock& lock, int nTimeoutMs = -1)
+        {
+#ifdef _WIN32
+            DWORD dwMs = (nTimeoutMs < 0) ? INFINITE : (DWORD)nTimeoutMs;
+            return SleepConditionVariableCS(&m_crtlCond, &lock.m_crtlLock, dwMs) ? true : false;
+#else
+            if( nTimeoutMs < 0 )
+                return pthread_cond_wait( &m_crtlCond, &lock.m_crtlLock ) == 0;
+
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec  += nTimeoutMs / 1000;
+            ts.tv_nsec += (long)(nTimeoutMs % 1000) * 1000000L;
+            if( ts.tv_nsec >= 1000000000L )
+            {
+                ts.tv_sec  += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+            return pthread_cond_timedwait( &m_crtlCond, &lock.m_crtlLock, &ts ) != ETIMEDOUT;
+#endif
+        }
+        void Signal()
+        {
+#ifdef _WIN32
+            WakeConditionVariable(&m_crtlCond);
+#else
+            pthread_cond_signal( &m_crtlCond );
+#endif
+        }
+        void Broadcast()
+        {
+#ifdef _WIN32
+            WakeAllConditionVariable(&m_crtlCond);
+#else
+            pthread_cond_broadcast( &m_crtlCond );
+#endif
+        }
+    };
+    /******************************************************************************************/
+    // 线程类（后台工作线程）
+    class COTLThread
+    {
+    public:
+        typedef void (*ThreadFunc)(void *pArg);
+
+    private:
+#ifdef _WIN32
+        HANDLE      m_hThread;
+#else
+        pthread_t   m_hThread;
+#endif
+        bool        m_bRunning;
+        ThreadFunc  m_pFunc;
+        void      * m_pArg;
+
+#ifdef _WIN32
+        static DWORD WINAPI ThreadEntry(LPVOID pParam)
+        {
+            COTLThread *pThis = (COTLThread *)pParam;
+            pThis->m_pFunc(pThis->m_pArg);
+            return 0;
+        }
+#else
+        static void *ThreadEntry(void *pParam)
+        {
+            COTLThread *pThis = (COTLThread *)pParam;
+            pThis->m_pFunc(pThis->m_pArg);
+            return NULL;
+        }
+#endif
+
+    public:
+        COTLThread() : m_bRunning(false), m_pFunc(NULL), m_pArg(NULL) {}
+        virtual ~COTLThread() { Join(); }
+
+        bool Start(ThreadFunc pFunc, void *pArg)
+        {
+            if( m_bRunning )
+                return false;
+            m_pFunc = pFunc;
+            m_pArg  = pArg;
+#ifdef _WIN32
+            m_hThread = CreateThread(NULL, 0, ThreadEntry, this, 0, NULL);
+            m_bRunning = (m_hThread != NULL);
+#else
+            m_bRunning = (pthread_create( &m_hThread, NULL, ThreadEntry, this ) == 0);
+#endif
+            return m_bRunning;
+        }
+        void Join()
+        {
+            if( !m_bRunning )
+                return;
+#ifdef _WIN32
+            WaitForSingleObject(m_hThread, INFINITE);
+            CloseHandle(m_hThread);
+#else
+            pthread_join( m_hThread, NULL );
+#endif
+            m_bRunning = false;
+        }
+        inline bool IsRunning(void) { return m_bRunning; }
+    };
+    /******************************************************************************************/
+    // 线程局部存储类：每个线程一个指针，线程退出时对非NULL的值调用pDestructor
+    // (Windows用FLS实现，释放索引时也会调用)
+#ifdef _WIN32
+    #define OTL_TLS_CALLBACK WINAPI
+#else
+    #define OTL_TLS_CALLBACK
+#endif
+    class COTLThreadLocal
+    {
+    public:
+        typedef void (OTL_TLS_CALLBACK *Destructor)(void *pValue);
+
+    private:
+#ifdef _WIN32
+        DWORD          m_dwIndex;
+#else
+        pthread_key_t  m_Key;
+#endif
+
+    public:
+        COTLThreadLocal(Destructor pDestructor = NULL)
+        {
+#ifdef _WIN32
+            m_dwIndex = FlsAlloc(pDestructor);
+#else
+            pthread_key_create( &m_Key, pDestructor );
+#endif
+        }
+        virtual ~COTLThreadLocal()
+        {
+#ifdef _WIN32
+            FlsFree(m_dwIndex);
+#else
+            pthread_key_delete( m_Key );
+#endif
+        }
+
+        inline void *Get(void)
+        {
+#ifdef _WIN32
+            return FlsGetValue(m_dwIndex);
+#else
+            return pthread_getspecific( m_Key );
+#endif
+        }
+        inline void Set(void *pValue)
+        {
+#ifdef _WIN32
+            FlsSetValue(m_dwIndex, pValue);
+#else
+            pthread_setspecific( m_Key, pValue );
+#endif
+        }
+
+    private:
+        COTLThreadLocal(const COTLThreadLocal&);
+        COTLThreadLocal& operator=(const COTLThreadLocal&);
+    };
+    /******************************************************************************************/
+    // 错误分类
+    enum EDBErrCategory
+    {
+        DB_ERR_FATAL     = 0,   // 不可重试(约束冲突、语法错误等)，未配置的错误码均为此类
+        DB_ERR_RECONNECT = 1,   // 连接已失效，需要换用/重建连接
+        DB_ERR_RETRY     = 2,   // 暂时性错误，可在同一连接上重试
+        DB_ERR_DEADLOCK  = 3,   // 死锁，回滚后重试
+        DB_ERR_SNAPSHOT  = 4    // 快照过旧(ORA-01555)，重试
+    };
+
+    // 错误分类器：以错误码为下标的平坦表，查询无锁；默认表包含常见的ORA错误码，
+    // 可用Set/Reset调整，但必须在工作线程启动(开始使用连接池)之前完成，运行中修改不做同步
+    class CDBErrClassifier
+    {
+    public:
+        enum { MAX_CODE = 100000 };     // ORA错误号为5位数
+
+        CDBErrClassifier();
+
+        inline EDBErrCategory Classify(int errcode) const
+        {
+            return ( errcode > 0 && errcode < MAX_CODE ) ? (EDBErrCategory)m_arrCategory[errcode] : DB_ERR_FATAL;
+        }
+        void Set(int errcode, EDBErrCategory eCategory);
+        void Reset(void);   // 恢复默认表
+
+        // 幂等的操作遇到此类错误时是否可以重试
+        static inline bool IsRetryable(EDBErrCategory eCategory) { return eCategory != DB_ERR_FATAL; }
+
+    private:
+        unsigned char m_arrCategory[MAX_CODE];
+    };
+
+    // 进程内使用的错误分类器(CheckErrCodeForReconnect、幂等重试等)
+    CDBErrClassifier& GetErrClassifier(void);
+
+    // 幂等操作的重试策略：最多重试nMaxRetries次，间隔从nBaseDelayMs起按指数增长
+    // (带随机抖动，最长nMaxDelayMs)；需要重连时在nAcquireTimeoutMs内获取新的连接
+    struct SRetryPolicy
+    {
+        int          nMaxRetries;
+        unsigned int nBaseDelayMs;
+        unsigned int nMaxDelayMs;
+        int          nAcquireTimeoutMs;
+
+        SRetryPolicy() : nMaxRetries(3), nBaseDelayMs(50), nMaxDelayMs(2000), nAcquireTimeoutMs(5000) {}
+    };
+    /******************************************************************************************/
+    class CDBRowSource;
+
+    // 数据库会话接口：CDBConn通过它访问具体的数据库后端，失败时抛出otl_exception
+    class CDBSession
+    {
+    public:
+        virtual ~CDBSession() {}
+
+        virtual void Logon(const char *conn_str) = 0;   // 登录，不自动提交
+        virtual void Logoff(void) = 0;                  // 登出，失败时也视为已断开
+        virtual bool IsConnected(void) = 0;
+        virtual void Commit(void) = 0;
+        virtual void Rollback(void) = 0;
+        virtual long Execute(const char *sql) = 0;      // 直接执行，返回影响的行数
+        virtual void Ping(void) = 0;                    // 最轻量的服务器往返
+
+        // OTL连接对象，不支持otl_stream的后端返回NULL
+        virtual otl_connect *GetOtlConnect(void) { return NULL; }
+        // 执行查询并返回结果来源，CDBCursor从中读取结果而不使用otl_stream，调用者用delete释放；
+        // 返回NULL(默认)时使用otl_stream
+        virtual CDBRowSource *OpenRowSource(const char * /*sql*/) { return NULL; }
+    };
+
+    // 数据库后端：为连接池创建会话
+    class CDBBackend
+    {
+    public:
+        virtual ~CDBBackend() {}
+        virtual CDBSession *CreateSession(void) = 0;
+    };
+
+    // 基于OTL/OCI的会话(默认后端)
+    class COTLSession : public CDBSession
+    {
+    public:
+        COTLSession();
+        virtual ~COTLSession();
+
+        virtual void Logon(const char *conn_str);
+        virtual void Logoff(void);
+        virtual bool IsConnected(void) { return m_db.connected == 1; }
+        virtual void Commit(void) { m_db.commit(); }
+        virtual void Rollback(void) { m_db.rollback(); }
+        virtual long Execute(const char *sql) { return m_db.direct_exec(sql); }
+        virtual void Ping(void) { m_db.direct_exec("begin null; end;"); }
+        virtual otl_connect *GetOtlConnect(void) { return &m_db; }
+
+    private:
+        otl_connect m_db;
+    };
+
+    class COTLBackend : public CDBBackend
+    {
+    public:
+        virtual CDBSession *CreateSession(void) { return new COTLSession; }
+    };
+    /******************************************************************************************/
+    // 语句缓存类：每个连接缓存已解析的otl_stream，以SQL文本+缓冲区大小为键，
+    // 按最近最少使用淘汰。连接断开或重连前必须清空（游标随会话失效）
+    class CDBStmtCache
+    {
+    public:
+        struct SStmtEntry
+        {
+            otl_stream  * pStream;
+            std::string   strKey;   // 为空表示未缓存的临时语句
+            bool          bInUse;
+            std::list<SStmtEntry*>::iterator itLru;
+        };
+
+        CDBStmtCache();
+        virtual ~CDBStmtCache();
+
+        // 取出语句，未命中时解析新语句；nCapacity为0时不缓存
+        // bReused为true表示语句已执行过，需要重新绑定变量或rewind
+        SStmtEntry *Checkout(otl_connect& db, int buf_size, const char *sql, unsigned int nCapacity, bool& bReused);
+
+        // 归还语句，bBroken为true时关闭并丢弃
+        void Checkin(SStmtEntry *pEntry, bool bBroken);
+
+        // 关闭所有缓存的语句
+        void Clear(void);
+
+        inline int GetCount(void) { return (int)m_mapStmt.size(); }
+        inline unsigned long GetHitNum(void) { return m_nHitNum; }
+        inline unsigned long GetMissNum(void) { return m_nMissNum; }
+
+    private:
+        static void CloseEntry(SStmtEntry *pEntry);
+        void EvictLru(unsigned int nCapacity);
+
+        std::map<std::string, SStmtEntry*> m_mapStmt;  // SQL文本+缓冲区大小 -> 语句
+        std::list<SStmtEntry*>             m_lstLru;   // 头部为最近使用
+        unsigned long                      m_nHitNum;
+        unsigned long                      m_nMissNum;
+
+    private:
+        CDBStmtCache(const CDBStmtCache&);
+        CDBStmtCache& operator=(const CDBStmtCache&);
+    };
+    /******************************************************************************************/
     // 数据库连接类
     class CDBConn
     {
     public:
-        CDBConn();
+        CDBConn(CDBSession *pSession = NULL); // 接管pSession，NULL则使用OTL会话
         virtual ~CDBConn();
 
         // 连接/重连/关闭连接
@@ -171,25 +592,239 @@ namespace OTL
         // 是否需要重新连接
         bool IsNeedReconnect(void);
 
+        // 执行一次最轻量的服务器往返，检查连接是否可用
+        bool Ping(void);
+
         // 是否连接上
-        inline bool IsConnected(void) { return (m_db.connected == 1 ? true : false); }
+        inline bool IsConnected(void) { return m_pSession->IsConnected(); }
 
         // 获取错误信息
         inline const char* GetLastError(void) { return m_strErrMsg.c_str(); }
 
-        // 获取OTL连接对象
-        inline otl_connect& GetDb(void) {return m_db;};
+        // 获取OTL连接对象，后端不支持时抛出runtime_error
+        otl_connect& GetDb(void);
+
+        // 获取数据库会话
+        inline CDBSession& GetSession(void) { return *m_pSession; }
 
-        // 设置异常
+        // 设置/清除异常
         inline void SetException(const otl_exception& e) { m_err = e; }
+        inline void ClearException(void) { m_err.code = 0; }
+
+        // 最近一次验证通过时连接池的代数
+        inline long GetGeneration(void) { return m_nGeneration; }
+        inline void SetGeneration(long nGeneration) { m_nGeneration = nGeneration; }
+
+        // 获取语句缓存
+        inline CDBStmtCache& GetStmtCache(void) { return m_StmtCache; }
+
+    private:
+        friend class CDBConnIdleSet;
+        CDBConn    * m_pNextIdle;   // 空闲集合中的链表指针，避免空闲列表分配节点
+        unsigned long long m_tIdleSince; // 放入空闲集合的时间(微秒)
 
     private:
-        otl_connect  m_db;
+        friend class CDBConnPool;
+#ifdef DBPOOL_DEBUG
+        volatile long m_nCheckedOut;    // 被取出的次数-归还的次数，只能为0或1
+#endif
+        int          m_nClass;          // 使用中时所属的工作负载类别，-1为不计入
+        long         m_nGeneration;     // 验证通过时连接池的代数
+        int          m_nFailCount;      // 连续重连失败次数
+        unsigned long long m_tNextRetry;// 下次重连的时间(微秒)
+        CDBConn    * m_pHeldPrev;       // 持有时间监控：使用中的连接组成的双向链表
+        CDBConn    * m_pHeldNext;
+        unsigned long long m_tCheckOut; // 取出的时间(微秒)
+        const void * m_pSite;           // 取出连接的调用位置(返回地址)
+        bool         m_bHoldWarned;     // 已超过告警阈值
+        bool         m_bReclaimed;      // 已被收回，归还时删除
+
+    private:
+        CDBSession * m_pSession;
+        CDBStmtCache m_StmtCache;   // 语句依赖会话，Close时先清空
         otl_exception m_err;
         std::string  m_strConn;
         std::string  m_strErrMsg;
     };
     /******************************************************************************************/
+    // 空闲连接集合：按CPU分片，每个分片为独立加锁的侵入式链表，
+    // 本分片为空时从其他分片窃取；获取/释放时不分配内存
+    class CDBConnIdleSet
+    {
+    public:
+        typedef void (*VisitFunc)(CDBConn *pConn, void *pArg);
+
+        CDBConnIdleSet(int nShardNum = 0); // 0则按CPU数量分片
+        virtual ~CDBConnIdleSet();
+
+        void Push(CDBConn *pConn);
+        CDBConn *Pop(void);
+
+        // 遍历所有空闲连接（逐个分片加锁）
+        void ForEach(VisitFunc pFunc, void *pArg);
+
+        // 取出空闲时间早于tBefore的连接，最多nMax个，以m_pNextIdle串成链表返回
+        CDBConn *TakeIdleBefore(unsigned long long tBefore, int nMax);
+        static inline CDBConn *NextInChain(CDBConn *pConn) { return pConn->m_pNextIdle; }
+
+        int GetCount(void);
+        inline int GetShardNum(void) { return m_nShardNum; }
+
+        // 后进先出：最近释放的连接最先被复用，冷连接留在链表尾部等待回收
+        inline void SetLifo(bool bLifo) { m_bLifo = bLifo; }
+        inline bool IsLifo(void) { return m_bLifo; }
+
+    private:
+        struct SIdleShard
+        {
+            COTLThreadLock    lock;
+            CDBConn         * volatile pHead;
+            CDBConn         * pTail;
+            volatile long     nCount;
+            char              pad[64];  // 避免相邻分片伪共享
+        };
+
+        int LocalShard(void);
+
+        SIdleShard * m_pShards;
+        int          m_nShardNum;
+        bool         m_bLifo;
+
+    private:
+        CDBConnIdleSet(const CDBConnIdleSet&);
+        CDBConnIdleSet& operator=(const CDBConnIdleSet&);
+    };
+    /******************************************************************************************/
+    // 连接池熔断器状态
+    enum EDBBreakerState
+    {
+        DB_BREAKER_CLOSED    = 0,   // 正常
+        DB_BREAKER_OPEN      = 1,   // 连续新建连接失败，获取不到空闲连接时立即失败
+        DB_BREAKER_HALF_OPEN = 2    // 后台正在试探新建连接，获取仍立即失败
+    };
+
+    // 连接池统计快照
+    struct SPoolStats
+    {
+        enum { HIST_BUCKETS = 32 }; // 第i个桶(i>0)为[2^(i-1), 2^i)微秒，第0个桶为0
+
+        // 连接数(在连接池锁内读取，彼此一致)
+        int nTotal;         // 连接总数
+        int nIdle;          // 空闲
+        int nInUse;         // 使用中
+        int nBroken;        // 等待验证/重连
+        int nPending;       // 正在新建
+        int nWaiting;       // 等待连接的调用者
+
+        // 累计计数
+        long long nAcquires;        // 获取成功
+        long long nAcquireFails;    // 获取失败(超时/无法新建)
+        long long nConnects;        // 新建连接成功
+        long long nConnectFails;    // 新建连接失败
+        long long nReconnects;      // 重连成功
+        long long nReconnectFails;  // 重连失败
+        long long nBreakerRejects;  // 熔断期间立即失败的获取
+        long long nShedRejects;     // 排队过久被拒绝的获取
+        int       nBreakerState;    // EDBBreakerState
+
+        // 持有时间监控(EnableHoldWatch)
+        int       nHeldOverWarn;    // 当前持有超过告警阈值的连接
+        unsigned long long nOldestHeldMs; // 当前持有最久的连接已持有的时间
+        long long nHoldWarns;       // 累计超过告警阈值的次数
+        long long nHoldReclaims;    // 累计收回的连接
+        int       nReclaimedOpen;   // 已收回但持有者尚未归还的连接(会话仍打开)
+
+        // 获取等待时间、连接持有时间(CDBAppConn获取到Release)的直方图
+        long long nWaitSumUs;
+        long long nHoldSumUs;
+        long long nHolds;
+        long long arrWaitHist[HIST_BUCKETS];
+        long long arrHoldHist[HIST_BUCKETS];
+
+        SPoolStats();
+
+        // 按直方图估算百分位数(取所在桶的上界)，p为0~1
+        static unsigned long long PercentileUs(const long long *pHist, double p);
+
+        // 输出为文本
+        void ToString(std::string& strOut) const;
+    };
+
+    // 连接池统计计数器：按CPU分片累加，读取时汇总，开销低，可在生产环境常开
+    class CDBPoolStats
+    {
+    public:
+        CDBPoolStats(int nShardNum);
+        virtual ~CDBPoolStats();
+
+        void RecordAcquire(unsigned long long nWaitUs, bool bOK);
+        void RecordHold(unsigned long long nHoldUs);
+        void RecordConnect(bool bOK);
+        void RecordReconnect(bool bOK);
+        void RecordReject(bool bShed);
+        void RecordHoldWatch(bool bReclaimed);
+
+        // 汇总累计计数和直方图到stats
+        void Collect(SPoolStats& stats);
+
+        static int BucketOf(unsigned long long nUs);
+
+    private:
+        struct SStatShard
+        {
+            volatile long long nAcquires;
+            volatile long long nAcquireFails;
+            volatile long long nConnects;
+            volatile long long nConnectFails;
+            volatile long long nReconnects;
+            volatile long long nReconnectFails;
+            volatile long long nBreakerRejects;
+            volatile long long nShedRejects;
+            volatile long long nHoldWarns;
+            volatile long long nHoldReclaims;
+            volatile long long nWaitSumUs;
+            volatile long long nHoldSumUs;
+            volatile long long nHolds;
+            volatile long long arrWaitHist[SPoolStats::HIST_BUCKETS];
+            volatile long long arrHoldHist[SPoolStats::HIST_BUCKETS];
+            char               pad[64];  // 避免相邻分片伪共享
+        };
+
+        SStatShard * m_pShards;
+        int          m_nShardNum;
+
+    private:
+        CDBPoolStats(const CDBPoolStats&);
+        CDBPoolStats& operator=(const CDBPoolStats&);
+    };
+    // 连接池初始化结果
+    struct SInitResult
+    {
+        int nRequested;     // 请求的连接数
+        int nConnected;     // 已建立
+        int nFailed;        // 建立失败
+        int nSkipped;       // 一个连接也没有建立且连续失败，放弃尝试
+        int nPending;       // 延迟模式下仍在后台建立
+        unsigned long long nReadyUs;    // Init返回的用时(微秒)
+        unsigned long long nTotalUs;    // 全部完成的用时(微秒)，未完成为0
+        std::map<std::string, int> mapErrors; // 失败原因 -> 次数
+
+        SInitResult();
+
+        // 输出为文本
+        void ToString(std::string& strOut) const;
+    };
+    // 持有中的连接
+    struct SHeldConn
+    {
+        CDBConn            * pConn;
+        const void         * pSite;     // 取出连接的调用位置(返回地址，可用addr2line等工具解析)
+        unsigned long long   nHeldMs;   // 已持有的时间(毫秒)
+    };
+    class CDBAppConn;
+    class CDBAsyncQuery;
+    class CDBAsyncExecutor;
+    /******************************************************************************************/
     // 连接池类
     class CDBConnPool
     {
@@ -201,15 +836,75 @@ namespace OTL
         int Init(const char *conn_str, int conn_num, int auto_add_num = 2);
         void Destroy(void);
 
-        // 获取/释放连接
-        CDBConn *GetConn(bool bAutoAdd = true);
+        // 初始化策略，须在Init之前调用：parallel_num个连接同时建立；min_ready < 0 时
+        // Init等待全部完成，否则建立min_ready个后即返回，其余在后台继续建立(期间获取
+        // 连接的调用者等待新连接)；默认逐个建立并等待全部完成
+        void SetInitPolicy(unsigned int parallel_num, int min_ready = -1);
+        // 初始化结果(延迟模式下随后台建立更新)
+        void GetInitResult(SInitResult& result);
+
+        // 获取/释放连接，nClass为工作负载类别
+        CDBConn *GetConn(bool bAutoAdd = true, int nClass = 0);
         void ReleaseConn(CDBConn *conn);
 
-        // 连接数控制操作
+        // 有界获取连接：达到最大连接数时按先来先得排队等待，nTimeoutMs < 0 表示无限等待
+        CDBConn *WaitConn(int nTimeoutMs, int nClass = 0);
+
+        // 工作负载类别：同一连接池中为不同类别的请求预留连接。min_reserved为保证的连接数，
+        // 其他类别不能占用；max_share为该类别最多使用的连接数(0不限)；等待连接时priority
+        // 大的先得到连接，相同的先来先得。预留以最大连接数(SetMaxConnNum)为总量；类别0为
+        // 默认类别(不预留、不限、优先级0)，未指定类别的获取计入默认类别。启用后获取和
+        // 归还都在连接池锁内记账，线程亲和槽位不再使用。返回类别号，失败返回-1
+        int AddWorkloadClass(const char *name, unsigned int min_reserved, unsigned int max_share = 0, int priority = 0);
+        int FindWorkloadClass(const char *name);
+        int GetClassInUse(int nClass);
+
+        // 连接数控制操作（新建连接不持有连接池锁）
         int AddConnNum(int num);
         void ReduceConnNum(int num);
         inline void SetAutoConnNum(unsigned int num) { m_nAutoAddConnNum = num; }
-        inline int GetConnNum(void) { return (int)m_ConnList.size(); }
+        inline int GetConnNum(void) { return m_IdleSet.GetCount() + (int)m_nParkedNum; }
+
+        // 最大连接数（空闲+使用中），0表示不限制
+        inline void SetMaxConnNum(unsigned int num) { m_nMaxConnNum = num; }
+        inline unsigned int GetMaxConnNum(void) { return m_nMaxConnNum; }
+        inline int GetTotalConnNum(void) { return (int)m_nTotalConnNum; }
+
+        // 自适应连接数策略：后进先出复用，保持至少min_idle个空闲连接，
+        // 回收空闲超过idle_timeout_sec秒的连接，并按demand_window_sec秒内
+        // 并发使用量的移动平均预先增长；最大连接数由SetMaxConnNum限制
+        void SetAdaptivePolicy(unsigned int min_idle, unsigned int idle_timeout_sec,
+            unsigned int demand_window_sec = 60, bool bLifo = true);
+        inline double GetAvgInUse(void) { return m_dAvgInUse; }
+
+        // 后台健康检查：定期ping空闲超过interval_sec秒的连接；SetAllConnExceptions
+        // 使连接池代数加一，之前验证的连接须重新验证后才会分配给调用者；
+        // 失败的连接按带随机抖动的指数退避(最长max_backoff_sec秒)重连，不在请求路径上重连
+        bool EnableHealthCheck(unsigned int interval_sec, unsigned int max_backoff_sec = 60);
+        inline long GetGeneration(void) { return m_nGeneration; }
+        int GetBrokenConnNum(void);
+
+        // 线程亲和：每个线程在自己的槽位中保留最后归还的一个连接，下次获取时直接复用，
+        // 不访问空闲集合和统计之外的共享数据(语句缓存也随之命中)；槽位中的连接空闲超过
+        // idle_ms毫秒时由后台线程收回，其他线程获取不到空闲连接时立即收回
+        bool EnableThreadCache(unsigned int idle_ms = 1000);
+        inline int GetParkedConnNum(void) { return (int)m_nParkedNum; }
+
+        // 熔断与过载保护：连续fail_threshold次新建连接失败后熔断(0关闭)，熔断期间获取不到
+        // 空闲连接的调用者立即失败，既不新建连接也不排队，正在等待的调用者也立即返回；
+        // open_ms毫秒后由后台增长线程试探新建一个连接，成功则恢复，失败则继续熔断。
+        // shed_wait_ms > 0 时，队首的等待者已等待超过该时间则新的获取不再排队，立即失败
+        void SetCircuitBreaker(unsigned int fail_threshold, unsigned int open_ms = 5000, unsigned int shed_wait_ms = 0);
+        inline EDBBreakerState GetBreakerState(void) { return (EDBBreakerState)m_nBreakerState; }
+
+        // 持有时间监控：记录每个取出的连接的取出时间和调用位置，后台线程每秒检查一次，
+        // 持有超过warn_ms毫秒的连接计入告警；reclaim_ms > 0 时收回持有超过该时间的连接，
+        // 不再计入连接数以便新建连接替代，其会话在持有者归还时关闭(持有者可能仍在使用，
+        // 不能在后台关闭)。已收回而未归还的会话最多max_reclaimed个，达到后不再收回，
+        // 数据库会话总数不超过最大连接数加max_reclaimed。启用后不能关闭，可再次调用调整阈值
+        bool EnableHoldWatch(unsigned int warn_ms, unsigned int reclaim_ms = 0, unsigned int max_reclaimed = 1);
+        // 持有超过min_held_ms毫秒的连接，按持有时间从长到短排列，返回数量
+        int GetHeldConns(std::vector<SHeldConn>& vecHeld, unsigned int min_held_ms = 0);
 
         // 设置连接池中的连接的异常信息
         void SetAllConnExceptions(const otl_exception& e );
@@ -217,44 +912,1108 @@ namespace OTL
         // 获取错误信息
         inline const char* GetLastError(void) { return m_strErrMsg.c_str(); }
 
+        // 设置数据库后端(不接管)，须在Init之前调用；默认为OTL
+        inline void SetBackend(CDBBackend *pBackend) { m_pBackend = pBackend; }
+
+        // 统计信息：获取快照/输出为文本
+        void GetStats(SPoolStats& stats);
+        void DumpStats(std::string& strOut);
+
+        // 每个连接缓存的语句数量上限，0为不缓存
+        inline void SetStmtCacheSize(unsigned int num) { m_nStmtCacheSize = num; }
+        inline unsigned int GetStmtCacheSize(void) { return m_nStmtCacheSize; }
+
+        // 异步执行：启动thread_num个执行线程，每个线程用池中的连接执行提交的查询；
+        // max_queue为排队上限(0不限)，acquire_timeout_ms为获取连接的等待超时
+        bool EnableAsync(unsigned int thread_num, unsigned int max_queue = 0, int acquire_timeout_ms = -1);
+        // 提交异步查询(不接管)，未启用或队列已满时返回false；pConn不为NULL时在该已
+        // 获取的连接上执行(执行期间调用者不能使用该连接)，否则由执行线程从池中获取
+        bool SubmitAsync(CDBAsyncQuery *pQuery, CDBAppConn *pConn = NULL);
+
+        // 未归还的连接数(使用中+等待中)，无锁读取的近似值，用于负载均衡
+        inline int GetOutstandingNum(void)
+        {
+            return (int)m_nTotalConnNum - GetConnNum() + (int)m_nWaitNum;
+        }
+
+    private:
+        friend class CDBAppConn; // 记录持有时间和重连次数
+
+        // 等待连接的调用者，位于调用者栈上，以单链表组成按优先级排列的先进先出队列
+        struct SConnWaiter
+        {
+            CDBConn        * pConn;    // 由ReleaseConn或后台增长线程直接移交的连接
+            SConnWaiter    * pNext;
+            bool             bFailFast; // 没有正在新建的连接时放弃等待(GetConn)
+            unsigned long long tEnqueue; // 开始等待的时间(微秒)
+            int              nClass;    // 工作负载类别
+            int              nPriority;
+            COTLThreadCond   cond;
+        };
+
+        // 工作负载类别
+        struct SWorkloadClass
+        {
+            std::string      strName;
+            unsigned int     nMinReserved;
+            unsigned int     nMaxShare;   // 0不限
+            int              nPriority;
+            unsigned int     nInUse;
+        };
+
+        // 线程槽位，创建后一直保留到Destroy，线程退出后可被其他线程复用
+        struct SThreadSlot
+        {
+            CDBConn     * volatile pConn;   // 只有所属线程放入，所属线程和收回者用原子交换取出
+            unsigned long long     tParked; // 放入的时间(微秒)
+            CDBConnPool          * pPool;
+            SThreadSlot          * pNext;   // 所有槽位的链表(m_Lock)
+            bool                   bFree;   // 线程已退出
+        };
+
+        // 取出/放入本线程槽位中的连接
+        CDBConn *TakeThreadConn(void);
+        bool ParkThreadConn(CDBConn *pConn);
+        static void OTL_TLS_CALLBACK ThreadSlotExit(void *pValue);
+        // 收回放入时间早于tBefore的槽位连接：bTakeOne时返回第一个，其余发布(调用前需持有m_Lock)
+        CDBConn *ReclaimThreadConns(unsigned long long tBefore, bool bTakeOne);
+        void ReturnConn(CDBConn *pConn);
+
+        // 取出已验证的空闲连接，未验证的交给健康检查线程
+        CDBConn *PopValidConn(void);
+        bool IsSuspect(CDBConn *pConn);
+        void Quarantine(CDBConn *pConn);
+
+        // 后台健康检查线程
+        static void HealthThreadFunc(void *pArg);
+        void HealthLoop(void);
+        bool ValidateConn(CDBConn *pConn);
+        unsigned long long NextBackoffUs(int nFailCount);
+
+        // 以下函数调用前需持有m_Lock
+        CDBConn *AcquireLocked(int nTimeoutMs, bool bFailFast, int nClass);
+        CDBConn *WaitInQueue(int nTimeoutMs, bool bFailFast, int nClass);
+        bool AdmitClass(int nClass);
+        bool CanTakeNow(int nClass);
+        SConnWaiter *PickWaiter(void);
+        void AssignClass(CDBConn *pConn, int nClass);
+        void DispatchIdleConns(void);
+        void RemoveWaiter(SConnWaiter *pWaiter);
+        void PublishConn(CDBConn *pConn);
+        void WakeFailFastWaiters(void);
+        bool RejectAcquire(void);
+        void UpdateBreaker(bool bConnected);
+        int  ReserveConn(int num);
+        int  RequestGrow(int num);
+
+        // 初始化线程：逐个领取并建立Init预留的连接
+        static void InitThreadFunc(void *pArg);
+        void InitLoop(void);
+
+        // 记录连接被取出：持有时间监控加入使用中链表；调试构建中重复取出时中止
+        CDBConn *CheckOut(CDBConn *pConn, const void *pSite);
+        void TagCallSite(CDBConn *pConn, const void *pSite);
+        void UnlinkHeld(CDBConn *pConn);
+        void WatchHeldConns(void);
+
+        // 新建已预留的连接，在锁外执行rlogon
+        int  CreateConns(int num);
+        CDBConn *NewConn(void);
+
+        // 后台增长线程，启用自适应策略时同时定期维护连接数
+        static void GrowThreadFunc(void *pArg);
+        void GrowLoop(void);
+        bool IsAdaptive(void);
+        CDBConn *MaintainConns(void);
+
     private:
-        std::list<CDBConn*>  m_ConnList;        // connection objects's list
+        CDBConnIdleSet       m_IdleSet;         // idle connections
         std::string          m_strConn;         // connection characters
         std::string          m_strErrMsg;       // connected error message
         unsigned int         m_nAutoAddConnNum; // adding number automatically
+        unsigned int         m_nMaxConnNum;     // max number of connections, 0 is unlimited
+        unsigned int         m_nTotalConnNum;   // number of connections owned (idle + in use)
+        unsigned int         m_nPendingConnNum; // number of connections being opened
+        unsigned int         m_nGrowRequest;    // connections requested from the grow thread
+        volatile long        m_nWaitNum;        // number of waiting callers, read without lock
+        unsigned int         m_nMinIdleNum;     // adaptive policy: min idle connections
+        unsigned int         m_nIdleTimeoutSec; // adaptive policy: idle eviction timeout, 0 never
+        unsigned int         m_nDemandWindowSec;// adaptive policy: moving average window of use
+        double               m_dAvgInUse;       // moving average of connections in use
+        unsigned int         m_nStmtCacheSize;  // statement cache capacity per connection
+        volatile long        m_nGeneration;     // bumped when the server connection is suspect
+        bool                 m_bHealthCheck;    // health check enabled
+        bool                 m_bStopHealth;     // health thread exit flag
+        long                 m_nCheckedGeneration; // generation last swept by the health thread
+        unsigned int         m_nHealthIntervalSec; // ping idle connections idle longer than this
+        unsigned int         m_nMaxBackoffSec;  // max reconnect backoff
+        unsigned int         m_nRandSeed;       // backoff jitter
+        std::list<CDBConn*>  m_lstSuspect;      // connections waiting for validation
+        std::list<CDBConn*>  m_lstBroken;       // connections waiting for reconnect
+        COTLThreadLock       m_HealthLock;      // protects the health lists, taken after m_Lock
+        COTLThreadCond       m_HealthCond;      // wakes the health thread
+        COTLThread           m_HealthThread;    // background health check thread
+        CDBPoolStats         m_Stats;           // counters and histograms
+        CDBBackend         * m_pBackend;        // session factory, NULL for OTL
+        CDBAsyncExecutor   * m_pAsync;          // async query executor, created on demand
+        unsigned int         m_nInitParallel;   // connections opened concurrently by Init
+        int                  m_nInitMinReady;   // Init returns once this many are ready, <0 all
+        int                  m_nInitLaunchNum;  // Init connections not yet started
+        unsigned long long   m_tInitBegin;
+        SInitResult          m_InitResult;
+        COTLThread         * m_pInitThreads;    // background init threads
+        unsigned int         m_nInitThreadNum;
+        COTLThreadCond       m_InitCond;        // an init connection finished
+        COTLThreadLocal    * m_pThreadSlot;     // per-thread slot, NULL when thread cache is off
+        SThreadSlot        * m_pSlotList;       // all thread slots
+        unsigned int         m_nSlotIdleMs;     // reclaim parked connections idle longer than this
+        volatile long        m_nParkedNum;      // connections parked in thread slots
+        std::vector<SWorkloadClass> m_vecClass; // workload classes, empty when not used
+        volatile bool        m_bClassed;        // workload classes in use
+        unsigned int         m_nClassInUse;     // connections in use counted by classes
+        unsigned int         m_nBreakerThreshold; // connect failures in a row that open the breaker, 0 off
+        unsigned int         m_nBreakerOpenMs;  // time open before a half-open probe
+        unsigned int         m_nShedWaitMs;     // shed new acquires once the queue head waited longer, 0 off
+        unsigned int         m_nConnFailStreak; // connect failures in a row
+        volatile int         m_nBreakerState;   // EDBBreakerState
+        unsigned long long   m_tBreakerProbe;   // time of the next half-open probe
+        volatile bool        m_bHoldWatch;      // hold watch enabled, never turned off
+        unsigned int         m_nHoldWarnMs;     // flag connections held longer than this
+        unsigned int         m_nHoldReclaimMs;  // reclaim connections held longer than this, 0 never
+        unsigned int         m_nHoldReclaimMax; // stop reclaiming while this many are still held
+        unsigned int         m_nReclaimedOpen;  // reclaimed but not yet returned, under m_WatchLock
+        CDBConn            * m_pHeldList;       // checked-out connections while watched
+        COTLThreadLock       m_WatchLock;       // protects the held list, taken after m_Lock
+        SConnWaiter        * m_pWaitHead;       // FIFO queue of waiting callers
+        SConnWaiter        * m_pWaitTail;
+        bool                 m_bStopGrow;       // grow thread exit flag
+        COTLThreadCond       m_GrowCond;        // wakes the grow thread
+        COTLThread           m_GrowThread;      // background grow thread
         COTLThreadLock       m_Lock;            // thread lock
     };
+    /******************************************************************************************/
+    // 多节点连接池组：每个节点(主库或备库)一个连接池；只读请求按权重路由到未归还
+    // 连接最少的备库(没有可用备库时使用主库)，写请求路由到主库；连续失败的节点被
+    // 剔除，按指数退避到期后重新接纳试用，成功后恢复
+    class CDBPoolGroup
+    {
+    public:
+        CDBPoolGroup();
+        virtual ~CDBPoolGroup();
+
+        // 添加节点并初始化其连接池，pBackend为NULL时使用SetBackend设置的后端
+        // 成功返回节点序号，失败返回-1
+        int AddEndpoint(const char *conn_str, int conn_num, int weight = 1,
+            bool bPrimary = false, CDBBackend *pBackend = NULL);
+        void Destroy(void);
+
+        // 剔除策略：连续失败fail_num次剔除，剔除时间从base_ms起倍增，最长max_ms；
+        // 试用中的节点获取连接最多等待probe_ms毫秒
+        void SetEjectPolicy(int fail_num, unsigned int base_ms, unsigned int max_ms, unsigned int probe_ms = 200);
+        inline void SetBackend(CDBBackend *pBackend) { m_pBackend = pBackend; }
+
+        // 选择节点，nExclude为本次已尝试失败的节点；没有可用节点返回-1
+        int Route(bool bReadOnly, int nExclude = -1);
+        // 报告节点上的获取/执行结果，用于剔除与恢复
+        void ReportResult(int nEndpoint, bool bOK);
+
+        inline int GetEndpointNum(void) { return (int)m_vecEndpoint.size(); }
+        inline CDBConnPool *GetPool(int nEndpoint) { return m_vecEndpoint[nEndpoint]->pPool; }
+        bool IsEjected(int nEndpoint);
+        // 获取连接的等待时间：试用中的节点不超过试用等待时间
+        int GetAcquireTimeout(int nEndpoint, int nTimeoutMs);
+
+        // 获取错误信息
+        inline const char* GetLastError(void) { return m_strErrMsg.c_str(); }
+
+    private:
+        struct SEndpoint
+        {
+            CDBConnPool        * pPool;
+            int                  nWeight;
+            bool                 bPrimary;
+            volatile long        nFailCount;  // 连续失败次数
+            int                  nEjectNum;   // 连续剔除次数，决定剔除时间
+            volatile unsigned long long tEjectUntil; // 剔除到期时间(微秒)，0为未剔除
+        };
+
+        bool IsAvailable(SEndpoint *pEndpoint, unsigned long long tNow);
+
+        std::vector<SEndpoint*> m_vecEndpoint;  // 初始化后不再变化，路由时无锁读取
+        CDBBackend            * m_pBackend;
+        int                     m_nEjectFailNum;
+        unsigned int            m_nEjectBaseMs;
+        unsigned int            m_nEjectMaxMs;
+        unsigned int            m_nProbeMs;     // 试用中的节点获取连接的最长等待(毫秒)
+        volatile long           m_nRoundRobin;  // 负载相同时轮流选择
+        std::string             m_strErrMsg;
+        COTLThreadLock          m_Lock;         // 保护剔除状态的修改
+    };
     
+    /******************************************************************************************/
+    // 批量写入选项
+    struct SBulkOptions
+    {
+        int  nBatchSize;     // 每批的行数(OCI数组绑定的大小)
+        int  nCommitBatches; // 每N批提交一次，0则不提交(由调用者提交)
+        bool bStopOnError;   // 某批失败后是否停止
+
+        SBulkOptions(int batch_size = 100, int commit_batches = 0, bool stop_on_error = true)
+            : nBatchSize(batch_size), nCommitBatches(commit_batches), bStopOnError(stop_on_error) {}
+    };
+
+    // 批量写入中失败的批次
+    struct SBulkError
+    {
+        int         nBatch;     // 批次序号(从0开始)
+        long        nFirstRow;  // 该批第一行在容器中的序号
+        int         nRowCount;  // 该批的行数
+        long        nRowsDone;  // 该批出错前已处理的行数
+        int         nErrCode;   // ORA错误码
+        std::string strErrMsg;
+    };
+
+    // 批量写入结果
+    struct SBulkResult
+    {
+        long                    nRows;    // 写入成功的行数
+        int                     nBatches; // 执行的批数
+        std::vector<SBulkError> errors;
+
+        SBulkResult() : nRows(0), nBatches(0) {}
+        inline bool Good(void) const { return errors.empty(); }
+    };
+
+    // 默认的行绑定：要求定义 otl_stream& operator<<(otl_stream&, const Row&)
+    struct CDBStreamBinder
+    {
+        template<class Row> void operator()(otl_stream& s, const Row& row) const { s << row; }
+    };
+
+    // 批量写入的分批执行与错误记录，由CDBAppConn::BulkWrite以本连接和缓冲区大小为opt.nBatchSize
+    // 的CDBStream调用。Conn需提供Commit、GetErrFromException，Stream需提供Get、SetBroken，
+    // 以及通过->调用的flush、get_rpc、clean(同otl_stream)
+    template<class Conn, class Stream, class Container, class Binder>
+    SBulkResult BulkWriteBatches(Conn& conn, Stream& stm, const Container& rows, Binder binder,
+        const SBulkOptions& opt);
     /******************************************************************************************/
     // 数据库连接应用类
+    // 连接句柄：构造时获取连接，析构时归还；只能转移，不能复制。
+    // 跨阶段传递时用Transfer/Swap(C++11起也可以移动)转移连接，不需要归还后重新获取：
+    //     CDBAppConn conn(&pool, 1000);
+    //     stage.conn.Transfer(conn);      // conn变为空句柄
     class CDBAppConn
     {
     public:
+        CDBAppConn();   // 空句柄，之后用Transfer/Attach获得连接
         CDBAppConn(CDBConnPool *pPool);
+        CDBAppConn(CDBConnPool *pPool, int nTimeoutMs, int nClass = 0); // 有界等待获取连接，nClass为工作负载类别
+        // 从连接池组获取连接：只读请求路由到备库，节点不可用时换一个节点重试一次
+        CDBAppConn(CDBPoolGroup *pGroup, bool bReadOnly, int nTimeoutMs = -1);
         ~CDBAppConn();
+#if __cplusplus >= 201103L || ( defined(_MSVC_LANG) && _MSVC_LANG >= 201103L )
+        CDBAppConn(CDBAppConn&& other) : m_pConn(NULL), m_pPool(NULL), m_pGroup(NULL),
+            m_nEndpoint(-1), m_bReadOnly(false), m_tAcquired(0) { Swap(other); }
+        CDBAppConn& operator=(CDBAppConn&& other) { Transfer(other); return *this; }
+#endif
 
         void Release(void); // release the db connection
+        inline void Reset(void) { Release(); }
+
+        // 转移所有权：归还本句柄的连接，接管other的连接，other变为空句柄
+        void Transfer(CDBAppConn& other);
+        void Swap(CDBAppConn& other);
+        // 放弃所有权并返回连接(不归还)，之后须用Attach交给句柄或用ReleaseConn归还
+        CDBConn *Detach(void);
+        // 接管从pPool取出的连接pConn，先归还本句柄原有的连接
+        void Attach(CDBConnPool *pPool, CDBConn *pConn);
+        inline CDBConn *GetConn(void) { return m_pConn; }
+
         void Commit(void);  // commit a transaction manually
+        long Execute(const char *sql); // execute a statement directly (throws otl_exception)
         bool Rollback(otl_exception* pException = NULL); // rollback a transaction manually
 
         // 连接是否可用
         inline bool Good(void){ return (m_pConn && m_pConn->IsConnected()); }
 
         // 重新连接，当不可用时进行尝试
-        inline bool Reconnect(bool bForce = false) { return (m_pConn ? m_pConn->Reconnect(bForce) : false); }
+        bool Reconnect(bool bForce = false);
 
-        // 获取错误信息
-        inline const char* GetLastError(void) { return (m_pConn ? m_pConn->GetLastError() : "NULL Connection"); }
+        // 获取错误信息，没有获取到连接时为连接池的错误信息(熔断、拒绝、等待超时等)
+        inline const char* GetLastError(void)
+        {
+            if( m_pConn )
+                return m_pConn->GetLastError();
+            return m_pPool ? m_pPool->GetLastError() : "NULL Connection";
+        }
+
+        // 获取所属的连接池
+        inline CDBConnPool* GetPool(void) { return m_pPool; }
 
         // 从异常中获取错误信息
         const char* GetErrFromException(const otl_exception& e);
 
+        // 执行幂等的操作work(CDBAppConn&)，遇到可重试的错误时回滚并按策略重试，连接失效
+        // 时换用新的连接；不可重试或重试次数用尽时抛出最后一次的otl_exception
+        template<class Work>
+        void ExecuteIdempotent(Work work, const SRetryPolicy& policy = SRetryPolicy());
+        // 直接执行幂等的SQL语句，返回影响的行数
+        long ExecuteIdempotent(const char *sql, const SRetryPolicy& policy = SRetryPolicy());
+
         // 获取OTL连接对象
         operator otl_connect&(void) const;
 
+        // 从连接的语句缓存中取出/归还已解析的语句，一般通过CDBStream使用
+        CDBStmtCache::SStmtEntry *CheckoutStream(int buf_size, const char *sql, bool& bReused);
+        void CheckinStream(CDBStmtCache::SStmtEntry *pEntry, bool bBroken);
+
+        // 批量写入：按批以数组绑定执行insert/update，binder(otl_stream&, const Row&)负责写入一行
+        // 的绑定变量；Commit失败时抛出otl_exception
+        template<class Container, class Binder>
+        SBulkResult BulkWrite(const char *sql, const Container& rows, Binder binder,
+            const SBulkOptions& opt = SBulkOptions());
+        template<class Container>
+        SBulkResult BulkWrite(const char *sql, const Container& rows, const SBulkOptions& opt = SBulkOptions())
+        {
+            return BulkWrite(sql, rows, CDBStreamBinder(), opt);
+        }
+
+    private:
+        void AfterAcquire(const void *pSite);
+        // 幂等操作出错后准备下一次尝试(回滚、必要时换连接、退避等待)，不应重试时返回false
+        bool PrepareRetry(const otl_exception& e, int nAttempt, const SRetryPolicy& policy);
+        bool Reacquire(int nTimeoutMs);
+
+        CDBConn      * m_pConn;
+        CDBConnPool  * m_pPool;
+        CDBPoolGroup * m_pGroup;    // 从连接池组获取时的组和节点
+        int            m_nEndpoint;
+        bool           m_bReadOnly;
+        unsigned long long m_tAcquired; // 获取到连接的时间，用于统计持有时间
+
+    private:
+        CDBAppConn(const CDBAppConn&);
+        CDBAppConn& operator=(const CDBAppConn&);
+    };
+    /******************************************************************************************/
+    // 缓存语句类：析构时将语句归还给取出时连接的语句缓存，使用方式同otl_stream
+    //     CDBStream stm(conn, 1, "select name from t where id = :id<int>");
+    //     stm << id;  stm >> name;
+    // 复用没有输入变量的语句时会自动rewind重新执行。通过<<、>>出错(即使异常已被捕获)
+    // 或析构时有本语句生存期内抛出的异常，语句被丢弃；通过Get()、->直接使用otl_stream
+    // 出错时须调用SetBroken。语句须在连接归还连接池之前析构
+    class CDBStream
+    {
+    public:
+        CDBStream(CDBAppConn& conn, int buf_size, const char *sql);
+        ~CDBStream();
+
+        inline otl_stream& Get(void) { return *m_pEntry->pStream; }
+        inline operator otl_stream&(void) { return *m_pEntry->pStream; }
+        inline otl_stream* operator->(void) { return m_pEntry->pStream; }
+
+        template<class T> CDBStream& operator<<(const T& v)
+        {
+            try { (*m_pEntry->pStream) << v; }
+            catch( otl_exception & ) { m_bBroken = true; throw; }
+            return *this;
+        }
+        template<class T> CDBStream& operator>>(T& v)
+        {
+            try { (*m_pEntry->pStream) >> v; }
+            catch( otl_exception & ) { m_bBroken = true; throw; }
+            return *this;
+        }
+
+        // 是否复用了缓存中的语句
+        inline bool IsReused(void) { return m_bReused; }
+        // 标记语句已损坏，归还时关闭丢弃
+        inline void SetBroken(void) { m_bBroken = true; }
+
+    private:
+        CDBStmtCache              * m_pCache;   // 取出语句的缓存
+        CDBStmtCache::SStmtEntry  * m_pEntry;
+        bool                        m_bReused;
+        bool                        m_bBroken;
+        int                         m_nUncaught; // 构造时未捕获的异常数
+
+    private:
+        CDBStream(const CDBStream&);
+        CDBStream& operator=(const CDBStream&);
+    };
+    /******************************************************************************************/
+    // 结果集的列描述
+    struct SCursorColumn
+    {
+        std::string strName;
+        int         nType;      // otl_var_xxx
+        int         nSize;      // 在行缓冲区中占用的字节数
+        int         nOffset;    // 在行缓冲区中的偏移
+    };
+
+    // 查询结果来源：由不支持otl_stream的后端通过CDBSession::OpenRowSource提供给CDBCursor，
+    // 逐行按列的顺序读取
+    class CDBRowSource
+    {
+    public:
+        virtual ~CDBRowSource() {}
+
+        // 列描述：填写列名、类型(otl_var_xxx)，字符列的nSize为最大长度
+        virtual void Describe(std::vector<SCursorColumn>& vecColumns) = 0;
+        // 是否已读完所有行
+        virtual bool Eof(void) = 0;
+        // 读取下一列的值到p(按col的类型，p有col.nSize字节)，返回是否为NULL
+        virtual bool Read(const SCursorColumn& col, char *p) = 0;
+    };
+
+    // 结果行视图：直接指向CDBCursor的行缓冲区，在游标取下一块数据前有效
+    class CDBRowView
+    {
+    public:
+        CDBRowView() : m_pColumns(NULL), m_pRow(NULL) {}
+        CDBRowView(const std::vector<SCursorColumn> *pColumns, const char *pRow)
+            : m_pColumns(pColumns), m_pRow(pRow) {}
+
+        inline int GetColumnNum(void) const { return (int)m_pColumns->size(); }
+        inline int GetColumnType(int col) const { return (*m_pColumns)[col].nType; }
+        inline bool IsNull(int col) const { return m_pRow[col] != 0; }
+
+        const char *GetString(int col) const;           // 字符列
+        double GetDouble(int col) const;                // 数值列
+        long GetLong(int col) const;                    // 数值列(截断)
+        const otl_datetime& GetDatetime(int col) const; // 日期时间列
+
+    private:
+        inline const char *Data(int col) const { return m_pRow + (*m_pColumns)[col].nOffset; }
+
+        const std::vector<SCursorColumn> * m_pColumns;
+        const char                       * m_pRow;      // 行首为每列一个字节的NULL标志
+    };
+
+    // 只进游标：otl_stream按nPrefetchRows行数组预取，结果读入可复用的行缓冲区，
+    // 无论结果集多大内存占用不变。LOB列不支持，请在SQL中转换(如dbms_lob.substr)。
+    // 会话提供结果来源(CDBSession::OpenRowSource)时从结果来源读取，忽略输入变量
+    //     CDBCursor cur(conn, "select id, name from t where type = :t<int>", 500);
+    //     cur << type;
+    //     while( cur.Next() ) { cur.Row().GetLong(0); cur.Row().GetString(1); }
+    class CDBCursor
+    {
+    public:
+        CDBCursor(CDBAppConn& conn, const char *sql, int nPrefetchRows = 500);
+        virtual ~CDBCursor();
+
+        // 写入输入变量，全部写入后开始执行
+        template<class T> CDBCursor& operator<<(const T& v) { if( m_pStream ) *m_pStream << v; return *this; }
+
+        // 移动到下一行，没有更多行时返回false
+        bool Next(void);
+        inline const CDBRowView& Row(void) const { return m_Row; }
+
+        // 按块处理：取下一块数据(最多nPrefetchRows行)，返回行数，0为结束
+        int FetchBlock(void);
+        CDBRowView RowAt(int nRow) const;
+
+        inline int GetColumnNum(void) { DescribeColumns(); return (int)m_Columns.size(); }
+        inline const char *GetColumnName(int col) { DescribeColumns(); return m_Columns[col].strName.c_str(); }
+        inline long GetRowCount(void) { return m_nRowCount; }
+
+    private:
+        void DescribeColumns(void);
+        void ReadRow(char *pRow);
+
+        CDBStream                 * m_pStream;      // 使用结果来源时为NULL
+        CDBRowSource              * m_pSource;
+        std::vector<SCursorColumn>  m_Columns;
+        int                         m_nPrefetchRows;
+        int                         m_nRowSize;
+        char                      * m_pBuffer;      // nPrefetchRows * m_nRowSize
+        int                         m_nBlockRows;   // 当前块的行数
+        int                         m_nCurRow;      // 当前行在块中的位置
+        long                        m_nRowCount;    // 已读取的总行数
+        CDBRowView                  m_Row;
+
+    private:
+        CDBCursor(const CDBCursor&);
+        CDBCursor& operator=(const CDBCursor&);
+    };
+    /******************************************************************************************/
+    // BulkWriteBatches 模板实现
+    template<class Conn, class Stream, class Container, class Binder>
+    SBulkResult BulkWriteBatches(Conn& conn, Stream& stm, const Container& rows, Binder binder,
+        const SBulkOptions& opt)
+    {
+        SBulkResult result;
+        int nBatchSize = (opt.nBatchSize > 0) ? opt.nBatchSize : 1;
+
+        typename Container::const_iterator it = rows.begin();
+        long nRow = 0;
+        bool bStopped = false;
+        while( it != rows.end() )
+        {
+            long nFirstRow = nRow;
+            int  n = 0;
+            try
+            {
+                for( ; it != rows.end() && n < nBatchSize; ++it, ++n, ++nRow )
+                    binder(stm.Get(), *it);
+                stm->flush();
+                result.nRows += n;
+            }
+            catch( otl_exception & e )
+            {
+                for( ; it != rows.end() && n < nBatchSize; ++it, ++n, ++nRow )
+                    ; // 跳过该批剩余的行
+
+                SBulkError err;
+                err.nBatch    = result.nBatches;
+                err.nFirstRow = nFirstRow;
+                err.nRowCount = n;
+                err.nRowsDone = stm->get_rpc();
+                err.nErrCode  = e.code;
+                err.strErrMsg = conn.GetErrFromException(e);
+                result.errors.push_back(err);
+                result.nRows += err.nRowsDone;
+
+                stm->clean();
+                if( CheckErrCodeForReconnect(e.code) )
+                    stm.SetBroken();
+                if( opt.bStopOnError || CheckErrCodeForReconnect(e.code) )
+                {
+                    // 停止时不提交未提交的批次，由调用者决定提交或回滚
+                    ++result.nBatches;
+                    bStopped = true;
+                    break;
+                }
+            }
+            ++result.nBatches;
+
+            if( opt.nCommitBatches > 0 && 0 == result.nBatches % opt.nCommitBatches )
+                conn.Commit();
+        }
+        if( !bStopped && opt.nCommitBatches > 0 && 0 != result.nBatches % opt.nCommitBatches )
+            conn.Commit();
+
+        return result;
+    }
+    /******************************************************************************************/
+    // CDBAppConn::BulkWrite 模板实现
+    template<class Container, class Binder>
+    SBulkResult CDBAppConn::BulkWrite(const char *sql, const Container& rows, Binder binder,
+        const SBulkOptions& opt /* = SBulkOptions() */)
+    {
+        int nBatchSize = (opt.nBatchSize > 0) ? opt.nBatchSize : 1;
+
+        // 缓冲区大小即数组绑定大小，缓冲区满时自动flush；提交由BulkWriteBatches控制
+        CDBStream stm(*this, nBatchSize, sql);
+        stm->set_commit(0);
+        SBulkResult result = BulkWriteBatches(*this, stm, rows, binder, opt);
+        stm->set_commit(1); // 恢复otl_stream的默认值
+        return result;
+    }
+    /******************************************************************************************/
+    // CDBAppConn::ExecuteIdempotent 模板实现
+    template<class Work>
+    void CDBAppConn::ExecuteIdempotent(Work work, const SRetryPolicy& policy /* = SRetryPolicy() */)
+    {
+        for( int nAttempt = 0; ; ++nAttempt )
+        {
+            try
+            {
+                if( !Good() )
+                    throw otl_exception(GetLastError(), 3114);
+                work(*this);
+                return;
+            }
+            catch( otl_exception & e )
+            {
+                if( !PrepareRetry(e, nAttempt, policy) )
+                    throw;
+            }
+        }
+    }
+    /******************************************************************************************/
+    // 异步查询：提交给连接池的执行线程，在池中的连接上执行并把结果解码为字符串。
+    // 输入变量按顺序以字符串绑定(SQL中声明为<char[N]>)；select/with语句读取全部结果，
+    // 其他语句取影响行数并在成功时提交、失败时回滚。需要其他绑定或解码方式时派生并重载Run。
+    // 未设置回调时用Wait等待完成；设置回调后在执行线程上调用回调，之后不再访问该对象，
+    // 回调中可以删除它，但不能再调用Wait
+    //     CDBAsyncQuery q("select name from t where id = :id<char[32]>");
+    //     q.Bind("42");
+    //     pool.SubmitAsync(&q);
+    //     if( q.Wait(1000) && q.Good() ) q.GetValue(0, 0);
+    class CDBAsyncQuery
+    {
+    public:
+        typedef void (*Callback)(CDBAsyncQuery *pQuery, void *pArg);
+
+        CDBAsyncQuery(const char *sql = NULL, int nPrefetchRows = 100);
+        virtual ~CDBAsyncQuery();
+
+        // 设置SQL/绑定输入变量(NULL为空值)/设置完成回调，须在提交前调用
+        inline void SetSql(const char *sql) { m_strSql = sql; }
+        CDBAsyncQuery& Bind(const char *value);
+        inline void SetCallback(Callback pCallback, void *pArg) { m_pCallback = pCallback; m_pCallbackArg = pArg; }
+
+        // 等待完成，nTimeoutMs < 0 无限等待，超时返回false
+        bool Wait(int nTimeoutMs = -1);
+        inline bool IsDone(void) { return m_bDone; }
+
+        // 执行结果
+        inline bool Good(void) { return m_bDone && m_strErrMsg.empty(); }
+        inline int GetErrCode(void) { return m_nErrCode; }
+        inline const char *GetLastError(void) { return m_strErrMsg.c_str(); }
+        inline long GetRpc(void) { return m_nRpc; }
+        inline int GetColumnNum(void) { return (int)m_vecColumns.size(); }
+        inline const char *GetColumnName(int col) { return m_vecColumns[col].c_str(); }
+        inline int GetRowNum(void) { return m_vecColumns.empty() ? 0 : (int)(m_vecValues.size() / m_vecColumns.size()); }
+        // 获取第row行第col列的值，NULL值返回NULL
+        const char *GetValue(int row, int col);
+
+    protected:
+        // 在执行线程上用已获取的连接执行，出错时抛出otl_exception
+        virtual void Run(CDBAppConn& conn);
+
+        // 在执行线程上处理查询：默认获取连接(或使用提交时指定的连接)后调用Run，
+        // 出错时回滚并记录错误；不需要执行SQL的任务(如异步获取连接)可重载
+        virtual void Process(CDBConnPool *pPool, int nAcquireTimeoutMs);
+        void SetError(int nErrCode, const char *msg);
+
+        // 供Run保存结果
+        inline void AddColumn(const char *name) { m_vecColumns.push_back(name); }
+        void AddValue(const char *value);
+        inline void SetRpc(long nRpc) { m_nRpc = nRpc; }
+
+        std::string               m_strSql;
+        int                       m_nPrefetchRows;
+        std::vector<std::string>  m_vecBinds;
+        std::vector<char>         m_vecBindNull;
+
+    private:
+        friend class CDBAsyncExecutor;
+
+        void Reset(void);
+        void RunOn(CDBAppConn& conn);
+        void Complete(void);
+        static bool IsSelect(const char *sql);
+
+        Callback                  m_pCallback;
+        void                    * m_pCallbackArg;
+        volatile bool             m_bDone;
+        int                       m_nErrCode;
+        std::string               m_strErrMsg;
+        long                      m_nRpc;
+        std::vector<std::string>  m_vecColumns;
+        std::vector<std::string>  m_vecValues;   // 按行存放
+        std::vector<char>         m_vecNull;
+        CDBAsyncQuery           * m_pNextQueued; // 执行器队列
+        CDBAppConn              * m_pRunConn;    // 提交时指定的连接
+        COTLThreadLock            m_Lock;
+        COTLThreadCond            m_Cond;
+
+    private:
+        CDBAsyncQuery(const CDBAsyncQuery&);
+        CDBAsyncQuery& operator=(const CDBAsyncQuery&);
+    };
+
+    // 异步查询执行器：固定数量的执行线程从先进先出队列中取出查询执行，
+    // 并发执行的查询数等于线程数，调用线程不阻塞。在已获取的连接上执行的查询
+    // 单独排队并优先执行，需要从池中获取连接的查询最多占用thread_num-1个线程，
+    // 保证持有连接等待查询完成的调用者(如协程)不会因执行线程都在等待连接而死锁
+    // (此保证要求至少2个执行线程)
+    class CDBAsyncExecutor
+    {
+    public:
+        CDBAsyncExecutor(CDBConnPool *pPool);
+        virtual ~CDBAsyncExecutor();
+
+        bool Start(unsigned int thread_num, unsigned int max_queue, int acquire_timeout_ms);
+        // 停止：等待执行中的查询完成，排队中的查询以错误结束
+        void Stop(void);
+        bool Submit(CDBAsyncQuery *pQuery, CDBAppConn *pConn = NULL);
+        inline unsigned int GetQueueNum(void) { return m_nQueueNum; }
+
+    private:
+        static void ThreadFunc(void *pArg);
+        void WorkLoop(void);
+        CDBAsyncQuery *PopQueued(void);  // 调用前需持有m_Lock
+        static void PushQueue(CDBAsyncQuery *&pHead, CDBAsyncQuery *&pTail, CDBAsyncQuery *pQuery);
+
+        CDBConnPool    * m_pPool;
+        CDBAsyncQuery  * m_pHead;       // 需要获取连接的查询，先进先出
+        CDBAsyncQuery  * m_pTail;
+        CDBAsyncQuery  * m_pConnHead;   // 在已获取的连接上执行的查询，优先执行
+        CDBAsyncQuery  * m_pConnTail;
+        unsigned int     m_nQueueNum;
+        unsigned int     m_nAcquiring;  // 正在执行需要获取连接的查询的线程数
+        unsigned int     m_nMaxQueue;
+        int              m_nAcquireTimeoutMs;
+        bool             m_bStop;
+        COTLThread     * m_pThreads;
+        unsigned int     m_nThreadNum;
+        COTLThreadLock   m_Lock;
+        COTLThreadCond   m_Cond;
+
+    private:
+        CDBAsyncExecutor(const CDBAsyncExecutor&);
+        CDBAsyncExecutor& operator=(const CDBAsyncExecutor&);
+    };
+    /******************************************************************************************/
+    // 组提交的写入单元：输入变量按顺序以字符串绑定(SQL中声明为<char[N]>)，默认用缓存
+    // 语句执行；需要其他写法时派生并重载Apply。Apply不能提交，同一批中某个单元失败时
+    // 整批回滚并去掉该单元重新执行，因此Apply须可以重复执行
+    class CDBWriteUnit
+    {
+    public:
+        CDBWriteUnit(const char *sql = NULL);
+        virtual ~CDBWriteUnit();
+
+        inline void SetSql(const char *sql) { m_strSql = sql; }
+        CDBWriteUnit& Bind(const char *value);  // NULL为空值
+
+        // 等待提交完成，nTimeoutMs < 0 无限等待，超时返回false
+        bool Wait(int nTimeoutMs = -1);
+        inline bool IsDone(void) { return m_bDone; }
+        inline bool Good(void) { return m_bDone && m_strErrMsg.empty(); }
+        inline int GetErrCode(void) { return m_nErrCode; }
+        inline const char *GetLastError(void) { return m_strErrMsg.c_str(); }
+        inline long GetRpc(void) { return m_nRpc; }
+
+    protected:
+        // 在组提交线程上执行写入(不提交)，出错时抛出otl_exception
+        virtual void Apply(CDBAppConn& conn);
+        inline void SetRpc(long nRpc) { m_nRpc = nRpc; }
+
+        std::string               m_strSql;
+        std::vector<std::string>  m_vecBinds;
+        std::vector<char>         m_vecBindNull;
+
+    private:
+        friend class CDBGroupCommitter;
+
+        void Complete(int nErrCode, const char *msg);
+
+        volatile bool             m_bDone;
+        int                       m_nErrCode;
+        std::string               m_strErrMsg;
+        long                      m_nRpc;
+        CDBWriteUnit            * m_pNextQueued;
+        COTLThreadLock            m_Lock;
+        COTLThreadCond            m_Cond;
+
+    private:
+        CDBWriteUnit(const CDBWriteUnit&);
+        CDBWriteUnit& operator=(const CDBWriteUnit&);
+    };
+
+    // 组提交：收集多个线程提交的小写入单元，在第一个单元到达后window_ms毫秒内或达到
+    // max_batch个时，在一个连接上执行整批并只提交一次，再通知每个调用者；
+    // 以几毫秒的延时换取写入吞吐
+    //     CDBWriteUnit unit("insert into t values(:a<char[32]>)");
+    //     unit.Bind("1");
+    //     if( committer.Write(&unit) ) ...
+    class CDBGroupCommitter
+    {
+    public:
+        CDBGroupCommitter(CDBConnPool *pPool);
+        virtual ~CDBGroupCommitter();
+
+        bool Start(unsigned int window_ms = 2, unsigned int max_batch = 64, int acquire_timeout_ms = 5000);
+        // 停止：排队中的单元执行完后退出
+        void Stop(void);
+
+        // 提交写入单元(不接管)，已停止时返回false
+        bool Submit(CDBWriteUnit *pUnit);
+        // 提交并等待，成功提交到数据库返回true
+        bool Write(CDBWriteUnit *pUnit);
+
+        // 已提交的批次数/单元数
+        inline long long GetBatchNum(void) { return m_nBatchNum; }
+        inline long long GetUnitNum(void) { return m_nUnitNum; }
+
+    private:
+        static void ThreadFunc(void *pArg);
+        void WorkLoop(void);
+        void ApplyBatch(std::vector<CDBWriteUnit*>& vecBatch);
+
+        CDBConnPool        * m_pPool;
+        CDBWriteUnit       * m_pHead;           // 先进先出队列
+        CDBWriteUnit       * m_pTail;
+        unsigned int         m_nQueueNum;
+        unsigned long long   m_tFirstQueued;    // 队列中第一个单元的到达时间
+        unsigned int         m_nWindowMs;
+        unsigned int         m_nMaxBatch;
+        int                  m_nAcquireTimeoutMs;
+        bool                 m_bStop;
+        volatile long long   m_nBatchNum;
+        volatile long long   m_nUnitNum;
+        COTLThread           m_Thread;
+        COTLThreadLock       m_Lock;
+        COTLThreadCond       m_Cond;
+
+    private:
+        CDBGroupCommitter(const CDBGroupCommitter&);
+        CDBGroupCommitter& operator=(const CDBGroupCommitter&);
+    };
+    /******************************************************************************************/
+    // 查询结果：列名与按行存放的字符串值，加载完成后只读，由CDBResultRef引用计数共享
+    class CDBResultSet
+    {
+    public:
+        CDBResultSet();
+
+        inline bool Good(void) const { return m_strErrMsg.empty(); }
+        inline int GetErrCode(void) const { return m_nErrCode; }
+        inline const char *GetLastError(void) const { return m_strErrMsg.c_str(); }
+
+        inline int GetColumnNum(void) const { return (int)m_vecColumns.size(); }
+        inline const char *GetColumnName(int col) const { return m_vecColumns[col].c_str(); }
+        inline int GetRowNum(void) const { return m_vecColumns.empty() ? 0 : (int)(m_vecValues.size() / m_vecColumns.size()); }
+        // 获取第row行第col列的值，NULL值返回NULL
+        const char *GetValue(int row, int col) const;
+        // 占用的内存(估算)
+        inline size_t GetMemSize(void) const { return m_nMemSize; }
+
+        // 供加载时保存结果
+        void AddColumn(const char *name);
+        void AddValue(const char *value);
+        void SetError(int nErrCode, const char *msg);
+        // 用只进游标读取全部结果并转为字符串
+        void Fetch(CDBCursor& cur);
+
+        // 将当前行第col列转为字符串，NULL值返回NULL；szBuf至少64字节
+        static const char *FormatValue(const CDBRowView& row, int col, char *szBuf);
+
+    private:
+        friend class CDBResultRef;
+        friend class CDBResultCache;
+        friend class CDBParallelQuery;
+
+        ~CDBResultSet() {}
+        inline void AddRef(void) { AtomicAdd(&m_nRef, 1); }
+        inline void Release(void) { if( 0 == AtomicAdd(&m_nRef, -1) ) delete this; }
+
+        volatile long             m_nRef;
+        int                       m_nErrCode;
+        std::string               m_strErrMsg;
+        std::vector<std::string>  m_vecColumns;
+        std::vector<std::string>  m_vecValues;   // 按行存放
+        std::vector<char>         m_vecNull;
+        size_t                    m_nMemSize;
+
+    private:
+        CDBResultSet(const CDBResultSet&);
+        CDBResultSet& operator=(const CDBResultSet&);
+    };
+
+    // 查询结果的引用，可以复制，最后一个引用释放时删除结果
+    class CDBResultRef
+    {
+    public:
+        CDBResultRef() : m_pResult(NULL) {}
+        CDBResultRef(const CDBResultRef& other) : m_pResult(other.m_pResult) { if( m_pResult ) m_pResult->AddRef(); }
+        ~CDBResultRef() { Reset(); }
+        CDBResultRef& operator=(const CDBResultRef& other);
+
+        inline bool Good(void) const { return m_pResult && m_pResult->Good(); }
+        inline const char *GetLastError(void) const { return m_pResult ? m_pResult->GetLastError() : "NULL Result"; }
+        inline const CDBResultSet *operator->(void) const { return m_pResult; }
+        inline const CDBResultSet& operator*(void) const { return *m_pResult; }
+        void Reset(void);
+
+    private:
+        friend class CDBResultCache;
+        void Attach(CDBResultSet *pResult);  // 增加引用
+
+        CDBResultSet *m_pResult;
+    };
+
+    // 查询结果缓存(读穿透)：以SQL和输入变量为键缓存查询结果，适用于代码表、配置等
+    // 重复读取且很少修改的数据。
+    //   - 每条语句可以单独设置有效期，0为不缓存；
+    //   - 超过内存上限时淘汰最久未使用的结果；
+    //   - 同一键的并发未命中只有一个线程执行查询，其他线程等待其结果；
+    //   - 写入后调用Invalidate使相关结果失效，正在执行的查询结果不会进入缓存。
+    // 输入变量按顺序以字符串绑定(SQL中声明为<char[N]>)，NULL为空值；
+    // 需要其他读取方式时派生并重载Load
+    //     CDBResultCache cache(&pool);
+    //     cache.Init(16 << 20, 60000);
+    //     const char *binds[] = { "CN" };
+    //     CDBResultRef res;
+    //     if( cache.Query("select name from country where code = :c<char[8]>", binds, 1, res) )
+    //         res->GetValue(0, 0);
+    class CDBResultCache
+    {
+    public:
+        CDBResultCache(CDBConnPool *pPool);
+        virtual ~CDBResultCache();
+
+        // 设置内存上限(字节)、默认有效期(毫秒)、获取连接的等待超时(毫秒)
+        void Init(size_t nMaxBytes = 64 << 20, unsigned int nDefaultTTLMs = 60000, int nAcquireTimeoutMs = 5000);
+        // 单独设置某条语句的有效期(毫秒)，0为不缓存
+        void SetStatementTTL(const char *sql, unsigned int nTTLMs);
+
+        // 查询，命中时不访问数据库；result总是被设置，失败时返回false，错误见result.GetLastError()
+        inline bool Query(const char *sql, CDBResultRef& result) { return Query(sql, NULL, 0, result); }
+        bool Query(const char *sql, const char * const *binds, int nBinds, CDBResultRef& result);
+
+        // 使指定语句+输入变量的结果失效
+        void Invalidate(const char *sql, const char * const *binds, int nBinds);
+        // 使指定语句所有输入变量的结果失效
+        void Invalidate(const char *sql);
+        void Clear(void);
+
+        // 统计
+        inline long long GetHitNum(void) { return m_nHitNum; }
+        inline long long GetMissNum(void) { return m_nMissNum; }
+        inline long long GetEvictNum(void) { return m_nEvictNum; }
+        inline size_t GetMemSize(void) { return m_nMemSize; }
+        inline size_t GetEntryNum(void) { return m_mapEntry.size(); }
+
+    protected:
+        // 未命中时用已获取的连接执行查询并保存结果，出错时抛出otl_exception
+        virtual void Load(CDBAppConn& conn, const char *sql, const char * const *binds, int nBinds, CDBResultSet& result);
+
+    private:
+        struct SEntry
+        {
+            std::string         strKey;
+            CDBResultSet      * pResult;    // 加载中为NULL
+            unsigned long long  tExpire;
+            size_t              nMemSize;
+            bool                bLoading;
+            bool                bDetached;  // 已从缓存中移除，最后一个等待者负责删除
+            int                 nWaiters;
+            SEntry            * pPrev;      // LRU链表，加载中的不在链表中
+            SEntry            * pNext;
+        };
+        typedef std::map<std::string, SEntry*> EntryMap;
+
+        static void MakeKey(std::string& strKey, const char *sql, const char * const *binds, int nBinds);
+        unsigned int GetTTL(const char *sql);
+        CDBResultSet *LoadResult(const char *sql, const char * const *binds, int nBinds);
+        // 以下调用前需持有m_Lock
+        void LinkFront(SEntry *pEntry);
+        void Unlink(SEntry *pEntry);
+        void Detach(SEntry *pEntry);
+        void FreeEntry(SEntry *pEntry);
+        void Evict(void);
+
+        CDBConnPool                       * m_pPool;
+        size_t                              m_nMaxBytes;
+        unsigned int                        m_nDefaultTTLMs;
+        int                                 m_nAcquireTimeoutMs;
+        std::map<std::string, unsigned int> m_mapTTL;
+        EntryMap                            m_mapEntry;
+        SEntry                            * m_pHead;      // 最近使用
+        SEntry                            * m_pTail;      // 最久未使用
+        size_t                              m_nMemSize;
+        long long                           m_nHitNum;
+        long long                           m_nMissNum;
+        long long                           m_nEvictNum;
+        COTLThreadLock                      m_Lock;
+        COTLThreadCond                      m_Cond;       // 加载完成
+
+    private:
+        CDBResultCache(const CDBResultCache&);
+        CDBResultCache& operator=(const CDBResultCache&);
+    };
+
+    // 分区并行查询：把一个大查询按分区拆开，在连接池的多个连接上并发执行，结果合并为
+    // 一个只进的结果流。输入变量按顺序以字符串绑定，公共输入变量在前，分区的在后：
+    //   - 键范围：AddRange(lo, hi)，模板如"... where id >= :lo<char[32]> and id < :hi<char[32]>"，
+    //     ROWID范围(如DBMS_PARALLEL_EXECUTE生成的块)同样用AddRange给出；
+    //   - 哈希桶：AddBuckets(n)，第i个分区绑定n和i，模板如
+    //     "... where mod(ora_hash(rowid), :n<char[12]>) = :b<char[12]>"。
+    // 不排序时先完成的分区先返回；SetOrderBy后各分区须按同一列排序(模板中的order by)，
+    // 全部完成后按该列归并。每个分区读取完整后才返回，分区数应使单个分区可以放入内存。
+    // 需要其他读取方式时派生并重载Load
+    //     CDBParallelQuery query(&pool);
+    //     query.SetSql("select ... where id >= :lo<char[32]> and id < :hi<char[32]>");
+    //     query.AddRange("0", "1000000");
+    //     query.AddRange("1000000", "2000000");
+    //     if( query.Run(4) )
+    //         while( query.Next() )
+    //             query.GetValue(0);
+    class CDBParallelQuery
+    {
+    public:
+        CDBParallelQuery(CDBConnPool *pPool);
+        virtual ~CDBParallelQuery();
+
+        // 设置SQL模板、公共输入变量(NULL为空值)和分区，须在Run之前调用
+        inline void SetSql(const char *sql) { m_strSql = sql; }
+        CDBParallelQuery& Bind(const char *value);
+        void AddRange(const char *lo, const char *hi);
+        void AddBuckets(int nBuckets);
+        // 按第col列归并，bNumeric为按数值比较，bDesc为降序；NULL值排在最后
+        void SetOrderBy(int col, bool bNumeric = false, bool bDesc = false);
+
+        // 启动执行并立即返回：最多使用max_conns个连接，每个连接由一个线程依次领取分区执行；
+        // 获取连接超时的线程退出，剩余分区由其他线程执行
+        bool Run(unsigned int max_conns, int acquire_timeout_ms = -1);
+        // 等待全部分区完成，返回是否全部成功
+        bool Wait(void);
+
+        // 合并后的结果流：移动到下一行，没有更多行或有分区失败时返回false
+        bool Next(void);
+        // 当前行所在分区的列，Next返回true后可用
+        int GetColumnNum(void);
+        const char *GetColumnName(int col);
+        // 当前行第col列的值，NULL值返回NULL
+        const char *GetValue(int col);
+        inline long GetRowCount(void) { return m_nRowCount; }
+
+        inline bool Good(void) { return !m_bFailed; }
+        inline const char *GetLastError(void) { return m_strErrMsg.c_str(); }
+        inline int GetPartitionNum(void) { return (int)m_vecParts.size(); }
+
+    protected:
+        // 用已获取的连接执行一个分区并保存结果，出错时抛出otl_exception
+        virtual void Load(CDBAppConn& conn, const char *sql, const char * const *binds, int nBinds, CDBResultSet& result);
+
+    private:
+        struct SPartition
+        {
+            std::vector<std::string>  vecBinds;
+            CDBResultSet            * pResult;  // 完成前为NULL
+            int                       nCurRow;  // 归并时的读取位置
+        };
+
+        static void WorkerFunc(void *pArg);
+        void WorkLoop(void);
+        void RunPartition(CDBAppConn& conn, SPartition& part);
+        void Fail(const char *msg);     // 调用前需持有m_Lock
+        void Clear(void);
+        bool NextMerged(void);
+        int  CompareRows(SPartition& a, SPartition& b);
+
+        CDBConnPool               * m_pPool;
+        std::string                 m_strSql;
+        std::vector<std::string>    m_vecBinds;
+        std::vector<char>           m_vecBindNull;
+        std::vector<SPartition>     m_vecParts;
+        int                         m_nOrderCol;    // < 0 不排序
+        bool                        m_bNumeric;
+        bool                        m_bDesc;
+        int                         m_nAcquireTimeoutMs;
+        COTLThread                * m_pThreads;
+        unsigned int                m_nThreadNum;
+        unsigned int                m_nActiveNum;   // 未退出的线程(m_Lock)
+        volatile long               m_nNextPart;    // 下一个待领取的分区
+        std::vector<int>            m_vecDone;      // 按完成顺序的分区(m_Lock)
+        volatile bool               m_bFailed;
+        std::string                 m_strErrMsg;    // 第一个错误
+        size_t                      m_nConsumed;    // 不排序时已开始读取的完成分区数
+        CDBResultSet              * m_pCurResult;   // 当前行所在的结果
+        int                         m_nCurRow;
+        long                        m_nRowCount;
+        bool                        m_bMergeReady;  // 排序时已等待全部完成
+        COTLThreadLock              m_Lock;
+        COTLThreadCond              m_Cond;         // 分区完成
+
     private:
-        CDBConn     * m_pConn;
-        CDBConnPool * m_pPool;
+        CDBParallelQuery(const CDBParallelQuery&);
+        CDBParallelQuery& operator=(const CDBParallelQuery&);
     };
     /******************************************************************************************/
     // 单件连接池类
@@ -0,0 +1,365 @@
+/*****************************************************************************************
+File name   : dbsim.cpp
+Version     : V1.0
+Description : 进程内模拟数据库后端，用于无数据库环境下的连接池性能测试
+Others      : 
+******************************************************************************************/
+
+#include "dbsim.h"
+
+/******************************************************************************************/
+
+namespace OTL
+{
+    /*****************************************************************
+
+        CDBSimBackend 模拟数据库后端
+
+    *****************************************************************/
+    CDBSimBackend::CDBSimBackend()
+        : m_nConnectUs(0)
+        , m_nQueryUs(0)
+        , m_nCommitUs(0)
+        , m_nSeed(1)
+        , m_dConnectErrRate(0)
+        , m_nConnectErrCode(0)
+        , m_dQueryErrRate(0)
+        , m_nQueryErrCode(0)
+        , m_nInjectConnectCode(0)
+        , m_nInjectConnectNum(0)
+        , m_nInjectQueryCode(0)
+        , m_nInjectQueryNum(0)
+        , m_nEpoch(0)
+        , m_bServerDown(false)
+        , m_nSessionNum(0)
+        , m_nLogonNum(0)
+        , m_nQueryNum(0)
+        , m_nCommitNum(0)
+        , m_nErrorNum(0)
+    {
+    }
+    CDBSimBackend::~CDBSimBackend()
+    {
+    }
+    CDBSession * CDBSimBackend::CreateSession(void)
+    {
+        return new CDBSimSession(this);
+    }
+    void CDBSimBackend::SetConnectLatency(unsigned int nUs)
+    {
+        m_nConnectUs = nUs;
+    }
+    void CDBSimBackend::SetCommitLatency(unsigned int nUs)
+    {
+        m_nCommitUs = nUs;
+    }
+    void CDBSimBackend::SetQueryLatency(unsigned int nUs)
+    {
+        m_nQueryUs = nUs;
+    }
+    void CDBSimBackend::SetQueryLatency(const char *sql, unsigned int nUs)
+    {
+        m_Lock.Lock();
+        m_mapQueryUs[sql] = nUs;
+        m_Lock.Unlock();
+    }
+    /*****************************************************************
+    Function    : CDBSimBackend::GetQueryLatency
+    Description : 获取语句的执行延时，未单独设置时返回默认值
+    Input       : 
+        @ sql   : SQL语句
+    Return      : 延时(微秒)
+    ******************************************************************/
+    unsigned int CDBSimBackend::GetQueryLatency(const char *sql)
+    {
+        unsigned int nUs = m_nQueryUs;
+        m_Lock.Lock();
+        if( !m_mapQueryUs.empty() )
+        {
+            std::map<std::string, unsigned int>::const_iterator it = m_mapQueryUs.find(sql);
+            if( it != m_mapQueryUs.end() )
+                nUs = it->second;
+        }
+        m_Lock.Unlock();
+        return nUs;
+    }
+
+    void CDBSimBackend::SetSeed(unsigned int nSeed)
+    {
+        m_Lock.Lock();
+        m_nSeed = nSeed;
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::SetConnectError(double dRate, int nErrCode)
+    {
+        m_Lock.Lock();
+        m_dConnectErrRate = dRate;
+        m_nConnectErrCode = nErrCode;
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::SetQueryError(double dRate, int nErrCode)
+    {
+        m_Lock.Lock();
+        m_dQueryErrRate = dRate;
+        m_nQueryErrCode = nErrCode;
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::InjectConnectError(int nErrCode, int nCount /* = 1 */)
+    {
+        m_Lock.Lock();
+        m_nInjectConnectCode = nErrCode;
+        m_nInjectConnectNum  = nCount;
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::InjectQueryError(int nErrCode, int nCount /* = 1 */)
+    {
+        m_Lock.Lock();
+        m_nInjectQueryCode = nErrCode;
+        m_nInjectQueryNum  = nCount;
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::AddResultColumn(const char *name, int nType, int nSize /* = 0 */)
+    {
+        SCursorColumn col;
+        col.strName = name;
+        col.nType   = nType;
+        col.nSize   = nSize;
+        col.nOffset = 0;
+        m_Lock.Lock();
+        m_vecResultColumns.push_back(col);
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::AddResultRow(const char * const *values)
+    {
+        m_Lock.Lock();
+        for( size_t i = 0; i < m_vecResultColumns.size(); ++i )
+        {
+            m_vecResultValues.push_back(values[i] ? values[i] : "");
+            m_vecResultNull.push_back(values[i] ? 0 : 1);
+        }
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::ClearResult(void)
+    {
+        m_Lock.Lock();
+        m_vecResultColumns.clear();
+        m_vecResultValues.clear();
+        m_vecResultNull.clear();
+        m_Lock.Unlock();
+    }
+    void CDBSimBackend::DisconnectAll(void)
+    {
+        AtomicAdd(&m_nEpoch, 1);
+    }
+    void CDBSimBackend::SetServerDown(bool bDown)
+    {
+        if( bDown && !m_bServerDown )
+            DisconnectAll();
+        m_bServerDown = bDown;
+    }
+    /*****************************************************************
+    Function    : CDBSimBackend::PickError
+    Description : 检查本次登录/执行是否注入错误，先消耗指定次数的错误，
+                  再按概率产生随机错误
+    Input       : 
+        @ bConnect : 登录(true)或执行(false)
+    Return      : 错误码，0为不注入
+    ******************************************************************/
+    int CDBSimBackend::PickError(bool bConnect)
+    {
+        int *pInjectNum = bConnect ? &m_nInjectConnectNum : &m_nInjectQueryNum;
+        double dRate    = bConnect ? m_dConnectErrRate : m_dQueryErrRate;
+        int nErrCode    = 0;
+
+        m_Lock.Lock();
+        if( *pInjectNum > 0 )
+        {
+            --*pInjectNum;
+            nErrCode = bConnect ? m_nInjectConnectCode : m_nInjectQueryCode;
+        }
+        else if( dRate > 0 )
+        {
+            m_nSeed = m_nSeed * 1103515245U + 12345U;
+            if( ((m_nSeed >> 8) & 0xFFFFFF) < dRate * 0x1000000 )
+                nErrCode = bConnect ? m_nConnectErrCode : m_nQueryErrCode;
+        }
+        m_Lock.Unlock();
+
+        if( nErrCode != 0 )
+            AtomicAdd64(&m_nErrorNum, 1);
+        return nErrCode;
+    }
+    /*****************************************************************
+    Function    : CDBSimBackend::ThrowError
+    Description : 按ORA错误号构造与OCI一致的错误信息并抛出otl_exception
+    Input       : 
+        @ nErrCode : ORA错误号
+    ******************************************************************/
+    void CDBSimBackend::ThrowError(int nErrCode)
+    {
+        const char *szText = "simulated error";
+        switch( nErrCode )
+        {
+        case 1:     szText = "unique constraint violated"; break;
+        case 60:    szText = "deadlock detected while waiting for resource"; break;
+        case 1013:  szText = "user requested cancel of current operation"; break;
+        case 3113:  szText = "end-of-file on communication channel"; break;
+        case 3114:  szText = "not connected to ORACLE"; break;
+        case 3135:  szText = "connection lost contact"; break;
+        case 12541: szText = "TNS:no listener"; break;
+        default: break;
+        }
+        char szMsg[128] = { 0 };
+        sprintf(szMsg, "ORA-%05d: %s", nErrCode, szText);
+        throw otl_exception(szMsg, nErrCode);
+    }
+
+    /*****************************************************************
+
+        CDBSimRowSource 模拟查询结果来源
+
+    *****************************************************************/
+    class CDBSimRowSource : public CDBRowSource
+    {
+    public:
+        CDBSimRowSource() : m_nPos(0) {}
+
+        virtual void Describe(std::vector<SCursorColumn>& vecColumns) { vecColumns = m_vecColumns; }
+        virtual bool Eof(void) { return m_nPos >= m_vecValues.size(); }
+        virtual bool Read(const SCursorColumn& col, char *p);
+
+        std::vector<SCursorColumn>  m_vecColumns;
+        std::vector<std::string>    m_vecValues;
+        std::vector<char>           m_vecNull;
+        size_t                      m_nPos;     // 下一个值的位置
+    };
+    /*****************************************************************
+    Function    : CDBSimRowSource::Read
+    Description : 把下一个值从文本转换为列的类型写入p
+    Input       : 
+        @ col   : 列描述
+    Output      : 
+        @ p     : 列数据
+    Return      : 是否为NULL
+    ******************************************************************/
+    bool CDBSimRowSource::Read(const SCursorColumn& col, char *p)
+    {
+        const char *szValue = (m_nPos < m_vecValues.size()) ? m_vecValues[m_nPos].c_str() : "";
+        bool bNull = (m_nPos < m_vecNull.size()) ? (m_vecNull[m_nPos] != 0) : true;
+        ++m_nPos;
+
+        switch( col.nType )
+        {
+        case otl_var_char:
+            strncpy(p, szValue, col.nSize - 1);
+            p[col.nSize - 1] = '\0';
+            break;
+        case otl_var_int:       *(int *)p    = atoi(szValue);  break;
+        case otl_var_long_int:  *(long *)p   = atol(szValue);  break;
+        case otl_var_double:    *(double *)p = atof(szValue);  break;
+        case otl_var_timestamp:
+            if( bNull || !ConvertOtlDatetime(*(otl_datetime *)p, szValue) )
+                *(otl_datetime *)p = otl_datetime();
+            break;
+        default:
+            throw runtime_error("unsupported column type in simulated result");
+        }
+        return bNull;
+    }
+
+    /*****************************************************************
+
+        CDBSimSession 模拟会话
+
+    *****************************************************************/
+    CDBSimSession::CDBSimSession(CDBSimBackend *pBackend)
+        : m_pBackend(pBackend)
+        , m_bConnected(false)
+        , m_nEpoch(0)
+    {
+    }
+    CDBSimSession::~CDBSimSession()
+    {
+        Logoff();
+    }
+    void CDBSimSession::Logon(const char * /*conn_str*/)
+    {
+        SleepUs(m_pBackend->m_nConnectUs);
+        AtomicAdd64(&m_pBackend->m_nLogonNum, 1);
+        if( m_pBackend->m_bServerDown )
+            CDBSimBackend::ThrowError(12541);
+        int nErrCode = m_pBackend->PickError(true);
+        if( nErrCode != 0 )
+            CDBSimBackend::ThrowError(nErrCode);
+
+        m_nEpoch = m_pBackend->m_nEpoch;
+        if( !m_bConnected )
+        {
+            m_bConnected = true;
+            AtomicAdd(&m_pBackend->m_nSessionNum, 1);
+        }
+    }
+    void CDBSimSession::Logoff(void)
+    {
+        if( m_bConnected )
+        {
+            m_bConnected = false;
+            AtomicAdd(&m_pBackend->m_nSessionNum, -1);
+        }
+    }
+    void CDBSimSession::Commit(void)
+    {
+        CheckConnected();
+        AtomicAdd64(&m_pBackend->m_nCommitNum, 1);
+        SleepUs(m_pBackend->m_nCommitUs);
+    }
+    void CDBSimSession::Rollback(void)
+    {
+        CheckConnected();
+    }
+    long CDBSimSession::Execute(const char *sql)
+    {
+        CheckConnected();
+        AtomicAdd64(&m_pBackend->m_nQueryNum, 1);
+        SleepUs(m_pBackend->GetQueryLatency(sql));
+        int nErrCode = m_pBackend->PickError(false);
+        if( nErrCode != 0 )
+            CDBSimBackend::ThrowError(nErrCode);
+        return 0;
+    }
+    void CDBSimSession::Ping(void)
+    {
+        CheckConnected();
+    }
+    /*****************************************************************
+    Function    : CDBSimSession::OpenRowSource
+    Description : 按Execute模拟执行查询，返回后端设置的查询结果的副本
+    Input       : 
+        @ sql   : SQL语句
+    Return      : 结果来源，调用者用delete释放
+    ******************************************************************/
+    CDBRowSource * CDBSimSession::OpenRowSource(const char *sql)
+    {
+        Execute(sql);
+
+        CDBSimRowSource *pSource = new CDBSimRowSource;
+        m_pBackend->m_Lock.Lock();
+        pSource->m_vecColumns = m_pBackend->m_vecResultColumns;
+        pSource->m_vecValues  = m_pBackend->m_vecResultValues;
+        pSource->m_vecNull    = m_pBackend->m_vecResultNull;
+        m_pBackend->m_Lock.Unlock();
+        return pSource;
+    }
+    /*****************************************************************
+    Function    : CDBSimSession::CheckConnected
+    Description : 按OCI的行为检查会话：未登录抛出ORA-03114，登录后后端
+                  发生过断线则抛出ORA-03113(会话仍为已连接状态，需重连)
+    ******************************************************************/
+    void CDBSimSession::CheckConnected(void)
+    {
+        if( !m_bConnected )
+            CDBSimBackend::ThrowError(3114);
+        if( m_nEpoch != m_pBackend->m_nEpoch )
+            CDBSimBackend::ThrowError(3113);
+    }
+}
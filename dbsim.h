@@ -0,0 +1,125 @@
+/*****************************************************************************************
+File name   : dbsim.h
+Version     : V1.0
+Description : 进程内模拟数据库后端，用于无数据库环境下的连接池性能测试
+Others      : 
+******************************************************************************************/
+
+#ifndef __YZ_DBSIM_H__
+#define __YZ_DBSIM_H__
+
+#include "dbpool.h"
+
+namespace OTL
+{
+    /******************************************************************************************/
+    // 模拟数据库后端：可配置连接延时、(按SQL)执行延时、错误注入与断线，
+    // 不访问任何数据库。随机错误由固定种子的伪随机数产生，相同种子可重现
+    class CDBSimBackend : public CDBBackend
+    {
+    public:
+        CDBSimBackend();
+        virtual ~CDBSimBackend();
+
+        virtual CDBSession *CreateSession(void);
+
+        // 延时设置，单位微秒
+        void SetConnectLatency(unsigned int nUs);
+        void SetQueryLatency(unsigned int nUs);                  // 未单独设置的语句
+        void SetQueryLatency(const char *sql, unsigned int nUs); // 指定语句
+        void SetCommitLatency(unsigned int nUs);                 // 提交(模拟日志刷盘)
+
+        unsigned int GetConnectLatency(void) { return m_nConnectUs; }
+        unsigned int GetCommitLatency(void) { return m_nCommitUs; }
+        unsigned int GetQueryLatency(const char *sql);
+
+        // 错误注入，错误码为ORA错误号(如3113)，0为关闭
+        void SetSeed(unsigned int nSeed);
+        void SetConnectError(double dRate, int nErrCode);  // 登录按概率失败
+        void SetQueryError(double dRate, int nErrCode);    // 执行按概率失败
+        void InjectConnectError(int nErrCode, int nCount = 1); // 之后的nCount次登录失败
+        void InjectQueryError(int nErrCode, int nCount = 1);   // 之后的nCount次执行失败
+
+        // 查询结果：CDBCursor在模拟会话上读取，所有查询返回相同的结果(不使用输入变量)，
+        // 未设置时为空结果集。列类型支持otl_var_char(nSize为最大长度)、otl_var_int、
+        // otl_var_long_int、otl_var_double和otl_var_timestamp，值均为文本，NULL为空值，
+        // 日期时间的格式同ConvertOtlDatetime
+        void AddResultColumn(const char *name, int nType, int nSize = 0);
+        void AddResultRow(const char * const *values);  // 按列的顺序，个数为列数
+        void ClearResult(void);
+
+        // 断线：已登录的会话之后的调用均抛出ORA-03113，直到重新登录
+        void DisconnectAll(void);
+        // 服务器停机：登录抛出ORA-12541，已登录的会话同DisconnectAll
+        void SetServerDown(bool bDown);
+
+        // 当前已登录的会话数/累计登录、执行、提交、注入错误的次数
+        inline long GetSessionNum(void) { return m_nSessionNum; }
+        inline long long GetLogonNum(void) { return m_nLogonNum; }
+        inline long long GetQueryNum(void) { return m_nQueryNum; }
+        inline long long GetCommitNum(void) { return m_nCommitNum; }
+        inline long long GetErrorNum(void) { return m_nErrorNum; }
+
+        // 按ORA错误号抛出otl_exception
+        static void ThrowError(int nErrCode);
+
+    private:
+        friend class CDBSimSession;
+
+        // 检查是否应注入错误(登录/执行)，返回错误码，0为不注入
+        int  PickError(bool bConnect);
+
+        volatile unsigned int               m_nConnectUs;
+        volatile unsigned int               m_nQueryUs;
+        volatile unsigned int               m_nCommitUs;
+        std::map<std::string, unsigned int> m_mapQueryUs;
+
+        unsigned int                        m_nSeed;
+        double                              m_dConnectErrRate;
+        int                                 m_nConnectErrCode;
+        double                              m_dQueryErrRate;
+        int                                 m_nQueryErrCode;
+        int                                 m_nInjectConnectCode;
+        int                                 m_nInjectConnectNum;
+        int                                 m_nInjectQueryCode;
+        int                                 m_nInjectQueryNum;
+        std::vector<SCursorColumn>          m_vecResultColumns;
+        std::vector<std::string>            m_vecResultValues;  // 按行优先
+        std::vector<char>                   m_vecResultNull;
+        volatile long                       m_nEpoch;       // 每次断线加1
+        volatile bool                       m_bServerDown;
+
+        volatile long                       m_nSessionNum;
+        volatile long long                  m_nLogonNum;
+        volatile long long                  m_nQueryNum;
+        volatile long long                  m_nCommitNum;
+        volatile long long                  m_nErrorNum;
+        COTLThreadLock                      m_Lock;
+    };
+
+    // 模拟会话
+    class CDBSimSession : public CDBSession
+    {
+    public:
+        CDBSimSession(CDBSimBackend *pBackend);
+        virtual ~CDBSimSession();
+
+        virtual void Logon(const char *conn_str);
+        virtual void Logoff(void);
+        virtual bool IsConnected(void) { return m_bConnected; }
+        virtual void Commit(void);
+        virtual void Rollback(void);
+        virtual long Execute(const char *sql);
+        virtual void Ping(void);
+        virtual CDBRowSource *OpenRowSource(const char *sql);
+
+    private:
+        void CheckConnected(void);
+
+        CDBSimBackend * m_pBackend;
+        bool            m_bConnected;
+        long            m_nEpoch;       // 登录时后端的断线代数
+    };
+}
+
+#endif //__YZ_DBSIM_H__